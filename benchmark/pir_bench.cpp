@@ -0,0 +1,322 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+#include "pir_aggregate.hpp"
+#include "pir_lwe.hpp"
+#include "pir_psi.hpp"
+#include "pir_xor.hpp"
+
+#include <seal/seal.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+
+using namespace std::chrono;
+using namespace std;
+using namespace seal;
+
+// Kernel microbenchmarks. Each kernel is set up once, warmed up, then timed
+// `repetitions` times; the summary goes to stdout as JSON, progress to stderr.
+//
+// pir_bench [filter] [repetitions] [log2 items] [item size] [N] [logt]
+
+struct BenchResult {
+    string name;
+    vector<double> seconds; // one entry per repetition
+    uint64_t bytes;         // bytes processed per repetition, 0 if n/a
+    long peak_rss_kb;
+    uint32_t threads;
+};
+
+static uint32_t thread_count() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return stoul(line.substr(8));
+        }
+    }
+    return 1;
+}
+
+static long peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// nearest-rank percentile of sorted samples
+static double percentile(const vector<double> &sorted, double p) {
+    size_t rank = ceil(p * sorted.size());
+    return sorted[min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+class Bench {
+public:
+    Bench(const string &filter, uint32_t repetitions)
+        : filter_(filter), repetitions_(repetitions) {}
+
+    // Runs fn once to warm up, then repetitions times
+    void run(const string &name, uint64_t bytes, const function<void()> &fn) {
+        if (name.find(filter_) == string::npos) {
+            return;
+        }
+        cerr << "Bench: " << name << endl;
+        fn();
+        BenchResult result{name, {}, bytes, 0, 0};
+        for (uint32_t i = 0; i < repetitions_; i++) {
+            auto start = high_resolution_clock::now();
+            fn();
+            result.seconds.push_back(
+                duration<double>(high_resolution_clock::now() - start).count());
+        }
+        result.peak_rss_kb = peak_rss_kb();
+        result.threads = thread_count();
+        results_.push_back(move(result));
+    }
+
+    bool wants(const string &prefix) const {
+        return prefix.find(filter_) != string::npos ||
+               filter_.find(prefix) != string::npos;
+    }
+
+    void print_json(const string &config) const {
+        cout << "{\n  \"config\": " << config << ",\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results_.size(); i++) {
+            const BenchResult &r = results_[i];
+            vector<double> sorted = r.seconds;
+            sort(sorted.begin(), sorted.end());
+            double median = percentile(sorted, 0.5);
+            cout << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\""
+                 << ", \"repetitions\": " << sorted.size()
+                 << ", \"min_us\": " << sorted.front() * 1e6
+                 << ", \"median_us\": " << median * 1e6
+                 << ", \"p99_us\": " << percentile(sorted, 0.99) * 1e6
+                 << ", \"bytes_per_second\": " << (r.bytes ? r.bytes / median : 0)
+                 << ", \"peak_rss_kb\": " << r.peak_rss_kb
+                 << ", \"threads\": " << r.threads << "}";
+        }
+        cout << "\n  ]\n}" << endl;
+    }
+
+private:
+    string filter_;
+    uint32_t repetitions_;
+    vector<BenchResult> results_;
+};
+
+int main(int argc, char *argv[]) {
+    string filter = argc > 1 ? argv[1] : "";
+    uint32_t repetitions = argc > 2 ? stoi(argv[2]) : 20;
+    uint8_t dim_of_items_number = argc > 3 ? stoi(argv[3]) : 14;
+    uint64_t number_of_items = 1UL << dim_of_items_number;
+    uint64_t size_per_item = argc > 4 ? stoi(argv[4]) : 288; // in bytes
+    uint32_t N = argc > 5 ? stoi(argv[5]) : 4096;
+    uint32_t logt = argc > 6 ? stoi(argv[6]) : 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+
+    Bench bench(filter, repetitions);
+    mt19937_64 gen(42);
+
+    // Packers over 1 MiB of elements
+    {
+        uint64_t ele_num = (1 << 20) / size_per_item;
+        uint64_t cpe = coefficients_per_element(logt, size_per_item);
+        vector<uint8_t> bytes(ele_num * size_per_item);
+        for (auto &b : bytes) {
+            b = gen();
+        }
+        vector<uint64_t> coeffs(ele_num * cpe);
+        bench.run("bytes_to_coeffs", bytes.size(), [&]() {
+            for (uint64_t e = 0; e < ele_num; e++) {
+                bytes_to_coeffs(logt, bytes.data() + e * size_per_item, size_per_item,
+                                coeffs.data() + e * cpe);
+            }
+        });
+        bench.run("coeffs_to_bytes", bytes.size(), [&]() {
+            coeffs_to_bytes(logt, coeffs.data(), coeffs.size(), bytes.data(),
+                            bytes.size(), size_per_item);
+        });
+    }
+
+    // XOR PIR: one selection vector over the same database
+    if (bench.wants("xor_scan")) {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = gen();
+        }
+        unique_ptr<const uint8_t[]> bytes(move(db));
+        XorPirServer server;
+        server.set_num_threads(1);
+        server.set_database(bytes, number_of_items, size_per_item);
+        XorPirClient client(number_of_items, size_per_item, 2);
+        XorQuery query = client.generate_query(gen() % number_of_items)[0];
+        bench.run("xor_scan", number_of_items * size_per_item,
+                  [&]() { server.generate_reply(query); });
+    }
+
+    if (bench.wants("dpf_eval") || bench.wants("dpf_reply")) {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = gen();
+        }
+        unique_ptr<const uint8_t[]> bytes(move(db));
+        XorPirServer server;
+        server.set_num_threads(1);
+        server.set_database(bytes, number_of_items, size_per_item);
+        XorPirClient client(number_of_items, size_per_item, 2);
+        DpfKey key = client.generate_dpf_query(gen() % number_of_items)[0];
+        ThreadPool pool(1);
+        // full-domain expansion alone, then expansion plus the scan
+        bench.run("dpf_eval", 0, [&]() { dpf_eval_full(key, number_of_items, pool); });
+        bench.run("dpf_reply", number_of_items * size_per_item,
+                  [&]() { server.generate_reply(key); });
+    }
+
+    if (bench.wants("lwe_scan")) {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = gen();
+        }
+        unique_ptr<const uint8_t[]> bytes(move(db));
+        LwePirServer server;
+        server.set_num_threads(1);
+        server.set_database(bytes, number_of_items, size_per_item);
+        LwePirClient client(server.hint());
+        LweQuerySecret secret;
+        LweQuery query = client.generate_query(gen() % number_of_items, secret);
+        bench.run("lwe_scan", number_of_items * size_per_item,
+                  [&]() { server.generate_reply(query); });
+    }
+
+    if (bench.wants("psi_reply")) {
+        // the product tree needs the larger ring
+        EncryptionParameters psi_params(scheme_type::bfv);
+        gen_encryption_params(8192, logt, psi_params);
+        vector<uint64_t> blacklist(number_of_items);
+        for (auto &id : blacklist) {
+            id = gen();
+        }
+        PsiServer server(psi_params);
+        server.set_blacklist(blacklist);
+        PsiClient client(psi_params);
+        server.set_relin_keys(0, client.generate_relin_keys());
+        vector<uint64_t> ids(client.capacity());
+        for (auto &id : ids) {
+            id = gen();
+        }
+        PsiQuery query = client.generate_query(ids);
+        bench.run("psi_reply", 0, [&]() { server.generate_reply(query, 0); });
+    }
+
+    if (bench.wants("aggregate_reply")) {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = gen();
+        }
+        unique_ptr<const uint8_t[]> bytes(move(db));
+        AggregateServer server(enc_params);
+        server.set_database(bytes, number_of_items, size_per_item,
+                            aggregate_field_bytes(0, 1));
+        AggregateClient client(enc_params, number_of_items);
+        server.set_galois_keys(0, client.generate_galois_keys());
+        vector<uint64_t> indices;
+        for (uint64_t i = 0; i < number_of_items; i += 2) {
+            indices.push_back(i);
+        }
+        AggregateQuery query = client.generate_query(indices);
+        bench.run("aggregate_reply", number_of_items * size_per_item,
+                  [&]() { server.generate_reply(query, 0); });
+    }
+
+    if (bench.wants("first_dimension_compact")) {
+        PIRClient client(enc_params, pir_params);
+        PIRServer server(enc_params, pir_params);
+        server.set_galois_key(0, client.generate_galois_keys());
+        server.set_compact_residency(true);
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = gen();
+        }
+        server.set_database(move(db), number_of_items, size_per_item);
+        PirQuery query = client.generate_query(gen() % pir_params.num_of_plaintexts);
+        bench.run("first_dimension_compact", number_of_items * size_per_item,
+                  [&]() { server.generate_partial_reply(query, 0); });
+    }
+
+    if (bench.wants("expand_query") || bench.wants("first_dimension") ||
+        bench.wants("decompose") || bench.wants("serialize") ||
+        bench.wants("deserialize") || bench.wants("decode")) {
+        PIRClient client(enc_params, pir_params);
+        PIRServer server(enc_params, pir_params);
+        server.set_galois_key(0, client.generate_galois_keys());
+
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = gen();
+        }
+        server.set_database(move(db), number_of_items, size_per_item);
+
+        uint64_t ele_index = gen() % number_of_items;
+        uint64_t offset = client.get_fv_offset(ele_index);
+        PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+
+        for (uint64_t n_i = 16; n_i <= N; n_i *= 4) {
+            bench.run("expand_query/" + to_string(n_i), 0,
+                      [&]() { server.expand_query(query[0][0], n_i, 0); });
+        }
+
+        // expansion of dimension 0 plus the scan of the whole database
+        bench.run("first_dimension", number_of_items * size_per_item,
+                  [&]() { server.generate_partial_reply(query, 0); });
+
+        SEALContext context(enc_params, true);
+        Evaluator evaluator(context);
+        Ciphertext switched = query[0][0];
+        evaluator.mod_switch_to_inplace(switched, context.last_parms_id());
+        DecompositionPlan plan =
+            make_decomposition_plan(context.last_context_data()->parms());
+        vector<Plaintext> plains(plan.expansion_ratio * switched.size());
+        bench.run("decompose_to_plaintexts", 0, [&]() {
+            decompose_to_plaintexts(plan, switched, plains.data());
+        });
+
+        PirReply reply = server.generate_reply(query, 0);
+        stringstream reply_stream;
+        uint64_t reply_bytes = server.serialize_reply(reply, reply_stream);
+        bench.run("serialize_reply", reply_bytes, [&]() {
+            PirReply copy = reply;
+            stringstream stream;
+            server.serialize_reply(copy, stream);
+        });
+
+        stringstream query_stream;
+        uint64_t query_bytes =
+            client.generate_serialized_query(client.get_fv_index(ele_index), query_stream);
+        string serialized_query = query_stream.str();
+        bench.run("deserialize_query", query_bytes, [&]() {
+            stringstream stream(serialized_query);
+            server.deserialize_query(stream);
+        });
+
+        bench.run("decode_reply", 0, [&]() { client.decode_reply(reply, offset); });
+    }
+
+    stringstream config;
+    config << "{\"items\": " << number_of_items << ", \"item_size\": " << size_per_item
+           << ", \"N\": " << N << ", \"logt\": " << logt << ", \"d\": " << d
+           << ", \"nvec\": [" << pir_params.nvec[0] << ", " << pir_params.nvec[1]
+           << "], \"repetitions\": " << repetitions << "}";
+    bench.print_json(config.str());
+    return 0;
+}
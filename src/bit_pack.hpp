@@ -0,0 +1,217 @@
+#pragma once
+
+// Specialized kernels behind bytes_to_coeffs / coeffs_to_bytes.
+//
+// An element is read as a big-endian bit stream and cut into LOGT-bit
+// coefficients; the last coefficient of an element is left-aligned. Every
+// LOGT bytes of input map to exactly 8 coefficients, so the plans below are
+// computed at compile time for one such group and replayed over the element.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WPPCC_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+template <std::uint32_t LOGT> struct BitPackPlan {
+  static_assert(LOGT > 0 && LOGT <= 56, "unsupported coefficient width");
+
+  static constexpr std::uint64_t mask = (1ULL << LOGT) - 1;
+  static constexpr std::uint32_t group_bytes = LOGT; // 8 coefficients
+
+  // Offset of the first byte touched by coefficient k in a group, and the
+  // right shift that isolates it in a big-endian 32-bit window starting there
+  static constexpr std::uint32_t first_byte(std::uint32_t k) {
+    return (k * LOGT) / 8;
+  }
+  static constexpr std::uint32_t window_shift(std::uint32_t k) {
+    return 32 - (k * LOGT) % 8 - LOGT;
+  }
+
+  // AVX2 plan: the low 128-bit lane covers coefficients 0..3, the high lane
+  // 4..7 and is loaded starting at byte first_byte(4).
+  static constexpr bool use_simd = LOGT <= 25;
+  static constexpr std::uint32_t high_lane_base = (4 * LOGT) / 8;
+
+  static constexpr std::array<std::int8_t, 32> shuffle() {
+    std::array<std::int8_t, 32> s{};
+    for (std::uint32_t k = 0; k < 8; k++) {
+      std::uint32_t base = k < 4 ? 0 : high_lane_base;
+      std::uint32_t b0 = first_byte(k) - base;
+      // little-endian 32-bit lane, big-endian bytes
+      for (std::uint32_t i = 0; i < 4; i++) {
+        s[4 * k + i] = static_cast<std::int8_t>(b0 + 3 - i);
+      }
+    }
+    return s;
+  }
+  static constexpr std::array<std::int32_t, 8> shifts() {
+    std::array<std::int32_t, 8> s{};
+    for (std::uint32_t k = 0; k < 8; k++) {
+      s[k] = window_shift(k);
+    }
+    return s;
+  }
+};
+
+// Packs the tail of an element (or a whole element for wide LOGT) one byte at
+// a time through a bit accumulator
+inline std::uint64_t pack_bytes_scalar(std::uint32_t limit,
+                                       const std::uint8_t *bytes,
+                                       std::uint64_t size,
+                                       std::uint64_t *output) {
+  const std::uint64_t mask = (1ULL << limit) - 1;
+  std::uint64_t acc = 0;
+  std::uint32_t nbits = 0;
+  std::uint64_t *target = output;
+
+  for (std::uint64_t i = 0; i < size; i++) {
+    acc = (acc << 8) | bytes[i];
+    nbits += 8;
+    if (nbits >= limit) {
+      nbits -= limit;
+      *target++ = (acc >> nbits) & mask;
+    }
+  }
+  if (nbits) {
+    *target++ = (acc << (limit - nbits)) & mask;
+  }
+  return target - output;
+}
+
+template <std::uint32_t LOGT>
+inline void pack_group_scalar(const std::uint8_t *bytes,
+                              std::uint64_t *output) {
+  using Plan = BitPackPlan<LOGT>;
+  for (std::uint32_t k = 0; k < 8; k++) {
+    const std::uint8_t *p = bytes + Plan::first_byte(k);
+    std::uint64_t window = 0;
+    // LOGT + 7 bits never span more than 8 bytes
+    for (std::uint32_t i = 0; i < (((k * LOGT) % 8 + LOGT + 7) / 8); i++) {
+      window = (window << 8) | p[i];
+    }
+    std::uint32_t used = (((k * LOGT) % 8 + LOGT + 7) / 8) * 8;
+    output[k] = (window >> (used - (k * LOGT) % 8 - LOGT)) & Plan::mask;
+  }
+}
+
+#ifdef WPPCC_X86_DISPATCH
+template <std::uint32_t LOGT>
+__attribute__((target("avx2"))) inline void
+pack_group_avx2(const std::uint8_t *bytes, std::uint64_t *output) {
+  using Plan = BitPackPlan<LOGT>;
+  static constexpr auto shuf = Plan::shuffle();
+  static constexpr auto shft = Plan::shifts();
+
+  __m256i in = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes))),
+      _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(bytes + Plan::high_lane_base)),
+      1);
+  __m256i windows = _mm256_shuffle_epi8(
+      in, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(shuf.data())));
+  __m256i coeffs = _mm256_and_si256(
+      _mm256_srlv_epi32(windows, _mm256_loadu_si256(
+                                     reinterpret_cast<const __m256i *>(
+                                         shft.data()))),
+      _mm256_set1_epi32(static_cast<std::int32_t>(Plan::mask)));
+
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i *>(output),
+      _mm256_cvtepu32_epi64(_mm256_castsi256_si128(coeffs)));
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i *>(output + 4),
+      _mm256_cvtepu32_epi64(_mm256_extracti128_si256(coeffs, 1)));
+}
+
+inline bool cpu_has_avx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif
+
+template <std::uint32_t LOGT>
+inline void pack_bytes_kernel(const std::uint8_t *bytes, std::uint64_t size,
+                              std::uint64_t *output) {
+  using Plan = BitPackPlan<LOGT>;
+  std::uint64_t i = 0;
+
+#ifdef WPPCC_X86_DISPATCH
+  if (Plan::use_simd && cpu_has_avx2()) {
+    // the high lane reads 16 bytes from high_lane_base
+    const std::uint64_t reach =
+        std::max<std::uint64_t>(Plan::group_bytes, Plan::high_lane_base + 16);
+    for (; i + reach <= size; i += Plan::group_bytes) {
+      pack_group_avx2<LOGT>(bytes + i, output);
+      output += 8;
+    }
+  }
+#endif
+  for (; i + Plan::group_bytes <= size; i += Plan::group_bytes) {
+    pack_group_scalar<LOGT>(bytes + i, output);
+    output += 8;
+  }
+  pack_bytes_scalar(LOGT, bytes + i, size - i, output);
+}
+
+// Inverse of the packing: consumes coefficients of one element, appending
+// their top bits to the output until `size` bytes are produced. Returns the
+// number of coefficients consumed.
+inline std::uint64_t unpack_coeffs_scalar(std::uint32_t limit,
+                                          const std::uint64_t *coeffs,
+                                          std::uint64_t coeff_count,
+                                          std::uint8_t *output,
+                                          std::uint64_t size) {
+  const std::uint64_t mask = (1ULL << limit) - 1;
+  std::uint64_t bits_left = size * 8;
+  std::uint64_t acc = 0;
+  std::uint32_t nbits = 0;
+  std::uint64_t c = 0;
+  std::uint64_t j = 0;
+
+  while (j < size && c < coeff_count) {
+    std::uint32_t take =
+        static_cast<std::uint32_t>(std::min<std::uint64_t>(limit, bits_left));
+    acc = (acc << take) | ((coeffs[c++] & mask) >> (limit - take));
+    nbits += take;
+    bits_left -= take;
+    while (nbits >= 8 && j < size) {
+      nbits -= 8;
+      output[j++] = static_cast<std::uint8_t>(acc >> nbits);
+    }
+  }
+  return c;
+}
+
+template <std::uint32_t LOGT>
+inline std::uint64_t unpack_coeffs_kernel(const std::uint64_t *coeffs,
+                                          std::uint64_t coeff_count,
+                                          std::uint8_t *output,
+                                          std::uint64_t size) {
+  using Plan = BitPackPlan<LOGT>;
+  std::uint64_t c = 0;
+  std::uint64_t j = 0;
+
+  // 8 coefficients rebuild LOGT whole bytes, emitted through a 64-bit
+  // accumulator without per-bit branching
+  for (; j + Plan::group_bytes <= size && c + 8 <= coeff_count;
+       j += Plan::group_bytes, c += 8) {
+    std::uint64_t acc = 0;
+    std::uint32_t nbits = 0;
+    std::uint8_t *out = output + j;
+    for (std::uint32_t k = 0; k < 8; k++) {
+      acc = (acc << LOGT) | (coeffs[c + k] & Plan::mask);
+      nbits += LOGT;
+      while (nbits >= 8) {
+        nbits -= 8;
+        *out++ = static_cast<std::uint8_t>(acc >> nbits);
+      }
+    }
+  }
+  return c + unpack_coeffs_scalar(LOGT, coeffs + c, coeff_count - c,
+                                  output + j, size - j);
+}
@@ -64,6 +64,38 @@ void import_and_parse_data(std::unique_ptr<uint8_t[]> &db, const string csv_name
     fin.close();
 }
 
+vector<uint64_t> import_blacklist(const string csv_name, const uint8_t dim_of_items_number)
+{
+    fstream fin;
+    fin.open(csv_name, ios::in);
+
+    vector<uint64_t> blacklist;
+    string label, line, tmp;
+    uint64_t count = 0;
+    uint64_t number_of_items = 1UL << dim_of_items_number;
+
+    fin >> label;
+    while (count < number_of_items && fin >> line) {
+        stringstream ss(line);
+        vector<string> row;
+        while (getline( ss, tmp, ',' )) {
+            row.push_back(tmp);
+        }
+
+        // same index as import_and_parse_data
+        stringstream hex_indice(row[0].substr(0, 8));
+        uint64_t indice;
+        hex_indice >> hex >> indice;
+        if (stoi(row[2], nullptr, 2)) {
+            blacklist.push_back(indice & 0xfffffffe);
+        }
+        count++;
+    }
+
+    fin.close();
+    return blacklist;
+}
+
 uint8_t gen_rand(uint8_t seed) {
     auto now = std::chrono::system_clock::now();
     auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
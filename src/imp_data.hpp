@@ -8,4 +8,7 @@
 #include <random>
 
 void import_and_parse_data(std::unique_ptr<uint8_t[]>&, const std::string, const uint8_t);
+// The database indices `x || 0` of the blacklisted users among the first
+// 2^dim_of_items_number rows, the id set of a PsiServer.
+std::vector<std::uint64_t> import_blacklist(const std::string, const uint8_t);
 std::uint8_t gen_rand(std::uint8_t seed);
\ No newline at end of file
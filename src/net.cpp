@@ -0,0 +1,193 @@
+#include "net.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+static runtime_error net_error(const string &what) {
+  return runtime_error(what + ": " + strerror(errno));
+}
+
+static sockaddr_in resolve(const string &host, uint16_t port) {
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+      throw runtime_error("cannot resolve host " + host);
+    }
+    addr.sin_addr = reinterpret_cast<sockaddr_in *>(res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+  }
+  return addr;
+}
+
+int tcp_listen(const string &host, uint16_t port, int backlog) {
+  sockaddr_in addr = resolve(host, port);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw net_error("socket");
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, backlog) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    throw net_error("cannot listen on " + host + ":" + to_string(port));
+  }
+  return fd;
+}
+
+uint16_t tcp_local_port(int fd) {
+  sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+    throw net_error("getsockname");
+  }
+  return ntohs(addr.sin_port);
+}
+
+int tcp_connect(const string &host, uint16_t port) {
+  sockaddr_in addr = resolve(host, port);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw net_error("socket");
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    throw net_error("cannot connect to " + host + ":" + to_string(port));
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+void tcp_close(int fd) {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+static void write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw net_error("send");
+    }
+    data += n;
+    size -= n;
+  }
+}
+
+// Returns the number of bytes read, short only at end of stream
+static size_t read_all(int fd, char *data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = recv(fd, data + done, size - done, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw net_error("recv");
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+string frame_header(uint8_t type, uint64_t payload_size) {
+  string header(1, static_cast<char>(type));
+  put_u64(header, payload_size);
+  return header;
+}
+
+void send_frame(int fd, uint8_t type, const string &payload) {
+  string header = frame_header(type, payload.size());
+  write_all(fd, header.data(), header.size());
+  write_all(fd, payload.data(), payload.size());
+}
+
+bool recv_frame(int fd, uint8_t &type, string &payload) {
+  string header(kFrameHeaderSize, '\0');
+  size_t n = read_all(fd, &header[0], header.size());
+  if (n == 0) {
+    return false;
+  }
+  if (n != header.size()) {
+    throw runtime_error("connection closed inside a frame header");
+  }
+  size_t pos = 1;
+  type = static_cast<uint8_t>(header[0]);
+  uint64_t size = get_u64(header, pos);
+  payload.resize(size);
+  if (read_all(fd, &payload[0], size) != size) {
+    throw runtime_error("connection closed inside a frame");
+  }
+  return true;
+}
+
+void put_u32(string &out, uint32_t v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void put_u64(string &out, uint64_t v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void put_bytes(string &out, const string &bytes) {
+  put_u64(out, bytes.size());
+  out.append(bytes);
+}
+
+uint32_t get_u32(const string &in, size_t &pos) {
+  uint32_t v;
+  if (pos + sizeof(v) > in.size()) {
+    throw runtime_error("truncated message");
+  }
+  memcpy(&v, in.data() + pos, sizeof(v));
+  pos += sizeof(v);
+  return v;
+}
+
+uint64_t get_u64(const string &in, size_t &pos) {
+  uint64_t v;
+  if (pos + sizeof(v) > in.size()) {
+    throw runtime_error("truncated message");
+  }
+  memcpy(&v, in.data() + pos, sizeof(v));
+  pos += sizeof(v);
+  return v;
+}
+
+string get_bytes(const string &in, size_t &pos) {
+  uint64_t size = get_u64(in, pos);
+  if (pos + size > in.size()) {
+    throw runtime_error("truncated message");
+  }
+  string bytes = in.substr(pos, size);
+  pos += size;
+  return bytes;
+}
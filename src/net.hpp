@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Blocking TCP helpers and the length-framed message format shared by the
+// shard and service protocols. A frame is a 1-byte message type, the payload
+// length as a 64-bit little-endian integer, then the payload. Errors are
+// reported as std::runtime_error.
+
+const std::size_t kFrameHeaderSize = 9;
+
+// Listens on host:port (port 0 picks an ephemeral port)
+int tcp_listen(const std::string &host, std::uint16_t port, int backlog = 64);
+std::uint16_t tcp_local_port(int fd);
+int tcp_connect(const std::string &host, std::uint16_t port);
+void tcp_close(int fd);
+
+void send_frame(int fd, std::uint8_t type, const std::string &payload);
+// Returns false if the peer closed the connection before a new frame started
+bool recv_frame(int fd, std::uint8_t &type, std::string &payload);
+
+// Builds the header of a frame carrying payload_size bytes
+std::string frame_header(std::uint8_t type, std::uint64_t payload_size);
+
+// Little-endian payload fields; the readers advance pos and throw on
+// truncated input
+void put_u32(std::string &out, std::uint32_t v);
+void put_u64(std::string &out, std::uint64_t v);
+void put_bytes(std::string &out, const std::string &bytes);
+std::uint32_t get_u32(const std::string &in, std::size_t &pos);
+std::uint64_t get_u64(const std::string &in, std::size_t &pos);
+std::string get_bytes(const std::string &in, std::size_t &pos);
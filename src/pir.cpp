@@ -1,4 +1,5 @@
 #include "pir.hpp"
+#include "bit_pack.hpp"
 
 using namespace std;
 using namespace seal;
@@ -67,7 +68,27 @@ void verify_encryption_params(const seal::EncryptionParameters &enc_params) {
 void gen_pir_params(uint64_t ele_num, uint64_t ele_size, uint32_t d,
                     const EncryptionParameters &enc_params,
                     PirParams &pir_params, bool enable_symmetric,
-                    bool enable_batching, bool enable_mswitching) {
+                    bool enable_batching, bool enable_mswitching,
+                    bool enable_rgsw_folding, bool enable_dense_packing) {
+  std::uint32_t N = enc_params.poly_modulus_degree();
+  Modulus t = enc_params.plain_modulus();
+  std::uint32_t logt = floor(log2(t.value())); // # of usable bits
+  std::uint64_t num_of_plaintexts =
+      enable_batching ? plaintexts_per_db(logt, N, ele_num, ele_size,
+                                          enable_dense_packing)
+                      : ele_num;
+
+  gen_pir_params(ele_num, ele_size, get_dimensions(num_of_plaintexts, d),
+                 enc_params, pir_params, enable_symmetric, enable_batching,
+                 enable_mswitching, enable_rgsw_folding, enable_dense_packing);
+}
+
+void gen_pir_params(uint64_t ele_num, uint64_t ele_size,
+                    const vector<uint64_t> &nvec,
+                    const EncryptionParameters &enc_params,
+                    PirParams &pir_params, bool enable_symmetric,
+                    bool enable_batching, bool enable_mswitching,
+                    bool enable_rgsw_folding, bool enable_dense_packing) {
   std::uint32_t N = enc_params.poly_modulus_degree();
   Modulus t = enc_params.plain_modulus();
   std::uint32_t logt = floor(log2(t.value())); // # of usable bits
@@ -75,14 +96,22 @@ void gen_pir_params(uint64_t ele_num, uint64_t ele_size, uint32_t d,
   std::uint64_t num_of_plaintexts;
 
   if (enable_batching) {
-    elements_per_plaintext = elements_per_ptxt(logt, N, ele_size);
-    num_of_plaintexts = plaintexts_per_db(logt, N, ele_num, ele_size);
+    elements_per_plaintext =
+        elements_per_ptxt(logt, N, ele_size, enable_dense_packing);
+    num_of_plaintexts =
+        plaintexts_per_db(logt, N, ele_num, ele_size, enable_dense_packing);
   } else {
     elements_per_plaintext = 1;
     num_of_plaintexts = ele_num;
   }
 
-  vector<uint64_t> nvec = get_dimensions(num_of_plaintexts, d);
+  uint64_t prod = 1;
+  for (uint64_t n : nvec) {
+    prod *= n;
+  }
+  if (nvec.empty() || prod < num_of_plaintexts) {
+    throw invalid_argument("dimensions do not cover the database");
+  }
 
   uint32_t expansion_ratio = 0;
   for (uint32_t i = 0; i < enc_params.coeff_modulus().size(); ++i) {
@@ -93,11 +122,13 @@ void gen_pir_params(uint64_t ele_num, uint64_t ele_size, uint32_t d,
   pir_params.enable_symmetric = enable_symmetric;
   pir_params.enable_batching = enable_batching;
   pir_params.enable_mswitching = enable_mswitching;
+  pir_params.enable_rgsw_folding = enable_rgsw_folding;
+  pir_params.enable_dense_packing = enable_batching && enable_dense_packing;
   pir_params.ele_num = ele_num;
   pir_params.ele_size = ele_size;
   pir_params.elements_per_plaintext = elements_per_plaintext;
   pir_params.num_of_plaintexts = num_of_plaintexts;
-  pir_params.d = d;
+  pir_params.d = nvec.size();
   pir_params.expansion_ratio = expansion_ratio << 1;
   pir_params.nvec = nvec;
   pir_params.slot_count = N;
@@ -124,10 +155,28 @@ void print_pir_params(const PirParams &pir_params) {
   cout << "Using symmetric encryption: " << pir_params.enable_symmetric << endl;
   cout << "Using recursive mod switching: " << pir_params.enable_mswitching
        << endl;
+  cout << "Using RGSW folding: " << pir_params.enable_rgsw_folding << endl;
+  cout << "Using dense packing: " << pir_params.enable_dense_packing << endl;
   cout << "slot count: " << pir_params.slot_count << endl;
   cout << "==============================" << endl;
 }
 
+uint32_t folding_bits(uint64_t n_i) {
+  uint32_t bits = 0;
+  while ((uint64_t(1) << bits) < n_i) {
+    bits++;
+  }
+  return bits;
+}
+
+uint32_t rgsw_ciphertexts_per_bit(const EncryptionParameters &enc_params) {
+  // one row per gadget digit of each of the two polynomials, at the first
+  // data level where the folding happens
+  SEALContext context(enc_params, true);
+  return 2 * make_folding_plan(context.first_context_data()->parms())
+                 .expansion_ratio;
+}
+
 void print_seal_params(const EncryptionParameters &enc_params) {
   std::uint32_t N = enc_params.poly_modulus_degree();
   Modulus t = enc_params.plain_modulus();
@@ -153,81 +202,135 @@ uint64_t coefficients_per_element(uint32_t logt, uint64_t ele_size) {
 }
 
 // Number of database elements that can fit in a single FV plaintext
-uint64_t elements_per_ptxt(uint32_t logt, uint64_t N, uint64_t ele_size) {
-  uint64_t coeff_per_ele = coefficients_per_element(logt, ele_size);
-  uint64_t ele_per_ptxt = N / coeff_per_ele;
+uint64_t elements_per_ptxt(uint32_t logt, uint64_t N, uint64_t ele_size,
+                           bool dense) {
+  uint64_t ele_per_ptxt;
+  if (dense) {
+    ele_per_ptxt = N * logt / (8 * ele_size);
+  } else {
+    uint64_t coeff_per_ele = coefficients_per_element(logt, ele_size);
+    ele_per_ptxt = N / coeff_per_ele;
+  }
   assert(ele_per_ptxt > 0);
   return ele_per_ptxt;
 }
 
 // Number of FV plaintexts needed to represent the database
 uint64_t plaintexts_per_db(uint32_t logt, uint64_t N, uint64_t ele_num,
-                           uint64_t ele_size) {
-  uint64_t ele_per_ptxt = elements_per_ptxt(logt, N, ele_size);
+                           uint64_t ele_size, bool dense) {
+  uint64_t ele_per_ptxt = elements_per_ptxt(logt, N, ele_size, dense);
   return ceil((double)ele_num / ele_per_ptxt);
 }
 
-vector<uint64_t> bytes_to_coeffs(uint32_t limit, const uint8_t *bytes,
-                                 uint64_t size) {
-
-  uint64_t size_out = coefficients_per_element(limit, size);
-  vector<uint64_t> output(size_out);
+uint64_t coefficients_per_ptxt(const PirParams &pir_params, uint32_t logt) {
+  if (pir_params.enable_dense_packing) {
+    uint64_t bits = pir_params.elements_per_plaintext * 8 * pir_params.ele_size;
+    return (bits + logt - 1) / logt;
+  }
+  return pir_params.elements_per_plaintext *
+         coefficients_per_element(logt, pir_params.ele_size);
+}
 
-  uint32_t room = limit;
-  uint64_t *target = &output[0];
+void shard_element_range(const PirParams &pir_params, uint64_t row_begin,
+                         uint64_t row_end, uint64_t &first_element,
+                         uint64_t &num_elements) {
+  uint64_t plaintexts_per_row = 1;
+  for (uint32_t i = 1; i < pir_params.nvec.size(); i++) {
+    plaintexts_per_row *= pir_params.nvec[i];
+  }
+  uint64_t last_element = min(pir_params.ele_num,
+                              row_end * plaintexts_per_row *
+                                  pir_params.elements_per_plaintext);
+  first_element = min(pir_params.ele_num, row_begin * plaintexts_per_row *
+                                              pir_params.elements_per_plaintext);
+  num_elements = last_element - first_element;
+}
 
-  for (uint32_t i = 0; i < size; i++) {
-    uint8_t src = bytes[i];
-    uint32_t rest = 8;
-    while (rest) {
-      if (room == 0) {
-        target++;
-        room = limit;
-      }
-      uint32_t shift = rest;
-      if (room < rest) {
-        shift = room;
-      }
-      *target = *target << shift;
-      *target = *target | (src >> (8 - shift));
-      src = src << shift;
-      room -= shift;
-      rest -= shift;
-    }
+void bytes_to_coeffs(uint32_t limit, const uint8_t *bytes, uint64_t size,
+                     uint64_t *output) {
+  switch (limit) {
+  case 8:
+    return pack_bytes_kernel<8>(bytes, size, output);
+  case 12:
+    return pack_bytes_kernel<12>(bytes, size, output);
+  case 16:
+    return pack_bytes_kernel<16>(bytes, size, output);
+  case 20:
+    return pack_bytes_kernel<20>(bytes, size, output);
+  case 24:
+    return pack_bytes_kernel<24>(bytes, size, output);
+  default:
+    pack_bytes_scalar(limit, bytes, size, output);
   }
+}
 
-  *target = *target << room;
+vector<uint64_t> bytes_to_coeffs(uint32_t limit, const uint8_t *bytes,
+                                 uint64_t size) {
+  vector<uint64_t> output(coefficients_per_element(limit, size));
+  bytes_to_coeffs(limit, bytes, size, output.data());
   return output;
 }
 
+// Unpacks one element; returns the number of coefficients consumed
+static uint64_t unpack_element(uint32_t limit, const uint64_t *coeffs,
+                               uint64_t coeff_count, uint8_t *output,
+                               uint64_t size) {
+  switch (limit) {
+  case 8:
+    return unpack_coeffs_kernel<8>(coeffs, coeff_count, output, size);
+  case 12:
+    return unpack_coeffs_kernel<12>(coeffs, coeff_count, output, size);
+  case 16:
+    return unpack_coeffs_kernel<16>(coeffs, coeff_count, output, size);
+  case 20:
+    return unpack_coeffs_kernel<20>(coeffs, coeff_count, output, size);
+  case 24:
+    return unpack_coeffs_kernel<24>(coeffs, coeff_count, output, size);
+  default:
+    return unpack_coeffs_scalar(limit, coeffs, coeff_count, output, size);
+  }
+}
+
+void coeffs_to_bytes(uint32_t limit, const uint64_t *coeffs,
+                     uint64_t coeff_count, uint8_t *output, uint64_t size_out,
+                     uint64_t ele_size) {
+  uint64_t c = 0;
+  for (uint64_t j = 0; j < size_out && c < coeff_count; j += ele_size) {
+    c += unpack_element(limit, coeffs + c, coeff_count - c, output + j,
+                        min(ele_size, size_out - j));
+  }
+}
+
 void coeffs_to_bytes(uint32_t limit, const vector<uint64_t> &coeffs,
                      uint8_t *output, uint32_t size_out, uint32_t ele_size) {
-  uint32_t room = 8;
-  uint32_t j = 0;
-  uint8_t *target = output;
-  uint32_t bits_left = ele_size * 8;
-  for (uint32_t i = 0; i < coeffs.size(); i++) {
-    if (bits_left == 0) {
-      bits_left = ele_size * 8;
-    }
-    uint64_t src = coeffs[i];
-    uint32_t rest = min(limit, bits_left);
-    while (rest && j < size_out) {
-      uint32_t shift = rest;
-      if (room < rest) {
-        shift = room;
-      }
+  coeffs_to_bytes(limit, coeffs.data(), coeffs.size(), output, size_out,
+                  ele_size);
+}
 
-      target[j] = target[j] << shift;
-      target[j] = target[j] | (src >> (limit - shift));
-      src = src << shift;
-      room -= shift;
-      rest -= shift;
-      bits_left -= shift;
-      if (room == 0) {
-        j++;
-        room = 8;
-      }
+void dense_coeffs_to_bytes(uint32_t limit, const uint64_t *coeffs,
+                           uint64_t coeff_count, uint64_t bit_offset,
+                           uint8_t *output, uint64_t size) {
+  const uint64_t mask = (1ULL << limit) - 1;
+  uint64_t c = bit_offset / limit;
+  // bits of coeffs[c] not yet consumed, counted from its top
+  uint32_t avail = limit - bit_offset % limit;
+  uint64_t acc = 0;
+  uint32_t nbits = 0;
+  uint64_t j = 0;
+
+  while (j < size && c < coeff_count) {
+    uint32_t take = min<uint32_t>(avail, 64 - 8 - nbits);
+    uint64_t bits = (coeffs[c] & mask) >> (avail - take);
+    acc = (acc << take) | (bits & ((1ULL << take) - 1));
+    nbits += take;
+    avail -= take;
+    if (avail == 0) {
+      c++;
+      avail = limit;
+    }
+    while (nbits >= 8 && j < size) {
+      nbits -= 8;
+      output[j++] = static_cast<uint8_t>(acc >> nbits);
     }
   }
 }
@@ -272,86 +375,109 @@ uint64_t invert_mod(uint64_t m, const seal::Modulus &mod) {
   return inverse;
 }
 
-uint32_t compute_expansion_ratio(EncryptionParameters params) {
-  uint32_t expansion_ratio = 0;
-  uint32_t pt_bits_per_coeff = log2(params.plain_modulus().value());
+static DecompositionPlan make_plan(const EncryptionParameters &params,
+                                   uint32_t bits_per_coeff) {
+  DecompositionPlan plan;
+  plan.parms_id = params.parms_id();
+  plan.coeff_count = params.poly_modulus_degree();
+  plan.pt_bits_per_coeff = bits_per_coeff;
+  plan.pt_bitmask = (uint64_t(1) << plan.pt_bits_per_coeff) - 1;
   for (size_t i = 0; i < params.coeff_modulus().size(); ++i) {
-    double coeff_bit_size = log2(params.coeff_modulus()[i].value());
-    expansion_ratio += ceil(coeff_bit_size / pt_bits_per_coeff);
+    int coeff_bit_size = params.coeff_modulus()[i].bit_count();
+    for (int shift = 0; shift < coeff_bit_size;
+         shift += plan.pt_bits_per_coeff) {
+      plan.modulus_index.push_back(i);
+      plan.shift.push_back(shift);
+    }
   }
-  return expansion_ratio;
+  plan.expansion_ratio = plan.shift.size();
+  return plan;
 }
 
-vector<Plaintext> decompose_to_plaintexts(EncryptionParameters params,
-                                          const Ciphertext &ct) {
-  const uint32_t pt_bits_per_coeff = log2(params.plain_modulus().value());
-  const auto coeff_count = params.poly_modulus_degree();
-  const auto coeff_mod_count = params.coeff_modulus().size();
-  const uint64_t pt_bitmask = (1 << pt_bits_per_coeff) - 1;
+DecompositionPlan make_decomposition_plan(const EncryptionParameters &params) {
+  return make_plan(params, params.plain_modulus().bit_count() - 1);
+}
+
+DecompositionPlan make_folding_plan(const EncryptionParameters &params) {
+  return make_plan(params, params.plain_modulus().bit_count() - 2);
+}
+
+uint32_t compute_expansion_ratio(const EncryptionParameters &params) {
+  return make_decomposition_plan(params).expansion_ratio;
+}
+
+void decompose_to_plaintexts(const DecompositionPlan &plan, const Ciphertext &ct,
+                             Plaintext *out) {
+  if (ct.parms_id() != plan.parms_id) {
+    throw invalid_argument("ciphertext is not at the decomposition level");
+  }
+  const uint64_t coeff_count = plan.coeff_count;
+  const uint64_t mask = plan.pt_bitmask;
 
-  vector<Plaintext> result(compute_expansion_ratio(params) * ct.size());
-  auto pt_iter = result.begin();
   for (size_t poly_index = 0; poly_index < ct.size(); ++poly_index) {
-    for (size_t coeff_mod_index = 0; coeff_mod_index < coeff_mod_count;
-         ++coeff_mod_index) {
-      const double coeff_bit_size =
-          log2(params.coeff_modulus()[coeff_mod_index].value());
-      const size_t local_expansion_ratio =
-          ceil(coeff_bit_size / pt_bits_per_coeff);
-      size_t shift = 0;
-      for (size_t i = 0; i < local_expansion_ratio; ++i) {
-        pt_iter->resize(coeff_count);
-        for (size_t c = 0; c < coeff_count; ++c) {
-          (*pt_iter)[c] =
-              (ct.data(poly_index)[coeff_mod_index * coeff_count + c] >>
-               shift) &
-              pt_bitmask;
-        }
-        ++pt_iter;
-        shift += pt_bits_per_coeff;
+    const uint64_t *poly = ct.data(poly_index);
+    for (size_t p = 0; p < plan.expansion_ratio; ++p, ++out) {
+      // a previously NTT'd plaintext keeps its allocation
+      out->parms_id() = parms_id_zero;
+      out->resize(coeff_count);
+      const uint64_t *src = poly + plan.modulus_index[p] * coeff_count;
+      const uint32_t shift = plan.shift[p];
+      uint64_t *dst = out->data();
+      // one shift and mask per plaintext: a straight loop the compiler
+      // vectorizes
+      for (uint64_t c = 0; c < coeff_count; ++c) {
+        dst[c] = (src[c] >> shift) & mask;
       }
     }
   }
+}
+
+vector<Plaintext> decompose_to_plaintexts(const EncryptionParameters &params,
+                                          const Ciphertext &ct) {
+  DecompositionPlan plan = make_decomposition_plan(params);
+  vector<Plaintext> result(plan.expansion_ratio * ct.size());
+  decompose_to_plaintexts(plan, ct, result.data());
   return result;
 }
 
-void compose_to_ciphertext(EncryptionParameters params,
+void compose_to_ciphertext(const DecompositionPlan &plan,
                            vector<Plaintext>::const_iterator pt_iter,
                            const size_t ct_poly_count, Ciphertext &ct) {
-  const uint32_t pt_bits_per_coeff = log2(params.plain_modulus().value());
-  const auto coeff_count = params.poly_modulus_degree();
-  const auto coeff_mod_count = params.coeff_modulus().size();
+  const uint64_t coeff_count = plan.coeff_count;
 
   ct.resize(ct_poly_count);
   for (size_t poly_index = 0; poly_index < ct_poly_count; ++poly_index) {
-    for (size_t coeff_mod_index = 0; coeff_mod_index < coeff_mod_count;
-         ++coeff_mod_index) {
-      const double coeff_bit_size =
-          log2(params.coeff_modulus()[coeff_mod_index].value());
-      const size_t local_expansion_ratio =
-          ceil(coeff_bit_size / pt_bits_per_coeff);
-      size_t shift = 0;
-      for (size_t i = 0; i < local_expansion_ratio; ++i) {
-        for (size_t c = 0; c < pt_iter->coeff_count(); ++c) {
-          if (shift == 0) {
-            ct.data(poly_index)[coeff_mod_index * coeff_count + c] =
-                (*pt_iter)[c];
-          } else {
-            ct.data(poly_index)[coeff_mod_index * coeff_count + c] +=
-                ((*pt_iter)[c] << shift);
-          }
+    uint64_t *poly = ct.data(poly_index);
+    for (size_t p = 0; p < plan.expansion_ratio; ++p, ++pt_iter) {
+      uint64_t *dst = poly + plan.modulus_index[p] * coeff_count;
+      const uint32_t shift = plan.shift[p];
+      // decrypted plaintexts may be shorter than coeff_count
+      const uint64_t count = min<uint64_t>(pt_iter->coeff_count(), coeff_count);
+      const uint64_t *src = pt_iter->data();
+      if (shift == 0) {
+        copy(src, src + count, dst);
+        fill(dst + count, dst + coeff_count, 0);
+      } else {
+        for (uint64_t c = 0; c < count; ++c) {
+          dst[c] += src[c] << shift;
         }
-        ++pt_iter;
-        shift += pt_bits_per_coeff;
       }
     }
   }
 }
 
-void compose_to_ciphertext(EncryptionParameters params,
+void compose_to_ciphertext(const EncryptionParameters &params,
+                           vector<Plaintext>::const_iterator pt_iter,
+                           const size_t ct_poly_count, Ciphertext &ct) {
+  compose_to_ciphertext(make_decomposition_plan(params), pt_iter, ct_poly_count,
+                        ct);
+}
+
+void compose_to_ciphertext(const EncryptionParameters &params,
                            const vector<Plaintext> &pts, Ciphertext &ct) {
-  return compose_to_ciphertext(
-      params, pts.begin(), pts.size() / compute_expansion_ratio(params), ct);
+  DecompositionPlan plan = make_decomposition_plan(params);
+  compose_to_ciphertext(plan, pts.begin(), pts.size() / plan.expansion_ratio,
+                        ct);
 }
 
 PirQuery deserialize_query(uint32_t d, uint32_t count, string s,
@@ -372,6 +498,83 @@ PirQuery deserialize_query(uint32_t d, uint32_t count, string s,
   return q;
 }
 
+Ciphertext encrypt_zero_like(const SEALContext &context, Evaluator &evaluator,
+                             const Ciphertext &encrypted,
+                             MemoryPoolHandle pool) {
+  // 2 * h - 1 is t or -t for h = (t + 1) / 2, whichever way multiply_plain
+  // lifts h, so the result is encrypted times a multiple of t
+  auto context_data = context.get_context_data(encrypted.parms_id());
+  const EncryptionParameters &parms = context_data->parms();
+  Plaintext half(parms.poly_modulus_degree(), pool);
+  half[0] = (parms.plain_modulus().value() + 1) / 2;
+  if (encrypted.is_ntt_form()) {
+    evaluator.transform_to_ntt_inplace(half, encrypted.parms_id(), pool);
+  }
+  Ciphertext zero(pool);
+  evaluator.multiply_plain(encrypted, half, zero, pool);
+  evaluator.add_inplace(zero, zero);
+  evaluator.sub_inplace(zero, encrypted);
+  return zero;
+}
+
+string serialize_ciphertexts(const vector<Ciphertext> &cts) {
+  std::ostringstream output;
+  uint64_t count = cts.size();
+  output.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  for (const auto &ct : cts) {
+    ct.save(output);
+  }
+  return output.str();
+}
+
+vector<Ciphertext> deserialize_ciphertexts(const string &s,
+                                           const SEALContext &context) {
+  std::istringstream input(s);
+  uint64_t count = 0;
+  input.read(reinterpret_cast<char *>(&count), sizeof(count));
+  if (!input) {
+    throw invalid_argument("truncated ciphertext list");
+  }
+  vector<Ciphertext> cts(count);
+  for (auto &ct : cts) {
+    ct.load(context, input);
+  }
+  return cts;
+}
+
+string serialize_query(const PirQuery &query) {
+  std::ostringstream output;
+  uint64_t d = query.size();
+  output.write(reinterpret_cast<const char *>(&d), sizeof(d));
+  for (const auto &dimension : query) {
+    string cts = serialize_ciphertexts(dimension);
+    output.write(cts.data(), cts.size());
+  }
+  return output.str();
+}
+
+PirQuery deserialize_query(const string &s, const SEALContext &context) {
+  std::istringstream input(s);
+  uint64_t d = 0;
+  input.read(reinterpret_cast<char *>(&d), sizeof(d));
+  if (!input) {
+    throw invalid_argument("truncated query");
+  }
+  PirQuery q(d);
+  for (auto &dimension : q) {
+    uint64_t count = 0;
+    input.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!input) {
+      throw invalid_argument("truncated query");
+    }
+    dimension.resize(count);
+    for (auto &ct : dimension) {
+      ct.load(context, input);
+    }
+  }
+  return q;
+}
+
 string serialize_galoiskeys(Serializable<GaloisKeys> g) {
   std::ostringstream output;
   g.save(output);
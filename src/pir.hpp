@@ -18,6 +18,12 @@ struct PirParams {
   bool enable_symmetric;
   bool enable_batching;
   bool enable_mswitching;
+  // dimensions after the first are folded with RGSW external products, so
+  // the reply is a single ciphertext
+  bool enable_rgsw_folding;
+  // the elements of a plaintext form one bit stream, so an element may
+  // straddle coefficient boundaries instead of starting a new coefficient
+  bool enable_dense_packing;
   std::uint64_t ele_num;
   std::uint64_t ele_size;
   std::uint64_t elements_per_plaintext;
@@ -46,7 +52,19 @@ void gen_encryption_params(std::uint32_t N,    // degree of polynomial
 void gen_pir_params(uint64_t ele_num, uint64_t ele_size, uint32_t d,
                     const seal::EncryptionParameters &enc_params,
                     PirParams &pir_params, bool enable_symmetric = false,
-                    bool enable_batching = true, bool enable_mswitching = true);
+                    bool enable_batching = true, bool enable_mswitching = true,
+                    bool enable_rgsw_folding = false,
+                    bool enable_dense_packing = false);
+
+// Same as above with an explicit split of the database into nvec.size()
+// dimensions; their product must cover the database
+void gen_pir_params(uint64_t ele_num, uint64_t ele_size,
+                    const std::vector<std::uint64_t> &nvec,
+                    const seal::EncryptionParameters &enc_params,
+                    PirParams &pir_params, bool enable_symmetric = false,
+                    bool enable_batching = true, bool enable_mswitching = true,
+                    bool enable_rgsw_folding = false,
+                    bool enable_dense_packing = false);
 
 void gen_params(uint64_t ele_num, uint64_t ele_size, uint32_t N, uint32_t logt,
                 uint32_t d, seal::EncryptionParameters &params,
@@ -55,31 +73,62 @@ void gen_params(uint64_t ele_num, uint64_t ele_size, uint32_t N, uint32_t logt,
 void verify_encryption_params(const seal::EncryptionParameters &enc_params);
 
 void print_pir_params(const PirParams &pir_params);
+
+// Selection bits of a dimension of size n_i folded with RGSW external
+// products; each bit is sent as rgsw_ciphertexts_per_bit ciphertexts
+std::uint32_t folding_bits(std::uint64_t n_i);
+std::uint32_t rgsw_ciphertexts_per_bit(const seal::EncryptionParameters &enc_params);
 void print_seal_params(const seal::EncryptionParameters &enc_params);
 
 // returns the number of plaintexts that the database can hold
 std::uint64_t plaintexts_per_db(std::uint32_t logt, std::uint64_t N,
-                                std::uint64_t ele_num, std::uint64_t ele_size);
+                                std::uint64_t ele_num, std::uint64_t ele_size,
+                                bool dense = false);
 
 // returns the number of elements that a single FV plaintext can hold
 std::uint64_t elements_per_ptxt(std::uint32_t logt, std::uint64_t N,
-                                std::uint64_t ele_size);
+                                std::uint64_t ele_size, bool dense = false);
 
 // returns the number of coefficients needed to store one element
 std::uint64_t coefficients_per_element(std::uint32_t logt,
                                        std::uint64_t ele_size);
 
+// returns the number of coefficients holding the elements of a full plaintext
+std::uint64_t coefficients_per_ptxt(const PirParams &pir_params,
+                                    std::uint32_t logt);
+
+// Elements covered by rows [row_begin, row_end) of the first dimension, i.e.
+// what a shard holding those rows must be given
+void shard_element_range(const PirParams &pir_params, std::uint64_t row_begin,
+                         std::uint64_t row_end, std::uint64_t &first_element,
+                         std::uint64_t &num_elements);
+
 // Converts an array of bytes to a vector of coefficients, each of which is less
 // than the plaintext modulus
 std::vector<std::uint64_t> bytes_to_coeffs(std::uint32_t limit,
                                            const std::uint8_t *bytes,
                                            std::uint64_t size);
 
+// Same as above, writing the coefficients_per_element(limit, size)
+// coefficients to caller-provided storage
+void bytes_to_coeffs(std::uint32_t limit, const std::uint8_t *bytes,
+                     std::uint64_t size, std::uint64_t *output);
+
 // Converts an array of coefficients into an array of bytes
 void coeffs_to_bytes(std::uint32_t limit,
                      const std::vector<std::uint64_t> &coeffs,
                      std::uint8_t *output, std::uint32_t size_out,
                      std::uint32_t ele_size);
+void coeffs_to_bytes(std::uint32_t limit, const std::uint64_t *coeffs,
+                     std::uint64_t coeff_count, std::uint8_t *output,
+                     std::uint64_t size_out, std::uint64_t ele_size);
+
+// Reads size bytes starting bit_offset bits into the bit stream of the
+// coefficients, as written by bytes_to_coeffs over a whole plaintext of
+// densely packed elements
+void dense_coeffs_to_bytes(std::uint32_t limit, const std::uint64_t *coeffs,
+                           std::uint64_t coeff_count, std::uint64_t bit_offset,
+                           std::uint8_t *output, std::uint64_t size);
 
 // Takes a vector of coefficients and returns the corresponding FV plaintext
 void vector_to_plaintext(const std::vector<std::uint64_t> &coeffs,
@@ -93,19 +142,64 @@ std::vector<std::uint64_t> compute_indices(std::uint64_t desiredIndex,
 
 uint64_t invert_mod(uint64_t m, const seal::Modulus &mod);
 
-uint32_t compute_expansion_ratio(seal::EncryptionParameters params);
+// How a ciphertext at one parameter level is split into plaintexts: piece p
+// of a polynomial holds bits [shift[p], shift[p] + pt_bits_per_coeff) of its
+// residues modulo coeff_modulus[modulus_index[p]]. Built once per level so
+// the split does no floating point math and no allocation.
+struct DecompositionPlan {
+  seal::parms_id_type parms_id;
+  std::uint64_t coeff_count;
+  std::uint32_t pt_bits_per_coeff;
+  std::uint64_t pt_bitmask;
+  std::vector<std::uint32_t> modulus_index;
+  std::vector<std::uint32_t> shift;
+  // plaintexts per ciphertext polynomial
+  std::uint32_t expansion_ratio;
+};
+
+DecompositionPlan make_decomposition_plan(const seal::EncryptionParameters &params);
+// Gadget digits of RGSW folding: one bit narrower, so no digit reaches t / 2,
+// above which transform_to_ntt lifts a plaintext coefficient to a negative
+// value and the digits would no longer recompose the ciphertext
+DecompositionPlan make_folding_plan(const seal::EncryptionParameters &params);
+
+uint32_t compute_expansion_ratio(const seal::EncryptionParameters &params);
 std::vector<seal::Plaintext>
-decompose_to_plaintexts(seal::EncryptionParameters params,
+decompose_to_plaintexts(const seal::EncryptionParameters &params,
                         const seal::Ciphertext &ct);
+// Writes ct.size() * plan.expansion_ratio plaintexts to out[0..], reusing
+// their storage; ct must be at the plan's level
+void decompose_to_plaintexts(const DecompositionPlan &plan,
+                             const seal::Ciphertext &ct, seal::Plaintext *out);
 
 // We need the returned ciphertext to be initialized by Context so the caller
 // will pass it in
-void compose_to_ciphertext(seal::EncryptionParameters params,
+void compose_to_ciphertext(const seal::EncryptionParameters &params,
                            const std::vector<seal::Plaintext> &pts,
                            seal::Ciphertext &ct);
-void compose_to_ciphertext(seal::EncryptionParameters params,
+void compose_to_ciphertext(const seal::EncryptionParameters &params,
                            std::vector<seal::Plaintext>::const_iterator pt_iter,
-                           seal::Ciphertext &ct);
+                           const size_t ct_poly_count, seal::Ciphertext &ct);
+void compose_to_ciphertext(const DecompositionPlan &plan,
+                           std::vector<seal::Plaintext>::const_iterator pt_iter,
+                           const size_t ct_poly_count, seal::Ciphertext &ct);
+
+// An encryption of 0 computed from encrypted, for results that would
+// otherwise be products with zero plaintexts, i.e. transparent ciphertexts
+seal::Ciphertext
+encrypt_zero_like(const seal::SEALContext &context, seal::Evaluator &evaluator,
+                  const seal::Ciphertext &encrypted,
+                  seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
+
+// Serialize and deserialize a list of ciphertexts (partial replies, query
+// dimensions) to send them over the network
+std::string serialize_ciphertexts(const std::vector<seal::Ciphertext> &cts);
+std::vector<seal::Ciphertext>
+deserialize_ciphertexts(const std::string &s, const seal::SEALContext &context);
+
+std::string serialize_query(const PirQuery &query);
+PirQuery deserialize_query(const std::string &s,
+                           const seal::SEALContext &context);
 
 // Serialize and deserialize galois keys to send them over the network
 std::string serialize_galoiskeys(seal::Serializable<seal::GaloisKeys> g);
@@ -0,0 +1,183 @@
+#include "pir_aggregate.hpp"
+#include "pir.hpp"
+
+#include <stdexcept>
+
+using namespace std;
+using namespace seal;
+
+AggregateField aggregate_field_bytes(uint64_t offset, uint32_t size) {
+  if (size == 0 || size > sizeof(uint64_t)) {
+    throw invalid_argument("field size must be 1 to 8 bytes");
+  }
+  return [offset, size](const uint8_t *element) {
+    uint64_t value = 0;
+    for (uint32_t b = size; b > 0; b--) {
+      value = (value << 8) | element[offset + b - 1];
+    }
+    return value;
+  };
+}
+
+AggregateServer::AggregateServer(const EncryptionParameters &enc_params)
+    : enc_params_(enc_params) {
+  context_ = make_shared<SEALContext>(enc_params, true);
+  if (!context_->first_context_data()->qualifiers().using_batching) {
+    throw invalid_argument("aggregate queries need batching parameters");
+  }
+  evaluator_ = make_unique<Evaluator>(*context_);
+  encoder_ = make_unique<BatchEncoder>(*context_);
+}
+
+void AggregateServer::set_database(const unique_ptr<const uint8_t[]> &bytes,
+                                   uint64_t ele_num, uint64_t ele_size,
+                                   const AggregateField &field) {
+  if (!bytes || ele_num == 0 || ele_size == 0) {
+    throw invalid_argument("database cannot be empty");
+  }
+  const uint64_t slots = encoder_->slot_count();
+  const uint64_t t = enc_params_.plain_modulus().value();
+  fields_.assign((ele_num + slots - 1) / slots, Plaintext());
+  vector<uint64_t> values(slots);
+  for (uint64_t p = 0; p < fields_.size(); p++) {
+    fill(values.begin(), values.end(), 0);
+    for (uint64_t j = 0; j < slots && p * slots + j < ele_num; j++) {
+      values[j] = field(bytes.get() + (p * slots + j) * ele_size);
+      if (values[j] >= t) {
+        throw invalid_argument("field value does not fit the plain modulus");
+      }
+    }
+    encoder_->encode(values, fields_[p]);
+    evaluator_->transform_to_ntt_inplace(fields_[p], context_->first_parms_id());
+  }
+}
+
+void AggregateServer::set_galois_keys(uint32_t client_id,
+                                      GaloisKeys galois_keys) {
+  auto keys = make_shared<const GaloisKeys>(move(galois_keys));
+  lock_guard<mutex> lock(galois_keys_mutex_);
+  galois_keys_[client_id] = move(keys);
+}
+
+Ciphertext AggregateServer::generate_reply(const AggregateQuery &query,
+                                           uint32_t client_id, uint64_t mask) {
+  if (fields_.empty()) {
+    throw logic_error("database is not set");
+  }
+  if (query.size() != fields_.size()) {
+    throw invalid_argument("query does not match the database size");
+  }
+  shared_ptr<const GaloisKeys> galois_keys;
+  {
+    lock_guard<mutex> lock(galois_keys_mutex_);
+    auto it = galois_keys_.find(client_id);
+    if (it == galois_keys_.end()) {
+      throw invalid_argument("no galois key for client " +
+                             to_string(client_id));
+    }
+    galois_keys = it->second;
+  }
+  MemoryPoolHandle pool = MemoryPoolHandle::New();
+
+  // slot j of the sum is the selected total of elements j, j + N, ...
+  // A field plaintext of zeros adds nothing, and its product would be the
+  // transparent ciphertext
+  Ciphertext sum(pool), temp(pool);
+  bool started = false;
+  for (uint64_t p = 0; p < fields_.size(); p++) {
+    if (fields_[p].is_zero()) {
+      continue;
+    }
+    temp = query[p];
+    evaluator_->transform_to_ntt_inplace(temp);
+    evaluator_->multiply_plain_inplace(temp, fields_[p], pool);
+    if (!started) {
+      sum = temp;
+      started = true;
+    } else {
+      evaluator_->add_inplace(sum, temp);
+    }
+  }
+  if (started) {
+    evaluator_->transform_from_ntt_inplace(sum);
+  } else {
+    sum = encrypt_zero_like(*context_, *evaluator_, query[0], pool);
+  }
+
+  // The slots form a 2 x N/2 matrix: sum each row by doubling rotations,
+  // then add the swapped rows
+  for (uint64_t step = 1; step < encoder_->slot_count() / 2; step <<= 1) {
+    evaluator_->rotate_rows(sum, static_cast<int>(step), *galois_keys, temp,
+                            pool);
+    evaluator_->add_inplace(sum, temp);
+  }
+  evaluator_->rotate_columns(sum, *galois_keys, temp, pool);
+  evaluator_->add_inplace(sum, temp);
+
+  if (mask) {
+    Plaintext mask_pt(pool);
+    encoder_->encode(vector<uint64_t>(encoder_->slot_count(), mask), mask_pt);
+    evaluator_->add_plain_inplace(sum, mask_pt);
+  }
+  evaluator_->mod_switch_to_inplace(sum, context_->last_parms_id(), pool);
+  return sum;
+}
+
+AggregateClient::AggregateClient(const EncryptionParameters &enc_params,
+                                 uint64_t ele_num)
+    : enc_params_(enc_params), ele_num_(ele_num) {
+  context_ = make_shared<SEALContext>(enc_params, true);
+  keygen_ = make_unique<KeyGenerator>(*context_);
+  encryptor_ = make_unique<Encryptor>(*context_, keygen_->secret_key());
+  decryptor_ = make_unique<Decryptor>(*context_, keygen_->secret_key());
+  encoder_ = make_unique<BatchEncoder>(*context_);
+}
+
+GaloisKeys AggregateClient::generate_galois_keys() {
+  // step 0 is the column rotation
+  vector<int> steps = {0};
+  for (uint64_t step = 1; step < encoder_->slot_count() / 2; step <<= 1) {
+    steps.push_back(static_cast<int>(step));
+  }
+  GaloisKeys galois_keys;
+  keygen_->create_galois_keys(steps, galois_keys);
+  return galois_keys;
+}
+
+AggregateQuery AggregateClient::generate_query(const vector<uint64_t> &indices) {
+  const uint64_t slots = encoder_->slot_count();
+  vector<vector<uint64_t>> selection((ele_num_ + slots - 1) / slots,
+                                     vector<uint64_t>(slots, 0));
+  for (uint64_t index : indices) {
+    if (index >= ele_num_) {
+      throw invalid_argument("index out of range");
+    }
+    // an index listed twice is still counted once
+    selection[index / slots][index % slots] = 1;
+  }
+
+  AggregateQuery query(selection.size());
+  Plaintext pt;
+  for (uint64_t p = 0; p < selection.size(); p++) {
+    encoder_->encode(selection[p], pt);
+    encryptor_->encrypt_symmetric(pt, query[p]);
+  }
+  return query;
+}
+
+uint64_t AggregateClient::decode_reply(const Ciphertext &reply) {
+  Plaintext pt;
+  vector<uint64_t> slots;
+  decryptor_->decrypt(reply, pt);
+  encoder_->decode(pt, slots);
+  return slots[0];
+}
+
+uint64_t AggregateClient::decode_replies(const vector<Ciphertext> &replies) {
+  const Modulus &t = enc_params_.plain_modulus();
+  uint64_t total = 0;
+  for (const auto &reply : replies) {
+    total = util::add_uint_mod(total, decode_reply(reply), t);
+  }
+  return total;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <seal/seal.h>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Aggregate queries: the sum of one numeric field over a private set of
+// elements, in one reply ciphertext. The field of element i sits in slot
+// i % N of field plaintext i / N. The client sends a slot-packed 0/1
+// selection per field plaintext; the server multiplies, adds the products
+// and sums the slots with log2(N) rotations, so every slot of the reply holds
+// the total mod t and nothing about the individual elements. A count is the
+// sum of a 0/1 field.
+
+// One selection ciphertext per slot_count elements
+typedef std::vector<seal::Ciphertext> AggregateQuery;
+
+// The field of one element, given its ele_size bytes; must be less than t
+typedef std::function<std::uint64_t(const std::uint8_t *element)> AggregateField;
+
+// Reads the little-endian unsigned integer at [offset, offset + size)
+AggregateField aggregate_field_bytes(std::uint64_t offset, std::uint32_t size);
+
+class AggregateServer {
+public:
+  explicit AggregateServer(const seal::EncryptionParameters &enc_params);
+
+  void set_database(const std::unique_ptr<const std::uint8_t[]> &bytes,
+                    std::uint64_t ele_num, std::uint64_t ele_size,
+                    const AggregateField &field);
+  void set_galois_keys(std::uint32_t client_id, seal::GaloisKeys galois_keys);
+
+  // mask is added to the total, for replies whose masks cancel across
+  // servers (see PIRServer::next_mask)
+  seal::Ciphertext generate_reply(const AggregateQuery &query,
+                                  std::uint32_t client_id,
+                                  std::uint64_t mask = 0);
+
+private:
+  seal::EncryptionParameters enc_params_;
+  std::shared_ptr<seal::SEALContext> context_;
+  std::unique_ptr<seal::Evaluator> evaluator_;
+  std::unique_ptr<seal::BatchEncoder> encoder_;
+  std::map<std::uint32_t, std::shared_ptr<const seal::GaloisKeys>> galois_keys_;
+  std::mutex galois_keys_mutex_;
+  std::vector<seal::Plaintext> fields_; // NTT form
+};
+
+class AggregateClient {
+public:
+  AggregateClient(const seal::EncryptionParameters &enc_params,
+                  std::uint64_t ele_num);
+
+  // The row and column rotations of the slot sum
+  seal::GaloisKeys generate_galois_keys();
+
+  AggregateQuery generate_query(const std::vector<std::uint64_t> &indices);
+  std::uint64_t decode_reply(const seal::Ciphertext &reply);
+  // Total over the replies of several servers, whose masks cancel mod t
+  std::uint64_t decode_replies(const std::vector<seal::Ciphertext> &replies);
+
+private:
+  seal::EncryptionParameters enc_params_;
+  std::uint64_t ele_num_;
+  std::shared_ptr<seal::SEALContext> context_;
+  std::unique_ptr<seal::KeyGenerator> keygen_;
+  std::unique_ptr<seal::Encryptor> encryptor_;
+  std::unique_ptr<seal::Decryptor> decryptor_;
+  std::unique_ptr<seal::BatchEncoder> encoder_;
+};
@@ -0,0 +1,285 @@
+#include "pir_autotune.hpp"
+#include "pir_client.hpp"
+#include "pir_server.hpp"
+
+#include <chrono>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace std::chrono;
+using namespace seal;
+
+// Best of three timed runs of `reps` calls, per call
+template <typename Fn> static double seconds_per_call(uint32_t reps, Fn fn) {
+  double best = numeric_limits<double>::max();
+  for (int trial = 0; trial < 3; trial++) {
+    auto start = high_resolution_clock::now();
+    for (uint32_t i = 0; i < reps; i++) {
+      fn();
+    }
+    double elapsed =
+        duration<double>(high_resolution_clock::now() - start).count();
+    best = min(best, elapsed / reps);
+  }
+  return best;
+}
+
+// Runs one retrieval over a small random database split into d dimensions
+static bool retrieval_works(const EncryptionParameters &enc_params,
+                            uint64_t ele_size, uint32_t d,
+                            const TuneOptions &options) {
+  uint32_t logt = floor(log2(enc_params.plain_modulus().value()));
+  uint64_t ele_num =
+      elements_per_ptxt(logt, enc_params.poly_modulus_degree(), ele_size);
+  for (uint32_t i = 0; i < d; i++) {
+    ele_num *= 3;
+  }
+  PirParams pir_params;
+  gen_pir_params(ele_num, ele_size, d, enc_params, pir_params,
+                 options.enable_symmetric, true, options.enable_mswitching);
+
+  mt19937_64 gen(d);
+  auto db(make_unique<uint8_t[]>(ele_num * ele_size));
+  for (uint64_t i = 0; i < ele_num * ele_size; i++) {
+    db.get()[i] = gen() % 256;
+  }
+  uint64_t ele_index = ele_num - 1;
+  vector<uint8_t> expected(db.get() + ele_index * ele_size,
+                           db.get() + (ele_index + 1) * ele_size);
+
+  PIRClient client(enc_params, pir_params);
+  PIRServer server(enc_params, pir_params);
+  server.set_galois_key(0, client.generate_galois_keys());
+  server.set_database(move(db), ele_num, ele_size);
+
+  PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+  PirReply reply = server.generate_reply(query, 0);
+  return client.decode_reply(reply, client.get_fv_offset(ele_index)) ==
+         expected;
+}
+
+KernelCosts measure_kernel_costs(const EncryptionParameters &enc_params,
+                                 uint64_t ele_size, const TuneOptions &options) {
+  const uint32_t expand_m = 64;
+  uint32_t N = enc_params.poly_modulus_degree();
+  uint32_t logt = floor(log2(enc_params.plain_modulus().value()));
+  KernelCosts costs;
+
+  // a one-dimensional database of expand_m plaintexts
+  PirParams pir_params;
+  gen_pir_params(elements_per_ptxt(logt, N, ele_size) * expand_m, ele_size,
+                 vector<uint64_t>{expand_m}, enc_params, pir_params,
+                 options.enable_symmetric, true, options.enable_mswitching);
+  PIRClient client(enc_params, pir_params);
+  PIRServer server(enc_params, pir_params);
+  server.set_galois_key(0, client.generate_galois_keys());
+
+  SEALContext context(enc_params, true);
+  Evaluator evaluator(context);
+  BatchEncoder encoder(context);
+
+  PirQuery query = client.generate_query(0);
+  const Ciphertext &ct = query[0][0];
+  costs.expand_per_output =
+      seconds_per_call(2, [&]() { server.expand_query(ct, expand_m, 0); }) /
+      expand_m;
+
+  Ciphertext work = ct;
+  costs.ntt_per_ciphertext = seconds_per_call(64, [&]() {
+    evaluator.transform_to_ntt_inplace(work);
+    evaluator.transform_from_ntt_inplace(work);
+  });
+
+  mt19937_64 gen(N + logt);
+  vector<uint64_t> coeffs(N);
+  for (auto &c : coeffs) {
+    c = gen() % enc_params.plain_modulus().value();
+  }
+  Plaintext plain;
+  encoder.encode(coeffs, plain);
+  evaluator.transform_to_ntt_inplace(plain, context.first_parms_id());
+  Ciphertext ct_ntt = ct, product, sum;
+  evaluator.transform_to_ntt_inplace(ct_ntt);
+  evaluator.multiply_plain(ct_ntt, plain, sum);
+  costs.multiply_per_plaintext = seconds_per_call(256, [&]() {
+    evaluator.multiply_plain(ct_ntt, plain, product);
+    evaluator.add_inplace(sum, product);
+  });
+
+  // Mirrors one input of a recursion level in finish_reply
+  EncryptionParameters parms = options.enable_mswitching
+                                   ? context.last_context_data()->parms()
+                                   : context.first_context_data()->parms();
+  DecompositionPlan plan = make_decomposition_plan(parms);
+  costs.plaintexts_per_ciphertext = plan.expansion_ratio * ct.size();
+  vector<Plaintext> plains(costs.plaintexts_per_ciphertext);
+  costs.decompose_per_ciphertext = seconds_per_call(16, [&]() {
+    Ciphertext input = ct;
+    if (options.enable_mswitching) {
+      evaluator.mod_switch_to_inplace(input, context.last_parms_id());
+    }
+    decompose_to_plaintexts(plan, input, plains.data());
+    for (auto &p : plains) {
+      evaluator.transform_to_ntt_inplace(p, context.first_parms_id());
+    }
+  });
+
+  stringstream reply_stream;
+  costs.serialize_per_ciphertext = seconds_per_call(16, [&]() {
+    PirReply reply = {ct};
+    reply_stream.str("");
+    costs.reply_ciphertext_bytes = server.serialize_reply(reply, reply_stream);
+  });
+
+  stringstream query_stream;
+  costs.query_ciphertext_bytes =
+      client.generate_serialized_query(0, query_stream);
+
+  costs.max_d = 0;
+  for (uint32_t d = 1; d <= options.max_d; d++) {
+    if (!retrieval_works(enc_params, ele_size, d, options)) {
+      break;
+    }
+    costs.max_d = d;
+  }
+  return costs;
+}
+
+double estimate_server_seconds(const KernelCosts &costs,
+                               const vector<uint64_t> &nvec) {
+  uint64_t product = 1;
+  for (uint64_t n : nvec) {
+    product *= n;
+  }
+
+  // level 0 scans the database; each later level scans the decomposed
+  // outputs of the previous one
+  double seconds = 0;
+  double inputs = product; // plaintexts multiplied at this level
+  for (uint32_t i = 0; i < nvec.size(); i++) {
+    double outputs = inputs / nvec[i];
+    seconds += nvec[i] * (costs.expand_per_output + costs.ntt_per_ciphertext);
+    seconds += inputs * costs.multiply_per_plaintext;
+    seconds += outputs * costs.ntt_per_ciphertext;
+    if (i + 1 < nvec.size()) {
+      seconds += outputs * costs.decompose_per_ciphertext;
+      inputs = outputs * costs.plaintexts_per_ciphertext;
+    } else {
+      seconds += outputs * costs.serialize_per_ciphertext;
+    }
+  }
+  return seconds;
+}
+
+uint64_t estimate_query_bytes(const KernelCosts &costs,
+                              const vector<uint64_t> &nvec, uint32_t N) {
+  uint64_t count = 0;
+  for (uint64_t n : nvec) {
+    count += (n + N - 1) / N;
+  }
+  return count * costs.query_ciphertext_bytes;
+}
+
+uint64_t estimate_reply_bytes(const KernelCosts &costs, uint32_t d) {
+  uint64_t count = 1;
+  for (uint32_t i = 1; i < d; i++) {
+    count *= costs.plaintexts_per_ciphertext;
+  }
+  return count * costs.reply_ciphertext_bytes;
+}
+
+// Candidate sizes for one dimension: every value up to 64, then a geometric
+// grid, then `limit` itself
+static vector<uint64_t> split_candidates(uint64_t limit) {
+  vector<uint64_t> sizes;
+  for (uint64_t n = 2; n <= limit; n = n < 64 ? n + 1 : n + n / 16) {
+    sizes.push_back(n);
+  }
+  if (sizes.empty() || sizes.back() != limit) {
+    sizes.push_back(limit);
+  }
+  return sizes;
+}
+
+// Calls fn with every split of `plaintexts` into d dimensions, each dimension
+// at least 2, the last one the smallest that covers the database
+template <typename Fn>
+static void for_each_split(uint64_t plaintexts, uint32_t d,
+                           vector<uint64_t> &nvec, Fn fn) {
+  uint64_t covered = 1;
+  for (uint64_t n : nvec) {
+    covered *= n;
+  }
+  uint64_t rest = max<uint64_t>(2, (plaintexts + covered - 1) / covered);
+  if (nvec.size() + 1 == d) {
+    nvec.push_back(rest);
+    fn(nvec);
+    nvec.pop_back();
+    return;
+  }
+  for (uint64_t n : split_candidates(rest)) {
+    nvec.push_back(n);
+    for_each_split(plaintexts, d, nvec, fn);
+    nvec.pop_back();
+  }
+}
+
+TuneResult autotune_pir_params(uint64_t ele_num, uint64_t ele_size,
+                               const TuneOptions &options) {
+  TuneResult best;
+  // compared lexicographically: the objective, then server time
+  pair<double, double> best_score(numeric_limits<double>::max(), 0);
+
+  for (uint32_t N : options.poly_degrees) {
+    for (uint32_t logt : options.plain_bits) {
+      EncryptionParameters enc_params(scheme_type::bfv);
+      gen_encryption_params(N, logt, enc_params);
+      if (coefficients_per_element(logt, ele_size) > N) {
+        continue; // an element must fit in one plaintext
+      }
+      verify_encryption_params(enc_params);
+
+      KernelCosts costs = measure_kernel_costs(enc_params, ele_size, options);
+      uint64_t plaintexts = plaintexts_per_db(logt, N, ele_num, ele_size);
+
+      for (uint32_t d = 1; d <= costs.max_d; d++) {
+        vector<uint64_t> nvec;
+        for_each_split(plaintexts, d, nvec, [&](const vector<uint64_t> &split) {
+          // expansion of a dimension that is a multiple of N is not supported
+          for (uint64_t n : split) {
+            if (n % N == 0) {
+              return;
+            }
+          }
+          double seconds = estimate_server_seconds(costs, split);
+          uint64_t bytes = estimate_query_bytes(costs, split, N) +
+                           estimate_reply_bytes(costs, d);
+          pair<double, double> score(seconds, seconds);
+          if (options.objective == TUNE_BANDWIDTH) {
+            score.first = bytes;
+          } else if (options.objective == TUNE_WEIGHTED) {
+            score.first = seconds + bytes / options.link_bytes_per_second;
+          }
+          if (score < best_score) {
+            best_score = score;
+            best.enc_params = enc_params;
+            gen_pir_params(ele_num, ele_size, split, enc_params,
+                           best.pir_params, options.enable_symmetric, true,
+                           options.enable_mswitching);
+            best.server_seconds = seconds;
+            best.query_bytes = estimate_query_bytes(costs, split, N);
+            best.reply_bytes = estimate_reply_bytes(costs, d);
+          }
+        });
+      }
+    }
+  }
+
+  if (best_score.first == numeric_limits<double>::max()) {
+    throw invalid_argument("no candidate parameters fit the element size");
+  }
+  return best;
+}
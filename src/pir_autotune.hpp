@@ -0,0 +1,62 @@
+#pragma once
+
+#include "pir.hpp"
+#include <cstdint>
+#include <vector>
+
+// Parameter autotuner: times the reply kernels on this host for each
+// candidate (N, logt), then searches d and the dimension split with a cost
+// model of generate_reply.
+
+enum TuneObjective {
+  TUNE_LATENCY,   // server time per reply
+  TUNE_BANDWIDTH, // query + reply bytes
+  TUNE_WEIGHTED,  // server time plus transfer time over the given link
+};
+
+struct TuneOptions {
+  TuneObjective objective = TUNE_LATENCY;
+  double link_bytes_per_second = 12.5e6; // TUNE_WEIGHTED only (100 Mbit/s)
+  std::vector<std::uint32_t> poly_degrees = {4096, 8192};
+  std::vector<std::uint32_t> plain_bits = {16, 20};
+  std::uint32_t max_d = 3;
+  bool enable_symmetric = false;
+  bool enable_mswitching = true;
+};
+
+// Measured per-operation costs, in seconds, for one set of encryption
+// parameters
+struct KernelCosts {
+  double expand_per_output;        // expand_query, per expanded ciphertext
+  double ntt_per_ciphertext;       // forward + inverse transform
+  double multiply_per_plaintext;   // multiply_plain + add in NTT form
+  double decompose_per_ciphertext; // mod switch, decompose, NTT the pieces
+  double serialize_per_ciphertext; // mod switch and save a reply ciphertext
+  std::uint64_t query_ciphertext_bytes;
+  std::uint64_t reply_ciphertext_bytes;
+  std::uint32_t plaintexts_per_ciphertext; // decomposition fan-out
+  std::uint32_t max_d; // deepest recursion that still decrypted correctly
+};
+
+struct TuneResult {
+  seal::EncryptionParameters enc_params{seal::scheme_type::bfv};
+  PirParams pir_params;
+  double server_seconds;
+  std::uint64_t query_bytes;
+  std::uint64_t reply_bytes;
+};
+
+KernelCosts measure_kernel_costs(const seal::EncryptionParameters &enc_params,
+                                 std::uint64_t ele_size,
+                                 const TuneOptions &options);
+
+// Model of generate_reply / query and reply sizes for the given split
+double estimate_server_seconds(const KernelCosts &costs,
+                               const std::vector<std::uint64_t> &nvec);
+std::uint64_t estimate_query_bytes(const KernelCosts &costs,
+                                   const std::vector<std::uint64_t> &nvec,
+                                   std::uint32_t N);
+std::uint64_t estimate_reply_bytes(const KernelCosts &costs, std::uint32_t d);
+
+TuneResult autotune_pir_params(std::uint64_t ele_num, std::uint64_t ele_size,
+                               const TuneOptions &options = TuneOptions());
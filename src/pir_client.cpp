@@ -7,6 +7,8 @@
     #include <fstream>
 #endif
 
+#include <map>
+
 using namespace std;
 using namespace seal;
 using namespace seal::util;
@@ -36,6 +38,7 @@ PIRClient::PIRClient(const EncryptionParameters &enc_params,
 
 int PIRClient::generate_serialized_query(uint64_t desiredIndex,
                                          std::stringstream &stream) {
+  PhaseTimer timer(metrics_, PHASE_QUERY);
 
   int N = enc_params_.poly_modulus_degree();
   int output_size = 0;
@@ -43,6 +46,16 @@ int PIRClient::generate_serialized_query(uint64_t desiredIndex,
   Plaintext pt(enc_params_.poly_modulus_degree());
 
   for (uint32_t i = 0; i < indices_.size(); i++) {
+    if (pir_params_.enable_rgsw_folding && i > 0) {
+      vector<Ciphertext> rows;
+      for (uint32_t b = 0; b < folding_bits(pir_params_.nvec[i]); b++) {
+        encrypt_rgsw_bit((indices_[i] >> b) & 1, rows);
+      }
+      for (auto &row : rows) {
+        output_size += row.save(stream);
+      }
+      continue;
+    }
     uint32_t num_ptxts = ceil((pir_params_.nvec[i] + 0.0) / N);
     // initialize result.
     // cout << "Client: index " << i + 1 << "/ " << indices_.size() << " = "
@@ -77,6 +90,7 @@ int PIRClient::generate_serialized_query(uint64_t desiredIndex,
 }
 
 PirQuery PIRClient::generate_query(uint64_t desiredIndex) {
+  PhaseTimer timer(metrics_, PHASE_QUERY);
 
   indices_ = compute_indices(desiredIndex, pir_params_.nvec);
 
@@ -85,6 +99,13 @@ PirQuery PIRClient::generate_query(uint64_t desiredIndex) {
 
   Plaintext pt(enc_params_.poly_modulus_degree());
   for (uint32_t i = 0; i < indices_.size(); i++) {
+    if (pir_params_.enable_rgsw_folding && i > 0) {
+      // the bits of the row index, least significant first
+      for (uint32_t b = 0; b < folding_bits(pir_params_.nvec[i]); b++) {
+        encrypt_rgsw_bit((indices_[i] >> b) & 1, result[i]);
+      }
+      continue;
+    }
     uint32_t num_ptxts = ceil((pir_params_.nvec[i] + 0.0) / N);
     // initialize result.
     // cout << "Client: index " << i + 1 << "/ " << indices_.size() << " = "
@@ -119,6 +140,34 @@ PirQuery PIRClient::generate_query(uint64_t desiredIndex) {
   return result;
 }
 
+void PIRClient::encrypt_rgsw_bit(bool bit, vector<Ciphertext> &rows) {
+  auto context_data = context_->first_context_data();
+  const auto &coeff_modulus = context_data->parms().coeff_modulus();
+  DecompositionPlan plan = make_folding_plan(context_data->parms());
+
+  // Row (p, e) adds bit * 2^shift[e] * g_j to polynomial p, where g_j is the
+  // CRT basis element of prime j = modulus_index[e]: 1 mod q_j and 0 mod the
+  // other primes, so only coefficient 0 of prime j changes
+  for (size_t p = 0; p < 2; p++) {
+    for (size_t e = 0; e < plan.expansion_ratio; e++) {
+      Ciphertext row;
+      if (pir_params_.enable_symmetric) {
+        encryptor_->encrypt_zero_symmetric(row);
+      } else {
+        encryptor_->encrypt_zero(row);
+      }
+      if (bit) {
+        const Modulus &q_j = coeff_modulus[plan.modulus_index[e]];
+        uint64_t &c = row.data(p)[plan.modulus_index[e] * plan.coeff_count];
+        c = add_uint_mod(c, barrett_reduce_64(uint64_t(1) << plan.shift[e], q_j),
+                         q_j);
+      }
+      evaluator_->transform_to_ntt_inplace(row);
+      rows.push_back(move(row));
+    }
+  }
+}
+
 uint64_t PIRClient::get_fv_index(uint64_t element_index) {
   return static_cast<uint64_t>(element_index /
                                pir_params_.elements_per_plaintext);
@@ -139,6 +188,12 @@ vector<uint8_t> PIRClient::decode_reply(PirReply &reply, uint64_t offset) {
   return extract_bytes(result, offset);
 }
 
+vector<vector<uint8_t>>
+PIRClient::decode_reply(PirReply &reply, const vector<uint64_t> &offsets) {
+  Plaintext result = decode_reply(reply);
+  return extract_bytes(result, offsets);
+}
+
 vector<uint64_t> PIRClient::extract_coeffs(Plaintext pt) {
   vector<uint64_t> coeffs;
   encoder_->decode(pt, coeffs);
@@ -147,6 +202,9 @@ vector<uint64_t> PIRClient::extract_coeffs(Plaintext pt) {
 
 std::vector<uint64_t> PIRClient::extract_coeffs(seal::Plaintext pt,
                                                 uint64_t offset) {
+  if (pir_params_.enable_dense_packing) {
+    throw logic_error("densely packed elements have no coefficients of their own");
+  }
   vector<uint64_t> coeffs;
   encoder_->decode(pt, coeffs);
 
@@ -162,87 +220,113 @@ std::vector<uint64_t> PIRClient::extract_coeffs(seal::Plaintext pt,
 
 std::vector<uint8_t> PIRClient::extract_bytes(seal::Plaintext pt,
                                               uint64_t offset) {
-  uint32_t N = enc_params_.poly_modulus_degree();
-  uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
-  uint32_t bytes_per_ptxt =
-      pir_params_.elements_per_plaintext * pir_params_.ele_size;
+  vector<uint64_t> coeffs;
+  encoder_->decode(pt, coeffs);
+
+  vector<uint8_t> elem(pir_params_.ele_size);
+  element_to_bytes(coeffs, offset, elem.data());
+  return elem;
+}
 
-  // Convert from FV plaintext (polynomial) to database element at the client
-  vector<uint8_t> elems(bytes_per_ptxt);
+vector<vector<uint8_t>>
+PIRClient::extract_bytes(const Plaintext &pt, const vector<uint64_t> &offsets) {
   vector<uint64_t> coeffs;
   encoder_->decode(pt, coeffs);
-  coeffs_to_bytes(logt, coeffs, elems.data(), bytes_per_ptxt,
-                  pir_params_.ele_size);
-  return std::vector<uint8_t>(elems.begin() + offset * pir_params_.ele_size,
-                              elems.begin() +
-                                  (offset + 1) * pir_params_.ele_size);
+
+  vector<vector<uint8_t>> elems(offsets.size(),
+                                vector<uint8_t>(pir_params_.ele_size));
+  for (size_t i = 0; i < offsets.size(); i++) {
+    element_to_bytes(coeffs, offsets[i], elems[i].data());
+  }
+  return elems;
+}
+
+void PIRClient::element_to_bytes(const vector<uint64_t> &coeffs,
+                                 uint64_t offset, uint8_t *output) {
+  uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
+  uint64_t coeff_per_ele =
+      coefficients_per_element(logt, pir_params_.ele_size);
+  assert(offset < pir_params_.elements_per_plaintext);
+
+  if (pir_params_.enable_dense_packing) {
+    dense_coeffs_to_bytes(logt, coeffs.data(), coeffs.size(),
+                          offset * 8 * pir_params_.ele_size, output,
+                          pir_params_.ele_size);
+    return;
+  }
+  // Only the coefficients of the requested element are converted
+  coeffs_to_bytes(logt, coeffs.data() + offset * coeff_per_ele, coeff_per_ele,
+                  output, pir_params_.ele_size, pir_params_.ele_size);
 }
 
 Plaintext PIRClient::decode_reply(PirReply &reply) {
-  EncryptionParameters parms;
-  parms_id_type parms_id;
-  if (pir_params_.enable_mswitching) {
-    parms = context_->last_context_data()->parms();
-    parms_id = context_->last_parms_id();
+  PIRReplyDecoder decoder(*this);
+  for (const auto &ct : reply) {
+    decoder.add(ct);
+  }
+  return decoder.result();
+}
+
+PIRReplyDecoder::PIRReplyDecoder(PIRClient &client)
+    : client_(client),
+      // a folded reply is already the single ciphertext of the last layer
+      layers_(client.pir_params_.enable_rgsw_folding ? 1 : client.pir_params_.d),
+      done_(false) {
+  if (client_.pir_params_.enable_mswitching) {
+    parms_id_ = client_.context_->last_parms_id();
   } else {
-    parms = context_->first_context_data()->parms();
-    parms_id = context_->first_parms_id();
+    parms_id_ = client_.context_->first_parms_id();
   }
-  uint32_t exp_ratio = compute_expansion_ratio(parms);
-  uint32_t recursion_level = pir_params_.d;
-
-  vector<Ciphertext> temp = reply;
-  uint32_t ciphertext_size = temp[0].size();
-
-  uint64_t t = enc_params_.plain_modulus().value();
-
-  for (uint32_t i = 0; i < recursion_level; i++) {
-    // cout << "Client: " << i + 1 << "/ " << recursion_level
-    //      << "-th decryption layer started." << endl;
-    vector<Ciphertext> newtemp;
-    vector<Plaintext> tempplain;
-
-    for (uint32_t j = 0; j < temp.size(); j++) {
-      Plaintext ptxt;
-      decryptor_->decrypt(temp[j], ptxt);
-// #ifdef DEBUG
-//       cout << "Client: reply noise budget = "
-//            << decryptor_->invariant_noise_budget(temp[j]) << endl;
-// #endif
-
-      // cout << "decoded (and scaled) plaintext = " << ptxt.to_string() <<
-      // endl;
-      tempplain.push_back(ptxt);
-
-// #ifdef DEBUG
-//       cout << "recursion level : " << i << " noise budget :  ";
-//       cout << decryptor_->invariant_noise_budget(temp[j]) << endl;
-// #endif
-
-      if ((j + 1) % (exp_ratio * ciphertext_size) == 0 && j > 0) {
-        // Combine into one ciphertext.
-        Ciphertext combined(*context_, parms_id);
-        compose_to_ciphertext(parms, tempplain, combined);
-        newtemp.push_back(combined);
-        tempplain.clear();
-        // cout << "Client: const term of ciphertext = " << combined[0] << endl;
-      }
-    }
-    // cout << "Client: done." << endl;
-    // cout << endl;
-    if (i == recursion_level - 1) {
-      assert(temp.size() == 1);
-      return tempplain[0];
-    } else {
-      tempplain.clear();
-      temp = newtemp;
-    }
+  plan_ = make_decomposition_plan(
+      client_.context_->get_context_data(parms_id_)->parms());
+}
+
+void PIRReplyDecoder::add(const Ciphertext &ct) {
+  PhaseTimer timer(client_.metrics_, PHASE_DECODE);
+  add(ct, 0);
+}
+
+void PIRReplyDecoder::add(const string &ct) {
+  PhaseTimer timer(client_.metrics_, PHASE_DECODE);
+  Ciphertext loaded;
+  istringstream input(ct);
+  loaded.load(*client_.context_, input);
+  add(loaded, 0);
+}
+
+void PIRReplyDecoder::add(const Ciphertext &ct, uint32_t layer) {
+  if (done_) {
+    throw logic_error("reply is already complete");
+  }
+  Plaintext ptxt;
+  client_.metrics_.add(COUNT_DECRYPT);
+  client_.decryptor_->decrypt(ct, ptxt);
+
+  if (layer == layers_.size() - 1) {
+    // the last layer is a single ciphertext holding the element
+    result_ = move(ptxt);
+    done_ = true;
+    return;
+  }
+
+  vector<Plaintext> &pending = layers_[layer];
+  pending.push_back(move(ptxt));
+  if (pending.size() == plan_.expansion_ratio * ct.size()) {
+    // Combine into one ciphertext of the next layer.
+    Ciphertext combined(*client_.context_, parms_id_);
+    compose_to_ciphertext(plan_, pending.begin(), ct.size(), combined);
+    pending.clear();
+    add(combined, layer + 1);
   }
+}
+
+bool PIRReplyDecoder::done() const { return done_; }
 
-  // This should never be called
-  assert(0);
-  Plaintext fail;
-  return fail;
+Plaintext &PIRReplyDecoder::result() {
+  if (!done_) {
+    throw logic_error("reply is incomplete");
+  }
+  return result_;
 }
 
 GaloisKeys PIRClient::generate_galois_keys() {
@@ -266,6 +350,9 @@ GaloisKeys PIRClient::generate_galois_keys() {
 
 Plaintext PIRClient::replace_element(Plaintext pt, vector<uint64_t> new_element,
                                      uint64_t offset) {
+  if (pir_params_.enable_dense_packing) {
+    throw logic_error("densely packed elements have no coefficients of their own");
+  }
   vector<uint64_t> coeffs = extract_coeffs(pt);
 
   uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
@@ -355,103 +442,67 @@ vector<PirQuery> PIRClient::generate_batch_query(vector<uint64_t> &desired_index
 }
 
 vector<vector<uint8_t>> PIRClient::debatch_reply(vector<PirReply> &batch_reply, vector<Index> &elem_index_with_ptr) {
-    vector<vector<uint8_t>> elems;
+    vector<vector<uint8_t>> elems(elem_index_with_ptr.size());
 
-    for (auto it = elem_index_with_ptr.begin(); it < elem_index_with_ptr.end(); it++) {
-        uint64_t reply_id = it->fv_info_ptr->reply_id;
-        uint64_t offset = it->fv_info_ptr->fv_offset;
-        PirReply reply = batch_reply[reply_id];
-        elems.push_back(decode_reply(reply, offset));
+    // Decode every reply once and pull out all the offsets requested from it.
+    map<uint64_t, vector<size_t>> elems_per_reply;
+    for (size_t i = 0; i < elem_index_with_ptr.size(); i++) {
+        elems_per_reply[elem_index_with_ptr[i].fv_info_ptr->reply_id].push_back(i);
+    }
+
+    for (auto &entry : elems_per_reply) {
+        vector<uint64_t> offsets;
+        for (size_t pos : entry.second) {
+            offsets.push_back(elem_index_with_ptr[pos].fv_info_ptr->fv_offset);
+        }
+        vector<vector<uint8_t>> decoded = decode_reply(batch_reply[entry.first], offsets);
+        for (size_t k = 0; k < entry.second.size(); k++) {
+            elems[entry.second[k]] = move(decoded[k]);
+        }
     }
 
     return elems;
 }
 
 vector<uint8_t> PIRClient::deconfuse_and_decode_replies(vector<PirReply> &replies, uint64_t offset) {
-    uint64_t mod = enc_params_.plain_modulus().value();
-    uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
-    uint32_t N = enc_params_.poly_modulus_degree();
-    uint64_t ele_per_ptxt = pir_params_.elements_per_plaintext;
-    uint64_t ele_size = pir_params_.ele_size;
-    uint64_t coeff_per_ele = coefficients_per_element(logt, ele_size);
-    uint64_t coeff_per_ptxt = ele_per_ptxt * coeff_per_ele;
-    assert(coeff_per_ptxt <= N);
-
-    Plaintext result;
-    vector<uint64_t> result_coeffs;
-    vector<vector<uint64_t>> decoded_coeffs;
-
-    for (auto reply: replies) {
-        Plaintext decoded_reply = decode_reply(reply);
-        vector<uint64_t> coeffs;
-        encoder_->decode(decoded_reply, coeffs);
-        decoded_coeffs.push_back(coeffs);
-    }
-#ifdef DEBUG
-    ofstream debuglog;
-    debuglog.open("../src/debug/debug_log3.txt");
-    size_t cnt = 0;
-    debuglog << "Client: `deconfuse_and_decode_replies` debug:" << endl;
-    for (auto reply: replies) {
-        debuglog << "decoding reply " << ++cnt << "..." << endl;
-        Plaintext decoded_reply = decode_reply(reply);
-        vector<uint8_t> elems = extract_bytes(decoded_reply, offset);
-        for (int i = 0; i < ele_size / 64; i ++) {
-            for (int j = 0; j < 64; j ++) {
-                debuglog << setfill('0') << setw(2) << hex
-                 << (int)elems[i * (ele_size/64) + j]
-                 << " ";
-            }
-            debuglog << endl;
-        }
-    }
+    return deconfuse_and_decode_replies(replies, vector<uint64_t>{offset})[0];
+}
 
-    cnt = 0;
-    for (auto coeffs: decoded_coeffs) {
-        debuglog << "retaining elems from decoded coeffs " << ++cnt << "..." << endl;
-        Plaintext pt;
-        encoder_->encode(coeffs, pt);
-        vector<uint8_t> elems = extract_bytes(pt, offset);
-        for (int i = 0; i < ele_size / 64; i ++) {
-            for (int j = 0; j < 64; j ++) {
-                debuglog << setfill('0') << setw(2) << hex
-                 << (int)elems[i * (ele_size/64) + j]
-                 << " ";
-            }
-            debuglog << endl;
-        }
+vector<vector<uint8_t>> PIRClient::deconfuse_and_decode_replies(vector<PirReply> &replies, const vector<uint64_t> &offsets) {
+    PIRShareAccumulator shares(*this);
+    for (auto &reply: replies) {
+        shares.add(reply);
     }
-    debuglog << endl;
-    debuglog.close();
-#endif
+    return shares.extract(offsets);
+}
 
-#ifdef DEBUG
-    debuglog.open("../src/debug/debug_log1.txt");
-#endif
+PIRShareAccumulator::PIRShareAccumulator(PIRClient &client)
+    : client_(client), sum_(client.encoder_->slot_count(), 0), count_(0) {}
 
-    for (uint64_t i = 0UL; i < coeff_per_ptxt; i ++) {
-        uint64_t temp = 0UL;
-        for (uint64_t j = 0UL; j < decoded_coeffs.size(); j ++) {
-            temp = (temp + decoded_coeffs[j][i]) % mod;
-            // temp = (temp + decoded_coeffs[j][i]);
-#ifdef DEBUG
-            if (i >= offset * coeff_per_ele && i < (offset+1) * coeff_per_ele) {
-                debuglog << dec << "j = " << j << ", i = " << i << ". temp = ";
-                debuglog << setfill('0') << setw(16) << hex << temp << endl;
-            }
-#endif
-        }
-        result_coeffs.push_back(temp);
+void PIRShareAccumulator::add(PirReply &reply) {
+    const Modulus &mod = client_.enc_params_.plain_modulus();
+    Plaintext decoded_reply = client_.decode_reply(reply);
+    vector<uint64_t> coeffs;
+    client_.encoder_->decode(decoded_reply, coeffs);
+    for (size_t i = 0; i < sum_.size(); i++) {
+        sum_[i] = add_uint_mod(sum_[i], coeffs[i], mod);
     }
+    count_++;
+}
 
-#ifdef DEBUG
-    debuglog << endl;
-    debuglog.close();
-#endif
+size_t PIRShareAccumulator::count() const { return count_; }
 
-    encoder_->encode(result_coeffs, result);
+vector<vector<uint8_t>> PIRShareAccumulator::extract(const vector<uint64_t> &offsets) const {
+    // The additive masks cancel out mod t; only the coefficients of the
+    // requested elements are converted.
+    vector<vector<uint8_t>> results;
+    for (uint64_t offset : offsets) {
+        vector<uint8_t> elem(client_.pir_params_.ele_size);
+        client_.element_to_bytes(sum_, offset, elem.data());
+        results.push_back(move(elem));
+    }
 
-    return extract_bytes(result, offset);
+    return results;
 }
 
 #define DEBUG_BATCH_XXX
@@ -464,17 +515,29 @@ vector<vector<uint8_t>> PIRClient::batch_deconfuse_and_decode_replies(vector<Pir
 #ifdef DEBUG_BATCH_XXX
     cout << "Here" << endl;
 #endif
-    
-    for (auto e : elem_index_with_ptr) {
+
+    results.resize(elem_index_with_ptr.size());
+    map<uint64_t, vector<size_t>> elems_per_reply;
+    for (size_t i = 0; i < elem_index_with_ptr.size(); i++) {
+        elems_per_reply[elem_index_with_ptr[i].fv_info_ptr->reply_id].push_back(i);
+    }
+
+    for (auto &entry : elems_per_reply) {
         vector<PirReply> multi_party_reply;
-        for (auto batch_reply : multi_party_batch_reply) {
-            multi_party_reply.push_back(batch_reply[e.fv_info_ptr->reply_id]);
+        for (auto &batch_reply : multi_party_batch_reply) {
+            multi_party_reply.push_back(batch_reply[entry.first]);
+        }
+        vector<uint64_t> offsets;
+        for (size_t pos : entry.second) {
+            offsets.push_back(elem_index_with_ptr[pos].fv_info_ptr->fv_offset);
         }
 #ifdef DEBUG_BATCH_XXX
         cout << "Here" << endl;
 #endif
-        vector<uint8_t> result = deconfuse_and_decode_replies(multi_party_reply, e.fv_info_ptr->fv_offset);
-        results.push_back(result);
+        vector<vector<uint8_t>> decoded = deconfuse_and_decode_replies(multi_party_reply, offsets);
+        for (size_t k = 0; k < entry.second.size(); k++) {
+            results[entry.second[k]] = move(decoded[k]);
+        }
     }
 
     return results;
@@ -1,9 +1,11 @@
 #pragma once
 
 #include "pir.hpp"
+#include "pir_metrics.hpp"
 #include <memory>
 #include <vector>
 #include <list>
+#include <string>
 
 using namespace std;
 
@@ -23,16 +25,27 @@ public:
   seal::Plaintext decode_reply(PirReply &reply);
 
   std::vector<uint64_t> extract_coeffs(seal::Plaintext pt);
+  // The per-element coefficient views below throw with dense packing, where
+  // elements share coefficients
   std::vector<uint64_t> extract_coeffs(seal::Plaintext pt,
                                        std::uint64_t offset);
   std::vector<uint8_t> extract_bytes(seal::Plaintext pt, std::uint64_t offset);
+  // Decodes pt once and converts only the coefficients of the requested
+  // elements, in the order of `offsets`
+  std::vector<std::vector<uint8_t>>
+  extract_bytes(const seal::Plaintext &pt,
+                const std::vector<std::uint64_t> &offsets);
 
   std::vector<std::vector<uint8_t>> debatch_reply(std::vector<PirReply> &batch_reply, 
                                                        std::vector<Index> &elem_index_with_ptr);
 
   std::vector<uint8_t> decode_reply(PirReply &reply, uint64_t offset);
+  std::vector<std::vector<uint8_t>>
+  decode_reply(PirReply &reply, const std::vector<std::uint64_t> &offsets);
 
   std::vector<uint8_t> deconfuse_and_decode_replies(std::vector<PirReply> &replies, std::uint64_t offset);
+  std::vector<std::vector<uint8_t>> deconfuse_and_decode_replies(std::vector<PirReply> &replies,
+                                                                 const std::vector<std::uint64_t> &offsets);
 
   std::vector<vector<uint8_t>> batch_deconfuse_and_decode_replies(std::vector<PirBatchReply> multi_party_batch_reply, std::uint32_t party_num, std::vector<Index> &elem_index_with_ptr);
 
@@ -40,6 +53,9 @@ public:
 
   seal::GaloisKeys generate_galois_keys();
 
+  // Query generation and decoding latencies
+  PirMetrics &metrics() { return metrics_; }
+
   // Index and offset of an element in an FV plaintext
   uint64_t get_fv_index(uint64_t element_index);
   uint64_t get_fv_offset(uint64_t element_index);
@@ -64,6 +80,64 @@ private:
 
   vector<uint64_t> indices_; // the indices for retrieval.
   vector<uint64_t> inverse_scales_;
+  PirMetrics metrics_;
+
+  // Appends the RGSW rows of a selection bit for dimensions folded with
+  // external products: encryptions of zero plus bit times one gadget value,
+  // in NTT form, in the server's digit order
+  void encrypt_rgsw_bit(bool bit, std::vector<seal::Ciphertext> &rows);
+
+  // Converts the coefficients of the element at `offset` into ele_size bytes
+  void element_to_bytes(const std::vector<std::uint64_t> &coeffs,
+                        std::uint64_t offset, std::uint8_t *output);
 
   friend class PIRServer;
+  friend class PIRReplyDecoder;
+  friend class PIRShareAccumulator;
+};
+
+// Sums the decoded replies of the parties of a masked multi-server query.
+// Replies are added in whatever order they arrive; the masks cancel once
+// every party's reply is in.
+class PIRShareAccumulator {
+public:
+  explicit PIRShareAccumulator(PIRClient &client);
+
+  void add(PirReply &reply);
+  std::size_t count() const;
+  // Bytes of the elements at `offsets` of the summed plaintext
+  std::vector<std::vector<std::uint8_t>>
+  extract(const std::vector<std::uint64_t> &offsets) const;
+
+private:
+  PIRClient &client_;
+  std::vector<std::uint64_t> sum_; // slot values mod t
+  std::size_t count_;
+};
+
+// Incremental form of PIRClient::decode_reply for streamed replies: reply
+// ciphertexts are added in index order and each recursion layer is
+// decrypted and recomposed as soon as its inputs are complete.
+class PIRReplyDecoder {
+public:
+  explicit PIRReplyDecoder(PIRClient &client);
+
+  void add(const seal::Ciphertext &ct);
+  // Loads a ciphertext serialized by the server
+  void add(const std::string &ct);
+
+  bool done() const;
+  // The decoded plaintext; only valid once done()
+  seal::Plaintext &result();
+
+private:
+  PIRClient &client_;
+  seal::parms_id_type parms_id_;
+  DecompositionPlan plan_;
+  // decrypted plaintexts waiting to be composed, per recursion layer
+  std::vector<std::vector<seal::Plaintext>> layers_;
+  bool done_;
+  seal::Plaintext result_;
+
+  void add(const seal::Ciphertext &ct, std::uint32_t layer);
 };
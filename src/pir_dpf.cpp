@@ -0,0 +1,430 @@
+#include "pir_dpf.hpp"
+
+#include <seal/randomgen.h>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#define DPF_HAVE_X86 1
+#endif
+
+using namespace std;
+using namespace seal;
+
+namespace {
+
+// Each leaf of the tree is one block of 128 points
+constexpr uint32_t kLeafBits = 7;
+// Nodes per task when a level is expanded on the pool
+constexpr uint64_t kNodesPerTask = 1024;
+
+constexpr uint8_t kSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+    0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+    0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+    0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+    0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+    0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+    0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+    0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+    0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+    0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+    0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+    0xb0, 0x54, 0xbb, 0x16};
+
+struct AesRoundKeys {
+  uint8_t bytes[11][16];
+};
+
+AesRoundKeys aes128_expand_key(const uint8_t key[16]) {
+  static const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10,
+                                   0x20, 0x40, 0x80, 0x1b, 0x36};
+  AesRoundKeys rk;
+  memcpy(rk.bytes[0], key, 16);
+  for (int r = 1; r <= 10; r++) {
+    const uint8_t *prev = rk.bytes[r - 1];
+    uint8_t *cur = rk.bytes[r];
+    uint8_t temp[4] = {kSbox[prev[13]], kSbox[prev[14]], kSbox[prev[15]],
+                       kSbox[prev[12]]};
+    temp[0] ^= rcon[r - 1];
+    for (int i = 0; i < 16; i++) {
+      cur[i] = prev[i] ^ (i < 4 ? temp[i] : cur[i - 4]);
+    }
+  }
+  return rk;
+}
+
+inline uint8_t xtime(uint8_t x) {
+  return static_cast<uint8_t>((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+void aes128_block_portable(const AesRoundKeys &rk, const uint8_t in[16],
+                           uint8_t out[16]) {
+  uint8_t s[16];
+  for (int i = 0; i < 16; i++) {
+    s[i] = in[i] ^ rk.bytes[0][i];
+  }
+  for (int r = 1; r <= 10; r++) {
+    // SubBytes and ShiftRows; byte i is row i % 4 of column i / 4
+    uint8_t t[16];
+    for (int i = 0; i < 16; i++) {
+      t[i] = kSbox[s[(i + 4 * (i % 4)) % 16]];
+    }
+    if (r < 10) {
+      for (int c = 0; c < 4; c++) {
+        uint8_t *col = t + 4 * c;
+        uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        uint8_t first = col[0];
+        col[0] ^= all ^ xtime(col[0] ^ col[1]);
+        col[1] ^= all ^ xtime(col[1] ^ col[2]);
+        col[2] ^= all ^ xtime(col[2] ^ col[3]);
+        col[3] ^= all ^ xtime(col[3] ^ first);
+      }
+    }
+    for (int i = 0; i < 16; i++) {
+      s[i] = t[i] ^ rk.bytes[r][i];
+    }
+  }
+  memcpy(out, s, 16);
+}
+
+void aes128_portable(const AesRoundKeys &rk, const DpfBlock *in,
+                     DpfBlock *out, size_t count, size_t out_stride) {
+  for (size_t i = 0; i < count; i++) {
+    aes128_block_portable(rk, reinterpret_cast<const uint8_t *>(in + i),
+                          reinterpret_cast<uint8_t *>(out + i * out_stride));
+  }
+}
+
+#ifdef DPF_HAVE_X86
+// Four independent blocks are kept in flight to hide the latency of aesenc
+__attribute__((target("aes,sse2"))) void
+aes128_aesni(const AesRoundKeys &rk, const DpfBlock *in, DpfBlock *out,
+             size_t count, size_t out_stride) {
+  __m128i k[11];
+  for (int r = 0; r <= 10; r++) {
+    k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rk.bytes[r]));
+  }
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i b[4];
+    for (int j = 0; j < 4; j++) {
+      b[j] = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + j)), k[0]);
+    }
+    for (int r = 1; r < 10; r++) {
+      for (int j = 0; j < 4; j++) {
+        b[j] = _mm_aesenc_si128(b[j], k[r]);
+      }
+    }
+    for (int j = 0; j < 4; j++) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (i + j) * out_stride),
+                       _mm_aesenclast_si128(b[j], k[10]));
+    }
+  }
+  for (; i < count; i++) {
+    __m128i b = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), k[0]);
+    for (int r = 1; r < 10; r++) {
+      b = _mm_aesenc_si128(b, k[r]);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * out_stride),
+                     _mm_aesenclast_si128(b, k[10]));
+  }
+}
+#endif
+
+bool cpu_has_aesni() {
+#ifdef DPF_HAVE_X86
+  return __builtin_cpu_supports("aes");
+#else
+  return false;
+#endif
+}
+
+atomic<bool> aesni_enabled(true);
+
+void aes128(const AesRoundKeys &rk, const DpfBlock *in, DpfBlock *out,
+            size_t count, size_t out_stride) {
+#ifdef DPF_HAVE_X86
+  static const bool has_aesni = cpu_has_aesni();
+  if (has_aesni && aesni_enabled.load(memory_order_relaxed)) {
+    aes128_aesni(rk, in, out, count, out_stride);
+    return;
+  }
+#endif
+  aes128_portable(rk, in, out, count, out_stride);
+}
+
+// Fixed public keys of the two halves of the length-doubling PRG
+const AesRoundKeys &prg_key(int half) {
+  static const uint8_t raw[2][16] = {
+      {0x5d, 0x1b, 0x8c, 0x0f, 0xa3, 0x47, 0x92, 0xe6, 0x3b, 0x71, 0xc4,
+       0x28, 0x9e, 0x05, 0xd6, 0x6a},
+      {0xc2, 0x64, 0x1f, 0xb9, 0x07, 0xe8, 0x5a, 0x33, 0x9d, 0x41, 0xf0,
+       0x7c, 0x26, 0xab, 0x18, 0x85}};
+  static const AesRoundKeys keys[2] = {aes128_expand_key(raw[0]),
+                                       aes128_expand_key(raw[1])};
+  return keys[half];
+}
+
+inline DpfBlock operator^(DpfBlock a, DpfBlock b) {
+  return DpfBlock{a.lo ^ b.lo, a.hi ^ b.hi};
+}
+
+inline DpfBlock select(uint8_t bit, DpfBlock b) {
+  uint64_t mask = 0 - uint64_t(bit & 1);
+  return DpfBlock{b.lo & mask, b.hi & mask};
+}
+
+// children[2i] and children[2i + 1] are the left and right expansions of
+// seeds[i]: AES_k(s) ^ s for the two fixed keys
+void prg_expand(const DpfBlock *seeds, size_t count, DpfBlock *children) {
+  aes128(prg_key(0), seeds, children, count, 2);
+  aes128(prg_key(1), seeds, children + 1, count, 2);
+  for (size_t i = 0; i < count; i++) {
+    children[2 * i] = children[2 * i] ^ seeds[i];
+    children[2 * i + 1] = children[2 * i + 1] ^ seeds[i];
+  }
+}
+
+// Output block of a leaf seed
+void convert(const DpfBlock *seeds, size_t count, DpfBlock *out) {
+  aes128(prg_key(0), seeds, out, count, 1);
+  for (size_t i = 0; i < count; i++) {
+    out[i] = out[i] ^ seeds[i];
+  }
+}
+
+// Splits the control bit off a child seed
+inline uint8_t take_control(DpfBlock &seed) {
+  uint8_t t = seed.lo & 1;
+  seed.lo &= ~uint64_t(1);
+  return t;
+}
+
+uint32_t tree_levels(const DpfKey &key) { return key.domain_bits - kLeafBits; }
+
+} // namespace
+
+uint32_t dpf_domain_bits(uint64_t domain_size) {
+  uint32_t bits = kLeafBits;
+  while (bits < 64 && (uint64_t(1) << bits) < domain_size) {
+    bits++;
+  }
+  return bits;
+}
+
+pair<DpfKey, DpfKey> dpf_gen(uint64_t alpha, uint32_t domain_bits) {
+  if (domain_bits < kLeafBits || domain_bits >= 64) {
+    throw invalid_argument("domain_bits must be in [7, 64)");
+  }
+  if (alpha >> domain_bits) {
+    throw invalid_argument("alpha is outside the domain");
+  }
+  uint32_t levels = domain_bits - kLeafBits;
+
+  DpfBlock seeds[2];
+  auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
+  prng->generate(sizeof(seeds), reinterpret_cast<seal_byte *>(seeds));
+  uint8_t t[2] = {0, 1};
+
+  DpfKey keys[2];
+  for (int b = 0; b < 2; b++) {
+    keys[b].domain_bits = domain_bits;
+    keys[b].seed = seeds[b];
+    keys[b].control = t[b];
+    keys[b].seed_corrections.resize(levels);
+    keys[b].control_corrections.resize(levels);
+  }
+
+  for (uint32_t level = 0; level < levels; level++) {
+    DpfBlock children[2][2];
+    uint8_t child_t[2][2];
+    for (int b = 0; b < 2; b++) {
+      prg_expand(&seeds[b], 1, children[b]);
+      child_t[b][0] = take_control(children[b][0]);
+      child_t[b][1] = take_control(children[b][1]);
+    }
+
+    // keep is the child on alpha's path; the other child's seeds are made
+    // equal so everything below it cancels
+    int keep = (alpha >> (domain_bits - 1 - level)) & 1;
+    int lose = 1 - keep;
+    DpfBlock seed_cw = children[0][lose] ^ children[1][lose];
+    uint8_t t_cw[2];
+    t_cw[0] = child_t[0][0] ^ child_t[1][0] ^ keep ^ 1;
+    t_cw[1] = child_t[0][1] ^ child_t[1][1] ^ keep;
+    for (int b = 0; b < 2; b++) {
+      keys[b].seed_corrections[level] = seed_cw;
+      keys[b].control_corrections[level] = t_cw[0] | (t_cw[1] << 1);
+    }
+
+    for (int b = 0; b < 2; b++) {
+      seeds[b] = children[b][keep] ^ select(t[b], seed_cw);
+      t[b] = child_t[b][keep] ^ (t[b] & t_cw[keep]);
+    }
+  }
+
+  DpfBlock out[2];
+  convert(seeds, 2, out);
+  uint64_t point = alpha & ((uint64_t(1) << kLeafBits) - 1);
+  DpfBlock unit{point < 64 ? uint64_t(1) << point : 0,
+                point >= 64 ? uint64_t(1) << (point - 64) : 0};
+  DpfBlock output_cw = out[0] ^ out[1] ^ unit;
+  keys[0].output_correction = output_cw;
+  keys[1].output_correction = output_cw;
+  return make_pair(keys[0], keys[1]);
+}
+
+bool dpf_eval(const DpfKey &key, uint64_t x) {
+  if (x >> key.domain_bits) {
+    throw invalid_argument("x is outside the domain");
+  }
+  DpfBlock seed = key.seed;
+  uint8_t t = key.control;
+  for (uint32_t level = 0; level < tree_levels(key); level++) {
+    DpfBlock children[2];
+    prg_expand(&seed, 1, children);
+    int dir = (x >> (key.domain_bits - 1 - level)) & 1;
+    DpfBlock child = children[dir];
+    uint8_t child_t = take_control(child);
+    seed = child ^ select(t, key.seed_corrections[level]);
+    t = child_t ^ (t & (key.control_corrections[level] >> dir));
+  }
+  DpfBlock out;
+  convert(&seed, 1, &out);
+  out = out ^ select(t, key.output_correction);
+  uint64_t point = x & ((uint64_t(1) << kLeafBits) - 1);
+  return ((point < 64 ? out.lo : out.hi) >> (point & 63)) & 1;
+}
+
+vector<uint64_t> dpf_eval_full(const DpfKey &key, uint64_t domain_size,
+                               ThreadPool &pool) {
+  if (domain_size == 0 || (domain_size - 1) >> key.domain_bits) {
+    throw invalid_argument("domain_size does not fit the key's domain");
+  }
+  uint32_t levels = tree_levels(key);
+  uint64_t leaves = (domain_size + (uint64_t(1) << kLeafBits) - 1) >> kLeafBits;
+
+  // Runs fn on [begin, end) node ranges, on the pool for wide levels
+  auto for_nodes = [&](uint64_t nodes,
+                       const function<void(uint64_t, uint64_t)> &fn) {
+    uint64_t tasks = (nodes + kNodesPerTask - 1) / kNodesPerTask;
+    if (tasks <= 1) {
+      fn(0, nodes);
+      return;
+    }
+    pool.parallel_for(0, tasks, [&](uint64_t task) {
+      fn(task * kNodesPerTask, min(nodes, (task + 1) * kNodesPerTask));
+    });
+  };
+
+  vector<DpfBlock> seeds(1, key.seed), next_seeds;
+  vector<uint8_t> t(1, key.control), next_t;
+  for (uint32_t level = 0; level < levels; level++) {
+    // only the subtrees that reach the first `leaves` leaves are expanded
+    uint32_t below = levels - level - 1;
+    uint64_t children = (leaves + (uint64_t(1) << below) - 1) >> below;
+    next_seeds.resize(2 * seeds.size());
+    next_t.resize(children);
+    const DpfBlock seed_cw = key.seed_corrections[level];
+    const uint8_t t_cw = key.control_corrections[level];
+    for_nodes(seeds.size(), [&](uint64_t begin, uint64_t end) {
+      prg_expand(seeds.data() + begin, end - begin,
+                 next_seeds.data() + 2 * begin);
+      for (uint64_t c = 2 * begin; c < min(2 * end, children); c++) {
+        uint8_t parent_t = t[c >> 1];
+        uint8_t child_t = take_control(next_seeds[c]);
+        next_seeds[c] = next_seeds[c] ^ select(parent_t, seed_cw);
+        next_t[c] = child_t ^ (parent_t & (t_cw >> (c & 1)));
+      }
+    });
+    next_seeds.resize(children);
+    swap(seeds, next_seeds);
+    swap(t, next_t);
+  }
+
+  vector<uint64_t> bits(2 * leaves);
+  DpfBlock *out = reinterpret_cast<DpfBlock *>(bits.data());
+  for_nodes(leaves, [&](uint64_t begin, uint64_t end) {
+    convert(seeds.data() + begin, end - begin, out + begin);
+    for (uint64_t i = begin; i < end; i++) {
+      out[i] = out[i] ^ select(t[i], key.output_correction);
+    }
+  });
+
+  // Block i holds points 128 i .. 128 i + 127, low word first
+  bits.resize((domain_size + 63) / 64);
+  if (domain_size % 64) {
+    bits.back() &= (uint64_t(1) << (domain_size % 64)) - 1;
+  }
+  return bits;
+}
+
+string serialize_dpf_key(const DpfKey &key) {
+  uint32_t levels = key.seed_corrections.size();
+  string s;
+  s.reserve(sizeof(uint32_t) + 1 + 2 * sizeof(DpfBlock) +
+            levels * (sizeof(DpfBlock) + 1));
+  s.append(reinterpret_cast<const char *>(&key.domain_bits), sizeof(uint32_t));
+  s.append(reinterpret_cast<const char *>(&key.seed), sizeof(DpfBlock));
+  s.push_back(static_cast<char>(key.control));
+  for (uint32_t level = 0; level < levels; level++) {
+    s.append(reinterpret_cast<const char *>(&key.seed_corrections[level]),
+             sizeof(DpfBlock));
+    s.push_back(static_cast<char>(key.control_corrections[level]));
+  }
+  s.append(reinterpret_cast<const char *>(&key.output_correction),
+           sizeof(DpfBlock));
+  return s;
+}
+
+DpfKey deserialize_dpf_key(const string &s) {
+  DpfKey key;
+  const size_t fixed = sizeof(uint32_t) + 1 + 2 * sizeof(DpfBlock);
+  if (s.size() < fixed) {
+    throw invalid_argument("DPF key is truncated");
+  }
+  const char *p = s.data();
+  memcpy(&key.domain_bits, p, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  if (key.domain_bits < kLeafBits || key.domain_bits >= 64 ||
+      s.size() != fixed + (key.domain_bits - kLeafBits) * (sizeof(DpfBlock) + 1)) {
+    throw invalid_argument("DPF key has the wrong size");
+  }
+  memcpy(&key.seed, p, sizeof(DpfBlock));
+  p += sizeof(DpfBlock);
+  key.control = *p++ & 1;
+  uint32_t levels = key.domain_bits - kLeafBits;
+  key.seed_corrections.resize(levels);
+  key.control_corrections.resize(levels);
+  for (uint32_t level = 0; level < levels; level++) {
+    memcpy(&key.seed_corrections[level], p, sizeof(DpfBlock));
+    p += sizeof(DpfBlock);
+    key.control_corrections[level] = *p++ & 3;
+  }
+  memcpy(&key.output_correction, p, sizeof(DpfBlock));
+  return key;
+}
+
+bool dpf_aesni_available() { return cpu_has_aesni(); }
+
+void dpf_use_aesni(bool enabled) { aesni_enabled.store(enabled); }
+
+void dpf_aes128_encrypt(const uint8_t key[16], const DpfBlock *in,
+                        DpfBlock *out, size_t count) {
+  aes128(aes128_expand_key(key), in, out, count, 1);
+}
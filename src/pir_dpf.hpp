@@ -0,0 +1,60 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Two-party distributed point functions (tree construction of Boyle, Gilboa
+// and Ishai). The two keys of a point alpha evaluate to bit vectors that
+// XOR to the unit vector of alpha, while each key alone is pseudorandom.
+// A key holds one 128-bit correction word per tree level, so it grows with
+// log(domain) instead of with the domain. Each leaf of the tree covers 128
+// consecutive points.
+//
+// The tree PRG is fixed-key AES-128 (Matyas-Meyer-Oseas); it uses AES-NI
+// when the CPU has it and an equivalent portable implementation otherwise,
+// so servers with and without AES-NI evaluate keys identically.
+
+struct DpfBlock {
+  std::uint64_t lo;
+  std::uint64_t hi;
+};
+
+struct DpfKey {
+  std::uint32_t domain_bits; // the domain is [0, 2^domain_bits)
+  DpfBlock seed;
+  std::uint8_t control;
+  // per level: seed correction and the left / right control corrections
+  std::vector<DpfBlock> seed_corrections;
+  std::vector<std::uint8_t> control_corrections; // bit 0 left, bit 1 right
+  DpfBlock output_correction;
+};
+
+// Keys for the point function that is 1 at alpha and 0 elsewhere
+std::pair<DpfKey, DpfKey> dpf_gen(std::uint64_t alpha, std::uint32_t domain_bits);
+
+// This key's share of f(x)
+bool dpf_eval(const DpfKey &key, std::uint64_t x);
+
+// This key's shares of f(0 .. domain_size - 1), bit i of word i / 64,
+// expanding the tree level by level on the pool
+std::vector<std::uint64_t> dpf_eval_full(const DpfKey &key,
+                                         std::uint64_t domain_size,
+                                         ThreadPool &pool);
+
+// Smallest domain_bits covering domain_size points (at least one leaf)
+std::uint32_t dpf_domain_bits(std::uint64_t domain_size);
+
+std::string serialize_dpf_key(const DpfKey &key);
+DpfKey deserialize_dpf_key(const std::string &s);
+
+bool dpf_aesni_available();
+// Selects AES-NI (when available) or the portable AES; both give the same
+// results. AES-NI is used by default.
+void dpf_use_aesni(bool enabled);
+
+// AES-128 of each block under the given key; exposed for known-answer tests
+void dpf_aes128_encrypt(const std::uint8_t key[16], const DpfBlock *in,
+                        DpfBlock *out, std::size_t count);
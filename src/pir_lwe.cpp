@@ -0,0 +1,277 @@
+#include "pir_lwe.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+using namespace seal;
+
+namespace {
+
+// Plaintext entries are bytes; the scaled one sits in the top byte of Z_2^32
+constexpr uint32_t kDeltaBits = 24;
+
+vector<uint32_t> expand_matrix(const prng_seed_type &seed, uint64_t rows,
+                               uint32_t cols) {
+  vector<uint32_t> a(rows * cols);
+  Blake2xbPRNG prng(seed);
+  prng.generate(a.size() * sizeof(uint32_t),
+                reinterpret_cast<seal_byte *>(a.data()));
+  return a;
+}
+
+// Centered binomial noise in [-64, 64]: the difference of two 64-bit
+// popcounts, variance 32, standard deviation about 5.66
+uint32_t sample_noise(UniformRandomGenerator &prng) {
+  uint64_t bits[2];
+  prng.generate(sizeof(bits), reinterpret_cast<seal_byte *>(bits));
+  return static_cast<uint32_t>(__builtin_popcountll(bits[0]) -
+                               __builtin_popcountll(bits[1]));
+}
+
+// Dot product of one query with the rows starting at row, kRowBlock rows at
+// a time so every query word loaded is used once per row of the block
+constexpr uint64_t kRowBlock = 4;
+
+template <uint64_t Rows>
+void lwe_dot(const uint32_t *row, uint64_t row_words, const uint32_t *x,
+             uint32_t *out) {
+  uint32_t acc[Rows][2] = {};
+  for (uint64_t w = 0; w < row_words; w++) {
+    const uint32_t x0 = x[4 * w], x1 = x[4 * w + 1];
+    const uint32_t x2 = x[4 * w + 2], x3 = x[4 * w + 3];
+    for (uint64_t i = 0; i < Rows; i++) {
+      uint32_t word = row[i * row_words + w];
+      acc[i][0] += (word & 0xff) * x0 + ((word >> 16) & 0xff) * x2;
+      acc[i][1] += ((word >> 8) & 0xff) * x1 + (word >> 24) * x3;
+    }
+  }
+  for (uint64_t i = 0; i < Rows; i++) {
+    out[i] = acc[i][0] + acc[i][1];
+  }
+}
+
+// reply[r] = sum over c of row r entry c times query[c], for rows
+// [row_begin, row_end). Each block of rows is scanned for all queries while
+// it is in cache.
+void lwe_scan(const uint32_t *db, uint64_t row_words, uint64_t row_begin,
+              uint64_t row_end, const vector<LweQuery> &queries,
+              vector<LweReply> &replies) {
+  uint64_t r = row_begin;
+  for (; r + kRowBlock <= row_end; r += kRowBlock) {
+    for (size_t q = 0; q < queries.size(); q++) {
+      lwe_dot<kRowBlock>(db + r * row_words, row_words, queries[q].data(),
+                         replies[q].data() + r);
+    }
+  }
+  for (; r < row_end; r++) {
+    for (size_t q = 0; q < queries.size(); q++) {
+      lwe_dot<1>(db + r * row_words, row_words, queries[q].data(),
+                 replies[q].data() + r);
+    }
+  }
+}
+
+template <typename T> void put(string &s, const T &value) {
+  s.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> T get(const string &s, size_t &pos) {
+  if (pos + sizeof(T) > s.size()) {
+    throw invalid_argument("LWE hint is truncated");
+  }
+  T value;
+  memcpy(&value, s.data() + pos, sizeof(T));
+  pos += sizeof(T);
+  return value;
+}
+
+} // namespace
+
+string serialize_lwe_hint(const LweHint &hint) {
+  string s;
+  s.append(reinterpret_cast<const char *>(hint.matrix_seed.data()),
+           prng_seed_byte_count);
+  put(s, hint.lwe_dim);
+  put(s, hint.ele_num);
+  put(s, hint.ele_size);
+  put(s, hint.elements_per_column);
+  put(s, hint.rows);
+  put(s, hint.cols);
+  s.append(reinterpret_cast<const char *>(hint.matrix.data()),
+           hint.matrix.size() * sizeof(uint32_t));
+  return s;
+}
+
+LweHint deserialize_lwe_hint(const string &s) {
+  LweHint hint;
+  if (s.size() < prng_seed_byte_count) {
+    throw invalid_argument("LWE hint is truncated");
+  }
+  memcpy(hint.matrix_seed.data(), s.data(), prng_seed_byte_count);
+  size_t pos = prng_seed_byte_count;
+  hint.lwe_dim = get<uint32_t>(s, pos);
+  hint.ele_num = get<uint64_t>(s, pos);
+  hint.ele_size = get<uint64_t>(s, pos);
+  hint.elements_per_column = get<uint64_t>(s, pos);
+  hint.rows = get<uint64_t>(s, pos);
+  hint.cols = get<uint64_t>(s, pos);
+  if (hint.rows != hint.elements_per_column * hint.ele_size ||
+      hint.cols % 4 || hint.cols * hint.elements_per_column < hint.ele_num ||
+      s.size() - pos != hint.rows * hint.lwe_dim * sizeof(uint32_t)) {
+    throw invalid_argument("LWE hint is malformed");
+  }
+  hint.matrix.resize(hint.rows * hint.lwe_dim);
+  memcpy(hint.matrix.data(), s.data() + pos, s.size() - pos);
+  return hint;
+}
+
+LwePirServer::LwePirServer(uint32_t lwe_dim) : num_threads_(0) {
+  if (lwe_dim == 0) {
+    throw invalid_argument("lwe_dim must be positive");
+  }
+  hint_.lwe_dim = lwe_dim;
+  hint_.ele_num = 0;
+}
+
+void LwePirServer::set_database(const unique_ptr<const uint8_t[]> &bytes,
+                                uint64_t ele_num, uint64_t ele_size) {
+  if (!bytes || ele_num == 0 || ele_size == 0) {
+    throw invalid_argument("database cannot be empty");
+  }
+  if (!pool_) {
+    pool_ = make_unique<ThreadPool>(num_threads_);
+  }
+
+  // A roughly square matrix balances the query (cols) against the reply and
+  // the hint (rows)
+  uint64_t side = 1;
+  while (side * side < ele_num * ele_size) {
+    side++;
+  }
+  hint_.ele_num = ele_num;
+  hint_.ele_size = ele_size;
+  hint_.elements_per_column = max<uint64_t>(1, side / ele_size);
+  hint_.rows = hint_.elements_per_column * ele_size;
+  uint64_t used_cols =
+      (ele_num + hint_.elements_per_column - 1) / hint_.elements_per_column;
+  hint_.cols = (used_cols + 3) / 4 * 4;
+  uint64_t row_words = hint_.cols / 4;
+
+  // Element i occupies rows (i % per_column) * ele_size onwards of column
+  // i / per_column
+  db_.assign(hint_.rows * row_words, 0);
+  uint8_t *entries = reinterpret_cast<uint8_t *>(db_.data());
+  for (uint64_t i = 0; i < ele_num; i++) {
+    uint64_t col = i / hint_.elements_per_column;
+    uint64_t row = (i % hint_.elements_per_column) * ele_size;
+    for (uint64_t b = 0; b < ele_size; b++) {
+      entries[(row + b) * hint_.cols + col] = bytes.get()[i * ele_size + b];
+    }
+  }
+
+  random_bytes(reinterpret_cast<seal_byte *>(hint_.matrix_seed.data()),
+               prng_seed_byte_count);
+  vector<uint32_t> a = expand_matrix(hint_.matrix_seed, hint_.cols, hint_.lwe_dim);
+  const uint32_t n = hint_.lwe_dim;
+  hint_.matrix.assign(hint_.rows * n, 0);
+  pool_->parallel_for(0, hint_.rows, [&](uint64_t r) {
+    uint32_t *h = hint_.matrix.data() + r * n;
+    const uint8_t *row = entries + r * hint_.cols;
+    for (uint64_t c = 0; c < hint_.cols; c++) {
+      const uint32_t d = row[c];
+      if (d == 0) {
+        continue;
+      }
+      const uint32_t *a_row = a.data() + c * n;
+      for (uint32_t k = 0; k < n; k++) {
+        h[k] += d * a_row[k];
+      }
+    }
+  });
+}
+
+void LwePirServer::set_num_threads(uint32_t num_threads) {
+  num_threads_ = num_threads;
+  pool_ = make_unique<ThreadPool>(num_threads_);
+}
+
+const LweHint &LwePirServer::hint() const {
+  if (db_.empty()) {
+    throw logic_error("database is not set");
+  }
+  return hint_;
+}
+
+LweReply LwePirServer::generate_reply(const LweQuery &query) const {
+  return generate_replies(vector<LweQuery>{query})[0];
+}
+
+vector<LweReply>
+LwePirServer::generate_replies(const vector<LweQuery> &queries) const {
+  if (db_.empty()) {
+    throw logic_error("database is not set");
+  }
+  for (const auto &query : queries) {
+    if (query.size() != hint_.cols) {
+      throw invalid_argument("query does not match the database size");
+    }
+  }
+
+  // Workers own disjoint rows of every reply, so nothing is merged
+  vector<LweReply> replies(queries.size(), LweReply(hint_.rows));
+  uint64_t blocks = min<uint64_t>(pool_->size(), hint_.rows);
+  pool_->parallel_for(0, blocks, [&](uint64_t b) {
+    lwe_scan(db_.data(), hint_.cols / 4, hint_.rows * b / blocks,
+             hint_.rows * (b + 1) / blocks, queries, replies);
+  });
+  return replies;
+}
+
+LwePirClient::LwePirClient(const LweHint &hint)
+    : hint_(hint), a_(expand_matrix(hint.matrix_seed, hint.cols, hint.lwe_dim)),
+      prng_(UniformRandomGeneratorFactory::DefaultFactory()->create()) {}
+
+LweQuery LwePirClient::generate_query(uint64_t index, LweQuerySecret &secret) {
+  if (index >= hint_.ele_num) {
+    throw invalid_argument("index out of range");
+  }
+  const uint32_t n = hint_.lwe_dim;
+  secret.index = index;
+  secret.s.resize(n);
+  prng_->generate(n * sizeof(uint32_t),
+                  reinterpret_cast<seal_byte *>(secret.s.data()));
+
+  LweQuery query(hint_.cols);
+  for (uint64_t c = 0; c < hint_.cols; c++) {
+    const uint32_t *a_row = a_.data() + c * n;
+    uint32_t acc = sample_noise(*prng_);
+    for (uint32_t k = 0; k < n; k++) {
+      acc += a_row[k] * secret.s[k];
+    }
+    query[c] = acc;
+  }
+  query[index / hint_.elements_per_column] += uint32_t(1) << kDeltaBits;
+  return query;
+}
+
+vector<uint8_t> LwePirClient::decode_reply(const LweReply &reply,
+                                           const LweQuerySecret &secret) const {
+  if (reply.size() != hint_.rows || secret.s.size() != hint_.lwe_dim) {
+    throw invalid_argument("reply does not match the hint");
+  }
+  const uint32_t n = hint_.lwe_dim;
+  uint64_t row = (secret.index % hint_.elements_per_column) * hint_.ele_size;
+  vector<uint8_t> element(hint_.ele_size);
+  for (uint64_t b = 0; b < hint_.ele_size; b++) {
+    const uint32_t *h = hint_.matrix.data() + (row + b) * n;
+    uint32_t value = reply[row + b];
+    for (uint32_t k = 0; k < n; k++) {
+      value -= h[k] * secret.s[k];
+    }
+    // round away the noise D * e
+    element[b] = static_cast<uint8_t>(
+        (value + (uint32_t(1) << (kDeltaBits - 1))) >> kDeltaBits);
+  }
+  return element;
+}
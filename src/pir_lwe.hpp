@@ -0,0 +1,80 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include <seal/randomgen.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Single-server PIR from plain LWE with a preprocessing hint, in the style of
+// SimplePIR. The database bytes form a rows x cols matrix D over Z_256, each
+// element stored down one column. The server publishes the hint D * A once,
+// where A is a public cols x lwe_dim matrix expanded from a seed. A query for
+// column c is A * s + e + 2^24 * u_c with a fresh secret s; the reply is
+// D * query, from which the client removes hint * s and rounds. Answering is
+// one pass of 32-bit multiply-adds over the database, with no expansion or
+// NTTs, so it suits databases that change rarely.
+
+typedef std::vector<std::uint32_t> LweQuery;
+typedef std::vector<std::uint32_t> LweReply;
+
+struct LweHint {
+  seal::prng_seed_type matrix_seed;
+  std::uint32_t lwe_dim;
+  std::uint64_t ele_num;
+  std::uint64_t ele_size;
+  std::uint64_t elements_per_column;
+  std::uint64_t rows;
+  std::uint64_t cols; // a multiple of 4
+  std::vector<std::uint32_t> matrix; // rows x lwe_dim, D * A mod 2^32
+};
+
+std::string serialize_lwe_hint(const LweHint &hint);
+LweHint deserialize_lwe_hint(const std::string &s);
+
+class LwePirServer {
+public:
+  explicit LwePirServer(std::uint32_t lwe_dim = 1024);
+
+  // Packs the elements into the matrix and computes the hint
+  void set_database(const std::unique_ptr<const std::uint8_t[]> &bytes,
+                    std::uint64_t ele_num, std::uint64_t ele_size);
+
+  // Worker threads of the hint and of the scan (0 = one per core)
+  void set_num_threads(std::uint32_t num_threads);
+
+  const LweHint &hint() const;
+
+  LweReply generate_reply(const LweQuery &query) const;
+  // Answers all queries in the same pass over the database
+  std::vector<LweReply> generate_replies(const std::vector<LweQuery> &queries) const;
+
+private:
+  LweHint hint_;
+  // rows x cols / 4 words; each word packs four consecutive entries of a row
+  std::vector<std::uint32_t> db_;
+  std::uint32_t num_threads_;
+  std::unique_ptr<ThreadPool> pool_;
+};
+
+// Per-query secret kept by the client until the reply arrives
+struct LweQuerySecret {
+  std::uint64_t index;
+  std::vector<std::uint32_t> s;
+};
+
+class LwePirClient {
+public:
+  // Expands the public matrix from the hint's seed
+  explicit LwePirClient(const LweHint &hint);
+
+  LweQuery generate_query(std::uint64_t index, LweQuerySecret &secret);
+  std::vector<std::uint8_t> decode_reply(const LweReply &reply,
+                                         const LweQuerySecret &secret) const;
+
+private:
+  LweHint hint_;
+  std::vector<std::uint32_t> a_; // cols x lwe_dim
+  std::shared_ptr<seal::UniformRandomGenerator> prng_;
+};
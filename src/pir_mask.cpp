@@ -0,0 +1,29 @@
+#include "pir_mask.hpp"
+
+#include <limits>
+
+using namespace std;
+using namespace seal;
+
+MaskSeed random_mask_seed() {
+  MaskSeed seed;
+  random_bytes(reinterpret_cast<seal_byte *>(seed.data()),
+               prng_seed_byte_count);
+  return seed;
+}
+
+uint64_t uniform_mod(UniformRandomGenerator &prng, uint64_t modulus) {
+  // 2^64 mod modulus; draws in the top partial range would bias the result
+  uint64_t excess = (numeric_limits<uint64_t>::max() % modulus + 1) % modulus;
+  uint64_t limit = numeric_limits<uint64_t>::max() - excess;
+  uint64_t value;
+  do {
+    prng.generate(sizeof(value), reinterpret_cast<seal_byte *>(&value));
+  } while (value > limit);
+  return value % modulus;
+}
+
+MaskStream::MaskStream(const MaskSeed &seed, const Modulus &plain_modulus)
+    : prng_(make_unique<Blake2xbPRNG>(seed)), modulus_(plain_modulus.value()) {}
+
+uint64_t MaskStream::next() { return uniform_mod(*prng_, modulus_); }
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <seal/seal.h>
+#include <cstdint>
+#include <memory>
+
+// Additive masks of the three-party flow. Masks are expanded from a seed with
+// SEAL's Blake2xb PRNG, so a party holding the seed derives the same masks
+// in the same order and only the seed has to be sent between servers.
+typedef seal::prng_seed_type MaskSeed;
+
+// Fresh seed from the system's entropy source
+MaskSeed random_mask_seed();
+
+// Uniform value in [0, modulus) by rejection sampling, identical on every
+// platform for the same generator state
+std::uint64_t uniform_mod(seal::UniformRandomGenerator &prng,
+                          std::uint64_t modulus);
+
+class MaskStream {
+public:
+  MaskStream(const MaskSeed &seed, const seal::Modulus &plain_modulus);
+
+  // Next mask of the stream, uniform mod the plain modulus
+  std::uint64_t next();
+
+private:
+  std::unique_ptr<seal::Blake2xbPRNG> prng_;
+  std::uint64_t modulus_;
+};
@@ -0,0 +1,111 @@
+#include "pir_metrics.hpp"
+
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+const char *metric_counter_name(MetricCounter counter) {
+  static const char *names[COUNTER_COUNT] = {
+      "multiply_plain", "apply_galois", "ntt_forward", "ntt_inverse",
+      "mod_switch",     "decrypt",      "bytes_scanned", "requests"};
+  return names[counter];
+}
+
+const char *metric_phase_name(MetricPhase phase) {
+  static const char *names[PHASE_COUNT] = {
+      "expand",    "ntt",     "scan",  "intt",   "mod_switch",
+      "decompose", "serialize", "request", "query", "decode"};
+  return names[phase];
+}
+
+double metric_bucket_bound(size_t bucket) {
+  if (bucket + 1 >= kMetricBuckets) {
+    return numeric_limits<double>::infinity();
+  }
+  double bound = 1e-5;
+  for (size_t i = 0; i < bucket; i++) {
+    bound *= 4;
+  }
+  return bound;
+}
+
+PirMetrics::PirMetrics() { reset(); }
+
+void PirMetrics::observe(MetricPhase phase, double seconds) {
+  Histogram &h = phases_[phase];
+  size_t bucket = 0;
+  while (seconds > metric_bucket_bound(bucket)) {
+    bucket++;
+  }
+  h.buckets[bucket].fetch_add(1, memory_order_relaxed);
+  h.count.fetch_add(1, memory_order_relaxed);
+  h.sum_ns.fetch_add(static_cast<uint64_t>(seconds * 1e9),
+                     memory_order_relaxed);
+}
+
+MetricsSnapshot PirMetrics::snapshot() const {
+  MetricsSnapshot s;
+  for (size_t i = 0; i < COUNTER_COUNT; i++) {
+    s.counters[i] = counters_[i].load(memory_order_relaxed);
+  }
+  for (size_t p = 0; p < PHASE_COUNT; p++) {
+    const Histogram &h = phases_[p];
+    s.phases[p].count = h.count.load(memory_order_relaxed);
+    s.phases[p].sum_seconds = h.sum_ns.load(memory_order_relaxed) / 1e9;
+    for (size_t b = 0; b < kMetricBuckets; b++) {
+      s.phases[p].buckets[b] = h.buckets[b].load(memory_order_relaxed);
+    }
+  }
+  return s;
+}
+
+void PirMetrics::reset() {
+  for (auto &c : counters_) {
+    c.store(0, memory_order_relaxed);
+  }
+  for (auto &h : phases_) {
+    h.count.store(0, memory_order_relaxed);
+    h.sum_ns.store(0, memory_order_relaxed);
+    for (auto &b : h.buckets) {
+      b.store(0, memory_order_relaxed);
+    }
+  }
+}
+
+string PirMetrics::prometheus(const string &prefix) const {
+  MetricsSnapshot s = snapshot();
+  ostringstream out;
+
+  for (size_t i = 0; i < COUNTER_COUNT; i++) {
+    string name = prefix + "_" +
+                  metric_counter_name(static_cast<MetricCounter>(i)) + "_total";
+    out << "# TYPE " << name << " counter\n";
+    out << name << " " << s.counters[i] << "\n";
+  }
+
+  string name = prefix + "_phase_seconds";
+  out << "# TYPE " << name << " histogram\n";
+  for (size_t p = 0; p < PHASE_COUNT; p++) {
+    const PhaseStats &stats = s.phases[p];
+    if (stats.count == 0) {
+      continue;
+    }
+    string label = string("phase=\"") +
+                   metric_phase_name(static_cast<MetricPhase>(p)) + "\"";
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < kMetricBuckets; b++) {
+      cumulative += stats.buckets[b];
+      out << name << "_bucket{" << label << ",le=\"";
+      if (b + 1 == kMetricBuckets) {
+        out << "+Inf";
+      } else {
+        out << metric_bucket_bound(b);
+      }
+      out << "\"} " << cumulative << "\n";
+    }
+    out << name << "_sum{" << label << "} " << stats.sum_seconds << "\n";
+    out << name << "_count{" << label << "} " << stats.count << "\n";
+  }
+  return out.str();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Lock-free operation counters and per-phase latency histograms. Updates are
+// relaxed atomic adds, so one instance can be shared by concurrent requests.
+
+enum MetricCounter {
+  COUNT_MULTIPLY_PLAIN,
+  COUNT_APPLY_GALOIS,
+  COUNT_NTT_FORWARD,
+  COUNT_NTT_INVERSE,
+  COUNT_MOD_SWITCH,
+  COUNT_DECRYPT,
+  COUNT_BYTES_SCANNED, // database plaintext bytes read by the scans
+  COUNT_REQUESTS,
+  COUNTER_COUNT
+};
+
+enum MetricPhase {
+  PHASE_EXPAND,     // query expansion
+  PHASE_NTT,        // forward transforms of expanded queries / plaintexts
+  PHASE_SCAN,       // multiply_plain / add over a dimension
+  PHASE_INTT,       // inverse transforms of scan outputs
+  PHASE_MOD_SWITCH,
+  PHASE_DECOMPOSE,
+  PHASE_SERIALIZE,
+  PHASE_REQUEST,    // a whole reply on the server
+  PHASE_QUERY,      // client query generation
+  PHASE_DECODE,     // client decryption and recomposition
+  PHASE_COUNT
+};
+
+const char *metric_counter_name(MetricCounter counter);
+const char *metric_phase_name(MetricPhase phase);
+
+// Bucket upper bounds in seconds: 10us * 4^i, plus +Inf
+constexpr std::size_t kMetricBuckets = 11;
+double metric_bucket_bound(std::size_t bucket);
+
+struct PhaseStats {
+  std::uint64_t count;
+  double sum_seconds;
+  std::array<std::uint64_t, kMetricBuckets> buckets; // not cumulative
+};
+
+struct MetricsSnapshot {
+  std::array<std::uint64_t, COUNTER_COUNT> counters;
+  std::array<PhaseStats, PHASE_COUNT> phases;
+};
+
+class PirMetrics {
+public:
+  PirMetrics();
+
+  void add(MetricCounter counter, std::uint64_t n = 1) {
+    counters_[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+  void observe(MetricPhase phase, double seconds);
+
+  MetricsSnapshot snapshot() const;
+  void reset();
+
+  // Prometheus text exposition, metric names prefixed with `prefix`
+  std::string prometheus(const std::string &prefix) const;
+
+private:
+  struct Histogram {
+    std::atomic<std::uint64_t> count;
+    std::atomic<std::uint64_t> sum_ns;
+    std::array<std::atomic<std::uint64_t>, kMetricBuckets> buckets;
+  };
+
+  std::array<std::atomic<std::uint64_t>, COUNTER_COUNT> counters_;
+  std::array<Histogram, PHASE_COUNT> phases_;
+};
+
+// Records the time from construction to destruction (or stop()) into a phase
+class PhaseTimer {
+public:
+  PhaseTimer(PirMetrics &metrics, MetricPhase phase)
+      : metrics_(metrics), phase_(phase),
+        start_(std::chrono::steady_clock::now()), running_(true) {}
+  ~PhaseTimer() { stop(); }
+
+  void stop() {
+    if (running_) {
+      running_ = false;
+      metrics_.observe(phase_, std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start_)
+                                   .count());
+    }
+  }
+
+private:
+  PirMetrics &metrics_;
+  MetricPhase phase_;
+  std::chrono::steady_clock::time_point start_;
+  bool running_;
+};
@@ -0,0 +1,84 @@
+#include "pir_multiparty.hpp"
+#include "thread_pool.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+
+using namespace std;
+using namespace seal;
+
+MultiPartyQuery::MultiPartyQuery(PIRClient &client) : client_(client) {}
+
+void MultiPartyQuery::add_party(PartyReplier replier) {
+  if (!replier) {
+    throw invalid_argument("party cannot be empty");
+  }
+  parties_.push_back(move(replier));
+}
+
+size_t MultiPartyQuery::party_count() const { return parties_.size(); }
+
+vector<vector<uint8_t>>
+MultiPartyQuery::query(const PirQuery &query, const vector<uint64_t> &offsets) {
+  if (parties_.size() < 2) {
+    throw logic_error("a multi-party query needs at least two parties");
+  }
+
+  // Replies (or failures) in arrival order
+  mutex mutex;
+  condition_variable arrived;
+  deque<PirReply> replies;
+  exception_ptr error;
+  size_t finished = 0;
+
+  ThreadPool pool(parties_.size());
+  for (size_t p = 0; p < parties_.size(); p++) {
+    pool.submit([&, p, party_query = PirQuery(query)]() mutable {
+      PirReply reply;
+      exception_ptr failure;
+      try {
+        reply = parties_[p](party_query);
+      } catch (...) {
+        failure = current_exception();
+      }
+      lock_guard<std::mutex> lock(mutex);
+      if (failure) {
+        if (!error) {
+          error = failure;
+        }
+      } else {
+        replies.push_back(move(reply));
+      }
+      finished++;
+      arrived.notify_one();
+    });
+  }
+
+  PIRShareAccumulator shares(client_);
+  unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    arrived.wait(lock, [&]() { return !replies.empty() || finished == parties_.size(); });
+    if (replies.empty()) {
+      break;
+    }
+    PirReply reply = move(replies.front());
+    replies.pop_front();
+    bool failed = error != nullptr;
+    // decode while the remaining parties keep computing
+    lock.unlock();
+    if (!failed) {
+      shares.add(reply);
+    }
+    lock.lock();
+  }
+  if (error) {
+    rethrow_exception(error);
+  }
+  return shares.extract(offsets);
+}
+
+vector<uint8_t> MultiPartyQuery::query(const PirQuery &query, uint64_t offset) {
+  return this->query(query, vector<uint64_t>{offset})[0];
+}
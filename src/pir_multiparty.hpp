@@ -0,0 +1,35 @@
+#pragma once
+
+#include "pir.hpp"
+#include "pir_client.hpp"
+#include <functional>
+#include <vector>
+
+// Multi-server queries over additively shared databases. Every party masks
+// its reply with its share of a zero-sum mask (see
+// PIRServer::refresh_mask_seeds), and the client adds the decoded replies.
+
+// Computes one party's masked reply. Parties are called concurrently, each
+// with its own copy of the query; a party may be a local PIRServer or a
+// remote connection.
+typedef std::function<PirReply(PirQuery &query)> PartyReplier;
+
+class MultiPartyQuery {
+public:
+  explicit MultiPartyQuery(PIRClient &client);
+
+  void add_party(PartyReplier replier);
+  std::size_t party_count() const;
+
+  // Sends the query to every party at once and decodes each reply as it
+  // arrives, so the latency is that of the slowest party plus one decode.
+  // Returns the bytes of the elements at `offsets`. If a party fails, the
+  // first error is rethrown once all parties have finished.
+  std::vector<std::vector<std::uint8_t>>
+  query(const PirQuery &query, const std::vector<std::uint64_t> &offsets);
+  std::vector<std::uint8_t> query(const PirQuery &query, std::uint64_t offset);
+
+private:
+  PIRClient &client_;
+  std::vector<PartyReplier> parties_;
+};
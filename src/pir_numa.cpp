@@ -0,0 +1,198 @@
+#include "pir_numa.hpp"
+#include "pir_shard.hpp"
+
+#include <fstream>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace seal;
+
+vector<uint32_t> parse_cpu_list(const string &list) {
+  vector<uint32_t> cpus;
+  stringstream input(list);
+  string range;
+  while (getline(input, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    try {
+      size_t dash = range.find('-');
+      uint32_t first = stoul(range.substr(0, dash));
+      uint32_t last =
+          dash == string::npos ? first : stoul(range.substr(dash + 1));
+      if (last < first) {
+        throw invalid_argument(range);
+      }
+      for (uint32_t cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    } catch (const logic_error &) {
+      throw invalid_argument("invalid cpu list: " + list);
+    }
+  }
+  return cpus;
+}
+
+static bool read_line(const string &path, string &line) {
+  ifstream input(path);
+  return input && getline(input, line);
+}
+
+vector<NumaNode> numa_nodes() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    throw runtime_error("sched_getaffinity failed");
+  }
+
+  vector<NumaNode> nodes;
+  string online;
+  if (read_line("/sys/devices/system/node/online", online)) {
+    for (uint32_t id : parse_cpu_list(online)) {
+      string cpulist;
+      if (!read_line("/sys/devices/system/node/node" + to_string(id) +
+                         "/cpulist",
+                     cpulist)) {
+        continue;
+      }
+      NumaNode node{id, {}};
+      for (uint32_t cpu : parse_cpu_list(cpulist)) {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+          node.cpus.push_back(cpu);
+        }
+      }
+      if (!node.cpus.empty()) {
+        nodes.push_back(move(node));
+      }
+    }
+  }
+
+  if (nodes.empty()) {
+    NumaNode node{0, {}};
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        node.cpus.push_back(cpu);
+      }
+    }
+    nodes.push_back(move(node));
+  }
+  return nodes;
+}
+
+NumaServer::NumaServer(const EncryptionParameters &enc_params,
+                       const PirParams &pir_params,
+                       const vector<NumaNode> &nodes)
+    : pir_params_(pir_params) {
+  if (nodes.empty()) {
+    throw invalid_argument("at least one NUMA node is required");
+  }
+  for (auto &node : nodes) {
+    if (node.cpus.empty()) {
+      throw invalid_argument("NUMA node " + to_string(node.id) +
+                             " has no CPUs");
+    }
+  }
+
+  // a database with fewer rows than nodes leaves the extra nodes idle
+  uint32_t num_nodes = min<uint64_t>(nodes.size(), pir_params.nvec[0]);
+  auto ranges = shard_row_ranges(pir_params, num_nodes);
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    Node node;
+    node.topology = nodes[i];
+    node.row_begin = ranges[i].first;
+    node.row_end = ranges[i].second;
+    node.pool = make_unique<ThreadPool>(0, nodes[i].cpus);
+    // constructed on the node so its context and tables are local too
+    node.pool
+        ->submit([&]() {
+          node.server = make_unique<PIRServer>(enc_params, pir_params);
+          node.server->set_shard(node.row_begin, node.row_end);
+          node.server->set_num_threads(node.topology.cpus.size());
+          node.server->set_cpu_affinity(node.topology.cpus);
+        })
+        .get();
+    nodes_.push_back(move(node));
+  }
+
+  coordinator_ = make_unique<PIRServer>(enc_params, pir_params);
+}
+
+void NumaServer::set_database(const unique_ptr<const uint8_t[]> &bytes,
+                              uint64_t ele_num, uint64_t ele_size) {
+  if (ele_num != pir_params_.ele_num) {
+    throw invalid_argument("ele_num does not match the PIR parameters");
+  }
+
+  // same windows as PIRServer::set_database over a byte array
+  uint64_t chunk_size =
+      64 * max<uint64_t>(1, pir_params_.elements_per_plaintext) * ele_size;
+  vector<future<void>> builds;
+  for (auto &node : nodes_) {
+    uint64_t first_element, num_elements;
+    shard_element_range(pir_params_, node.row_begin, node.row_end,
+                        first_element, num_elements);
+    PIRServer *server = node.server.get();
+    const uint8_t *begin = bytes.get() + first_element * ele_size;
+    builds.push_back(node.pool->submit([=]() {
+      uint64_t size = num_elements * ele_size;
+      uint64_t offset = 0;
+      server->set_database(
+          [&](vector<uint8_t> &chunk) {
+            if (offset >= size) {
+              return false;
+            }
+            uint64_t len = min(chunk_size, size - offset);
+            chunk.assign(begin + offset, begin + offset + len);
+            offset += len;
+            return true;
+          },
+          num_elements, ele_size);
+    }));
+  }
+  // wait for every node before rethrowing so no build outlives `bytes`
+  for (auto &build : builds) {
+    build.wait();
+  }
+  for (auto &build : builds) {
+    build.get();
+  }
+}
+
+void NumaServer::set_galois_key(uint32_t client_id, const GaloisKeys &galkey) {
+  vector<future<void>> copies;
+  for (auto &node : nodes_) {
+    PIRServer *server = node.server.get();
+    // each node keeps a copy in its own memory
+    copies.push_back(node.pool->submit([server, client_id, &galkey]() {
+      server->set_galois_key(client_id, galkey);
+    }));
+  }
+  for (auto &copy : copies) {
+    copy.wait();
+  }
+  for (auto &copy : copies) {
+    copy.get();
+  }
+  coordinator_->set_galois_key(client_id, galkey);
+}
+
+PirReply NumaServer::generate_reply(PirQuery &query, uint32_t client_id) {
+  vector<vector<Ciphertext>> partial_replies(nodes_.size());
+  vector<future<void>> scans;
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    PIRServer *server = nodes_[i].server.get();
+    scans.push_back(nodes_[i].pool->submit([&, server, i]() {
+      partial_replies[i] = server->generate_partial_reply(query, client_id);
+    }));
+  }
+  for (auto &scan : scans) {
+    scan.wait();
+  }
+  for (auto &scan : scans) {
+    scan.get();
+  }
+
+  return coordinator_->merge_partial_replies(partial_replies, query, client_id);
+}
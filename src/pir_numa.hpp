@@ -0,0 +1,63 @@
+#pragma once
+
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "thread_pool.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// NUMA-aware serving in one process: the rows of the first dimension are
+// split across the NUMA nodes like shards (see pir_shard.hpp). Each node's
+// rows are built by threads pinned to its CPUs, so the kernel's first-touch
+// policy places them in its local memory, and each node's pinned worker pool
+// scans only those rows. The partial first-dimension results are then added
+// up and the remaining levels run on the calling thread.
+
+struct NumaNode {
+  std::uint32_t id;
+  std::vector<std::uint32_t> cpus;
+};
+
+// Parses a kernel CPU list such as "0-3,8,10-11"
+std::vector<std::uint32_t> parse_cpu_list(const std::string &list);
+
+// The NUMA nodes from /sys/devices/system/node, each with the CPUs of it this
+// process may run on; nodes without such CPUs are left out. Without NUMA
+// topology this is a single node holding every allowed CPU.
+std::vector<NumaNode> numa_nodes();
+
+class NumaServer {
+public:
+  // One shard per node, at most nvec[0] of them
+  NumaServer(const seal::EncryptionParameters &enc_params,
+             const PirParams &pir_params,
+             const std::vector<NumaNode> &nodes = numa_nodes());
+
+  // Every node builds its own rows concurrently, on its own CPUs
+  void set_database(const std::unique_ptr<const std::uint8_t[]> &bytes,
+                    std::uint64_t ele_num, std::uint64_t ele_size);
+
+  void set_galois_key(std::uint32_t client_id, const seal::GaloisKeys &galkey);
+
+  // Thread-safe; each node's part of a reply takes one of its workers, so
+  // concurrent replies keep every node's cores busy
+  PirReply generate_reply(PirQuery &query, std::uint32_t client_id);
+
+  std::uint32_t num_nodes() const { return nodes_.size(); }
+  const NumaNode &node(std::uint32_t i) const { return nodes_[i].topology; }
+  PIRServer &node_server(std::uint32_t i) { return *nodes_[i].server; }
+
+private:
+  struct Node {
+    NumaNode topology;
+    std::uint64_t row_begin;
+    std::uint64_t row_end;
+    std::unique_ptr<PIRServer> server;
+    std::unique_ptr<ThreadPool> pool;
+  };
+
+  PirParams pir_params_;
+  std::vector<Node> nodes_;
+  std::unique_ptr<PIRServer> coordinator_;
+};
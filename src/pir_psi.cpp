@@ -0,0 +1,319 @@
+#include "pir_psi.hpp"
+
+#include <cassert>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace std;
+using namespace seal;
+
+// splitmix64 finalizer; the hashes only need to spread ids, not hide them
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static uint64_t psi_bin(uint64_t id, uint32_t hash_index, uint64_t bins) {
+  return mix64(id + (hash_index + 1) * 0x9e3779b97f4a7c15ULL) % bins;
+}
+
+static uint64_t psi_fingerprint(uint64_t id, const Modulus &t) {
+  return mix64(id ^ 0x5851f42d4c957f2dULL) % t.value();
+}
+
+uint32_t psi_window_count(const PsiParams &psi_params) {
+  uint32_t count = 0;
+  while ((uint64_t(1) << count) <= psi_params.max_degree) {
+    count++;
+  }
+  return count;
+}
+
+static void check_psi_params(const SEALContext &context,
+                             const PsiParams &psi_params) {
+  if (!context.first_context_data()->qualifiers().using_batching) {
+    throw invalid_argument("PSI needs batching parameters");
+  }
+  if (psi_params.hash_count == 0 || psi_params.max_degree == 0) {
+    throw invalid_argument("hash_count and max_degree must be positive");
+  }
+}
+
+PsiServer::PsiServer(const EncryptionParameters &enc_params,
+                     const PsiParams &psi_params)
+    : enc_params_(enc_params), psi_params_(psi_params),
+      prng_(UniformRandomGeneratorFactory::DefaultFactory()->create()) {
+  context_ = make_shared<SEALContext>(enc_params, true);
+  check_psi_params(*context_, psi_params_);
+  evaluator_ = make_unique<Evaluator>(*context_);
+  encoder_ = make_unique<BatchEncoder>(*context_);
+}
+
+void PsiServer::set_blacklist(const vector<uint64_t> &ids) {
+  const Modulus &t = enc_params_.plain_modulus();
+  const uint64_t bins = encoder_->slot_count();
+  const uint32_t degree = psi_params_.max_degree;
+
+  // every member goes to the bins of all its hash functions, once per bin
+  vector<vector<uint64_t>> roots(bins);
+  size_t max_load = 0;
+  for (uint64_t id : ids) {
+    uint64_t fingerprint = psi_fingerprint(id, t);
+    for (uint32_t h = 0; h < psi_params_.hash_count; h++) {
+      uint64_t bin = psi_bin(id, h, bins);
+      bool seen = false;
+      for (uint32_t g = 0; g < h; g++) {
+        seen |= psi_bin(id, g, bins) == bin;
+      }
+      if (!seen) {
+        roots[bin].push_back(fingerprint);
+        max_load = max(max_load, roots[bin].size());
+      }
+    }
+  }
+
+  // Partition p of a bin holds roots [p * degree, (p + 1) * degree); its
+  // polynomial prod (x - root) is expanded one root at a time
+  uint64_t partition_count = max<uint64_t>(1, (max_load + degree - 1) / degree);
+  vector<vector<vector<uint64_t>>> coeffs(
+      partition_count,
+      vector<vector<uint64_t>>(degree + 1, vector<uint64_t>(bins, 0)));
+  for (uint64_t bin = 0; bin < bins; bin++) {
+    for (uint64_t p = 0; p < partition_count; p++) {
+      vector<vector<uint64_t>> &c = coeffs[p];
+      c[0][bin] = 1;
+      uint32_t d = 0;
+      for (uint64_t r = p * degree; r < min<uint64_t>(roots[bin].size(),
+                                                       (p + 1) * degree);
+           r++, d++) {
+        uint64_t neg_root = (t.value() - roots[bin][r]) % t.value();
+        for (uint32_t k = d + 1; k > 0; k--) {
+          c[k][bin] = (c[k - 1][bin] +
+                       util::multiply_uint_mod(c[k][bin], neg_root, t)) %
+                      t.value();
+        }
+        c[0][bin] = util::multiply_uint_mod(c[0][bin], neg_root, t);
+      }
+    }
+  }
+
+  partitions_.assign(partition_count, vector<Plaintext>(degree + 1));
+  for (uint64_t p = 0; p < partition_count; p++) {
+    for (uint32_t k = 0; k <= degree; k++) {
+      bool zero = true;
+      for (uint64_t value : coeffs[p][k]) {
+        zero &= value == 0;
+      }
+      if (zero) {
+        continue;
+      }
+      encoder_->encode(coeffs[p][k], partitions_[p][k]);
+      if (k > 0) {
+        evaluator_->transform_to_ntt_inplace(partitions_[p][k],
+                                             context_->first_parms_id());
+      }
+    }
+  }
+}
+
+void PsiServer::set_relin_keys(uint32_t client_id, RelinKeys relin_keys) {
+  auto keys = make_shared<const RelinKeys>(move(relin_keys));
+  lock_guard<mutex> lock(relin_keys_mutex_);
+  relin_keys_[client_id] = move(keys);
+}
+
+PsiReply PsiServer::generate_reply(const PsiQuery &query, uint32_t client_id) {
+  if (partitions_.empty()) {
+    throw logic_error("blacklist is not set");
+  }
+  if (query.size() != psi_window_count(psi_params_)) {
+    throw invalid_argument("query does not hold every power of two");
+  }
+  shared_ptr<const RelinKeys> relin_keys;
+  {
+    lock_guard<mutex> lock(relin_keys_mutex_);
+    auto it = relin_keys_.find(client_id);
+    if (it == relin_keys_.end()) {
+      throw invalid_argument("no relinearization keys for client " +
+                             to_string(client_id));
+    }
+    relin_keys = it->second;
+  }
+  MemoryPoolHandle pool = MemoryPoolHandle::New();
+  const uint32_t degree = psi_params_.max_degree;
+
+  // y^k = y^high * y^low, where high holds the upper half of k's set bits,
+  // so every power is at most ceil(log2(popcount(k))) products deep
+  vector<Ciphertext> powers(degree + 1);
+  for (uint32_t i = 0; i < query.size(); i++) {
+    powers[uint64_t(1) << i] = query[i];
+  }
+  for (uint32_t k = 3; k <= degree; k++) {
+    if ((k & (k - 1)) == 0) {
+      continue;
+    }
+    uint32_t bits = __builtin_popcount(k);
+    uint32_t high = k;
+    for (uint32_t b = 0; b < bits / 2; b++) {
+      high &= high - 1; // drops the lowest set bit
+    }
+    evaluator_->multiply(powers[high], powers[k - high], powers[k], pool);
+    evaluator_->relinearize_inplace(powers[k], *relin_keys, pool);
+  }
+  for (uint32_t k = 1; k <= degree; k++) {
+    evaluator_->transform_to_ntt_inplace(powers[k]);
+  }
+
+  PsiReply reply;
+  vector<uint64_t> mask(encoder_->slot_count());
+  Plaintext mask_pt(pool);
+  Ciphertext temp(pool);
+  const Modulus &t = enc_params_.plain_modulus();
+  for (const auto &coeffs : partitions_) {
+    Ciphertext result(pool);
+    bool started = false;
+    for (uint32_t k = 1; k <= degree; k++) {
+      if (coeffs[k].coeff_count() == 0) {
+        continue;
+      }
+      evaluator_->multiply_plain(powers[k], coeffs[k], started ? temp : result,
+                                 pool);
+      if (started) {
+        evaluator_->add_inplace(result, temp);
+      }
+      started = true;
+    }
+    // every partition has a bin with a root, whose leading term is x^k, k > 0
+    assert(started);
+    evaluator_->transform_from_ntt_inplace(result);
+    if (coeffs[0].coeff_count()) {
+      evaluator_->add_plain_inplace(result, coeffs[0]);
+    }
+
+    // nonzero values become uniform nonzero values; zeros stay zero
+    for (auto &value : mask) {
+      do {
+        prng_->generate(sizeof(value), reinterpret_cast<seal_byte *>(&value));
+        value %= t.value();
+      } while (value == 0);
+    }
+    encoder_->encode(mask, mask_pt);
+    evaluator_->multiply_plain_inplace(result, mask_pt, pool);
+    evaluator_->mod_switch_to_inplace(result, context_->last_parms_id(), pool);
+    reply.push_back(move(result));
+  }
+  return reply;
+}
+
+PsiClient::PsiClient(const EncryptionParameters &enc_params,
+                     const PsiParams &psi_params)
+    : enc_params_(enc_params), psi_params_(psi_params) {
+  context_ = make_shared<SEALContext>(enc_params, true);
+  check_psi_params(*context_, psi_params_);
+  keygen_ = make_unique<KeyGenerator>(*context_);
+  encryptor_ = make_unique<Encryptor>(*context_, keygen_->secret_key());
+  decryptor_ = make_unique<Decryptor>(*context_, keygen_->secret_key());
+  encoder_ = make_unique<BatchEncoder>(*context_);
+}
+
+RelinKeys PsiClient::generate_relin_keys() {
+  RelinKeys relin_keys;
+  keygen_->create_relin_keys(relin_keys);
+  return relin_keys;
+}
+
+uint64_t PsiClient::capacity() const {
+  // cuckoo hashing with three or more functions succeeds w.h.p. below ~90%
+  return encoder_->slot_count() * 8 / 10;
+}
+
+PsiQuery PsiClient::generate_query(const vector<uint64_t> &ids) {
+  if (ids.size() > capacity()) {
+    throw invalid_argument("too many ids for one query");
+  }
+  const uint64_t bins = encoder_->slot_count();
+  const uint32_t hash_count = psi_params_.hash_count;
+
+  // Cuckoo hashing of the distinct ids: an id evicted from its bin moves to
+  // the bin of another of its hash functions
+  vector<uint64_t> unique_ids;
+  unordered_map<uint64_t, uint64_t> slot_of; // id -> index in unique_ids
+  for (uint64_t id : ids) {
+    if (slot_of.emplace(id, unique_ids.size()).second) {
+      unique_ids.push_back(id);
+    }
+  }
+  const uint64_t empty = unique_ids.size();
+  vector<uint64_t> table(bins, empty);
+  vector<uint64_t> placed_bin(unique_ids.size());
+  mt19937_64 rng(random_device{}());
+  const uint32_t max_evictions = 500;
+  for (uint64_t i = 0; i < unique_ids.size(); i++) {
+    uint64_t item = i;
+    uint32_t evictions = 0;
+    while (item != empty) {
+      uint64_t bin = bins;
+      for (uint32_t h = 0; h < hash_count && bin == bins; h++) {
+        uint64_t candidate = psi_bin(unique_ids[item], h, bins);
+        if (table[candidate] == empty) {
+          bin = candidate;
+        }
+      }
+      if (bin == bins) {
+        if (hash_count == 1 || ++evictions > max_evictions) {
+          throw runtime_error("cuckoo hashing failed; split the ids");
+        }
+        bin = psi_bin(unique_ids[item], rng() % hash_count, bins);
+      }
+      swap(item, table[bin]);
+      placed_bin[table[bin]] = bin;
+    }
+  }
+  query_bins_.clear();
+  for (uint64_t id : ids) {
+    query_bins_.push_back(placed_bin[slot_of[id]]);
+  }
+
+  const Modulus &t = enc_params_.plain_modulus();
+  vector<uint64_t> power(bins, 0);
+  for (uint64_t bin = 0; bin < bins; bin++) {
+    if (table[bin] != empty) {
+      power[bin] = psi_fingerprint(unique_ids[table[bin]], t);
+    }
+  }
+  PsiQuery query;
+  Plaintext pt;
+  for (uint32_t i = 0; i < psi_window_count(psi_params_); i++) {
+    if (i > 0) {
+      for (auto &value : power) {
+        value = util::multiply_uint_mod(value, value, t);
+      }
+    }
+    encoder_->encode(power, pt);
+    Ciphertext ct;
+    encryptor_->encrypt_symmetric(pt, ct);
+    query.push_back(move(ct));
+  }
+  return query;
+}
+
+vector<bool> PsiClient::decode_reply(const PsiReply &reply) {
+  vector<bool> member(query_bins_.size(), false);
+  Plaintext pt;
+  vector<uint64_t> slots;
+  for (const auto &ct : reply) {
+    decryptor_->decrypt(ct, pt);
+    encoder_->decode(pt, slots);
+    for (size_t i = 0; i < query_bins_.size(); i++) {
+      if (slots[query_bins_[i]] == 0) {
+        member[i] = true;
+      }
+    }
+  }
+  return member;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <seal/seal.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Batched private set membership against a server-side set (the blacklist),
+// in the style of the Chen-Laine-Rindal PSI protocol. Both sides hash ids
+// into slot_count bins: the client places each of its ids in one bin by
+// cuckoo hashing, the server puts every set member in the bins of all
+// hash_count hash functions. Each server bin holds the polynomial whose roots
+// are the fingerprints of its members, split into partitions of at most
+// max_degree roots. The client sends its slot-packed fingerprints raised to
+// the powers of two up to max_degree; the server derives the other powers
+// with a product tree of depth ceil(log2(log2(max_degree) + 1)), evaluates
+// every partition's polynomial slot-wise and multiplies the result by a
+// random mask, so a slot decrypts to zero exactly when the id is in the set.
+// Fingerprints are reduced mod t, so each test has a false positive rate of
+// about (bin load) / t. The product tree is two multiplications deep for the
+// default max_degree, which needs N >= 8192 with the default coefficient
+// modulus.
+
+typedef std::vector<seal::Ciphertext> PsiQuery; // one per power of two
+typedef std::vector<seal::Ciphertext> PsiReply; // one per partition
+
+struct PsiParams {
+  std::uint32_t hash_count = 3;
+  std::uint32_t max_degree = 16; // roots per partition polynomial
+};
+
+// Number of query ciphertexts: the powers 1, 2, 4, ... <= max_degree
+std::uint32_t psi_window_count(const PsiParams &psi_params);
+
+class PsiServer {
+public:
+  PsiServer(const seal::EncryptionParameters &enc_params,
+            const PsiParams &psi_params = PsiParams());
+
+  // Ids may repeat; the previous set is replaced
+  void set_blacklist(const std::vector<std::uint64_t> &ids);
+  void set_relin_keys(std::uint32_t client_id, seal::RelinKeys relin_keys);
+
+  std::uint64_t partition_count() const { return partitions_.size(); }
+
+  PsiReply generate_reply(const PsiQuery &query, std::uint32_t client_id);
+
+private:
+  seal::EncryptionParameters enc_params_;
+  PsiParams psi_params_;
+  std::shared_ptr<seal::SEALContext> context_;
+  std::unique_ptr<seal::Evaluator> evaluator_;
+  std::unique_ptr<seal::BatchEncoder> encoder_;
+  std::map<std::uint32_t, std::shared_ptr<const seal::RelinKeys>> relin_keys_;
+  std::mutex relin_keys_mutex_;
+
+  // Per partition, the slot-packed coefficients of x^0 .. x^max_degree.
+  // x^0 is in coefficient form for add_plain, the others in NTT form; all
+  // zero coefficients are left empty and skipped.
+  std::vector<std::vector<seal::Plaintext>> partitions_;
+  std::shared_ptr<seal::UniformRandomGenerator> prng_;
+};
+
+class PsiClient {
+public:
+  PsiClient(const seal::EncryptionParameters &enc_params,
+            const PsiParams &psi_params = PsiParams());
+
+  seal::RelinKeys generate_relin_keys();
+
+  // Most ids a query can hold; cuckoo hashing may still fail close to it
+  std::uint64_t capacity() const;
+
+  // Throws runtime_error if the ids cannot be placed in distinct bins
+  PsiQuery generate_query(const std::vector<std::uint64_t> &ids);
+  // Membership of the ids of the last query, in their order
+  std::vector<bool> decode_reply(const PsiReply &reply);
+
+private:
+  seal::EncryptionParameters enc_params_;
+  PsiParams psi_params_;
+  std::shared_ptr<seal::SEALContext> context_;
+  std::unique_ptr<seal::KeyGenerator> keygen_;
+  std::unique_ptr<seal::Encryptor> encryptor_;
+  std::unique_ptr<seal::Decryptor> decryptor_;
+  std::unique_ptr<seal::BatchEncoder> encoder_;
+
+  std::vector<std::uint64_t> query_bins_; // bin of each id of the last query
+};
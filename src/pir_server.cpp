@@ -1,24 +1,60 @@
 #include "pir_server.hpp"
 #include "pir_client.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <deque>
 
 using namespace std;
 using namespace seal;
 using namespace seal::util;
 
+// Ciphertexts whose storage comes from pool; copies of a ciphertext would
+// allocate from the global pool instead
+static vector<Ciphertext> make_ciphertexts(size_t count,
+                                           const MemoryPoolHandle &pool) {
+  vector<Ciphertext> result;
+  result.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    result.emplace_back(pool);
+  }
+  return result;
+}
+
+// Database entries left empty stand for padding_plain_
+static bool is_padding(const Plaintext &plain) {
+  return plain.coeff_count() == 0;
+}
+
 PIRServer::PIRServer(const EncryptionParameters &enc_params,
                      const PirParams &pir_params)
     : enc_params_(enc_params), pir_params_(pir_params),
-      is_refreshed_(false),
-      is_db_preprocessed_(false) {
+      is_db_preprocessed_(false), is_mask_host_(false),
+      trio_prng_(UniformRandomGeneratorFactory::DefaultFactory()->create()),
+      is_refreshed_(false), num_threads_(0),
+      chunked_recursion_(false), compact_residency_(false), row_begin_(0),
+      row_end_(pir_params.nvec[0]) {
   context_ = make_shared<SEALContext>(enc_params, true);
   evaluator_ = make_unique<Evaluator>(*context_);
   encoder_ = make_unique<BatchEncoder>(*context_);
+  decomposition_plan_ = make_decomposition_plan(
+      pir_params_.enable_mswitching ? context_->last_context_data()->parms()
+                                    : context_->first_context_data()->parms());
+  folding_plan_ = make_folding_plan(context_->first_context_data()->parms());
+  mask_template_ = encode_mask_template();
+  encode_plaintext(nullptr, 0, pir_params_.ele_size, padding_plain_);
 }
 
 void PIRServer::preprocess_database() {
+  if (!db_) {
+    throw logic_error("database is not set");
+  }
   if (!is_db_preprocessed_) {
 
     for (uint32_t i = 0; i < db_->size(); i++) {
+      if (is_padding(db_->operator[](i))) {
+        continue;
+      }
       evaluator_->transform_to_ntt_inplace(db_->operator[](i),
                                            context_->first_parms_id());
     }
@@ -33,111 +69,277 @@ void PIRServer::set_database(unique_ptr<vector<Plaintext>> &&db) {
   }
 
   db_ = move(db);
+  compact_db_.clear();
   is_db_preprocessed_ = false;
 }
 
 void PIRServer::set_database(const unique_ptr<const uint8_t[]> &bytes,
                              uint64_t ele_num, uint64_t ele_size) {
+  // Walk the caller's array in windows of whole plaintexts so the build goes
+  // through the same parallel pipeline as streamed databases.
+  uint64_t db_size = ele_num * ele_size;
+  uint64_t chunk_size =
+      64 * max<uint64_t>(1, pir_params_.elements_per_plaintext) * ele_size;
+  uint64_t offset = 0;
+
+  set_database(
+      [&](vector<uint8_t> &chunk) {
+        if (offset >= db_size) {
+          return false;
+        }
+        uint64_t len = min(chunk_size, db_size - offset);
+        chunk.assign(bytes.get() + offset, bytes.get() + offset + len);
+        offset += len;
+        return true;
+      },
+      ele_num, ele_size);
+}
+
+void PIRServer::set_database(const DatabaseProducer &producer,
+                             uint64_t ele_num, uint64_t ele_size) {
 
   uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
   uint32_t N = enc_params_.poly_modulus_degree();
 
-  // number of FV plaintexts needed to represent all elements
-  uint64_t num_of_plaintexts = pir_params_.num_of_plaintexts;
-
   // number of FV plaintexts needed to create the d-dimensional matrix
   uint64_t prod = 1;
   for (uint32_t i = 0; i < pir_params_.nvec.size(); i++) {
     prod *= pir_params_.nvec[i];
   }
-  uint64_t matrix_plaintexts = prod;
 
-  assert(num_of_plaintexts <= matrix_plaintexts);
+  // A shard only holds its rows of the first dimension, which are a
+  // contiguous range of plaintexts; the producer supplies just those bytes.
+  uint64_t first_plaintext = row_begin_ * (prod / pir_params_.nvec[0]);
+  uint64_t matrix_plaintexts =
+      (row_end_ - row_begin_) * (prod / pir_params_.nvec[0]);
 
-  auto result = make_unique<vector<Plaintext>>();
-  result->reserve(matrix_plaintexts);
+  // number of FV plaintexts needed to represent all elements
+  uint64_t num_of_plaintexts =
+      min(matrix_plaintexts,
+          pir_params_.num_of_plaintexts -
+              min(pir_params_.num_of_plaintexts, first_plaintext));
 
   uint64_t ele_per_ptxt = pir_params_.elements_per_plaintext;
   uint64_t bytes_per_ptxt = ele_per_ptxt * ele_size;
-
   uint64_t db_size = ele_num * ele_size;
 
-  uint64_t coeff_per_ptxt =
-      ele_per_ptxt * coefficients_per_element(logt, ele_size);
-  assert(coeff_per_ptxt <= N);
-
-  // cout << "Elements per plaintext: " << ele_per_ptxt << endl;
-  // cout << "Coeff per ptxt: " << coeff_per_ptxt << endl;
-  // cout << "Bytes per plaintext: " << bytes_per_ptxt << endl;
-
-  uint32_t offset = 0;
-
-  for (uint64_t i = 0; i < num_of_plaintexts; i++) {
-
-    uint64_t process_bytes = 0;
-
-    if (db_size <= offset) {
-      break;
-    } else if (db_size < offset + bytes_per_ptxt) {
-      process_bytes = db_size - offset;
-    } else {
-      process_bytes = bytes_per_ptxt;
+  assert(coefficients_per_ptxt(pir_params_, logt) <= N);
+
+  // With compact residency the plaintexts go to `packed` and the database
+  // proper stays empty
+  auto result = make_unique<vector<Plaintext>>(
+      compact_residency_ ? 0 : matrix_plaintexts);
+  CompactDatabase packed(compact_residency_ ? matrix_plaintexts : 0);
+  // Declared after `result`: its destructor runs any queued encodes to
+  // completion before the plaintexts they write to go away.
+  ThreadPool pool(num_threads_, cpus_);
+
+  // Raw bytes are handed to the workers in batches of whole plaintexts, and
+  // the producer keeps reading while they are encoded. At most max_batches
+  // are outstanding, which bounds the resident raw bytes to about
+  // (max_batches + 1) batches plus one chunk.
+  const uint64_t batch_plaintexts = 4 * pool.size();
+  const size_t max_batches = 2;
+  deque<vector<future<void>>> in_flight;
+
+  vector<uint8_t> chunk;
+  vector<uint8_t> pending;
+  uint64_t consumed = 0;
+  uint64_t current_plaintexts = 0;
+
+  auto wait_oldest = [&]() {
+    for (auto &task : in_flight.front()) {
+      task.get();
     }
-    assert(process_bytes % ele_size == 0);
-    uint64_t ele_in_chunk = process_bytes / ele_size;
+    in_flight.pop_front();
+  };
 
-    // Get the coefficients of the elements that will be packed in plaintext i
-    vector<uint64_t> coefficients(coeff_per_ptxt);
-    for (uint64_t ele = 0; ele < ele_in_chunk; ele++) {
-      vector<uint64_t> element_coeffs = bytes_to_coeffs(
-          logt, bytes.get() + offset + (ele_size * ele), ele_size);
-      copy(element_coeffs.begin(), element_coeffs.end(),
-                coefficients.begin() +
-                    (coefficients_per_element(logt, ele_size) * ele));
+  auto submit_batch = [&](uint64_t count) {
+    assert(current_plaintexts + count <= num_of_plaintexts);
+    if (in_flight.size() >= max_batches) {
+      wait_oldest();
     }
 
-    offset += process_bytes;
-
-    uint64_t used = coefficients.size();
-
-    assert(used <= coeff_per_ptxt);
-
-    // Pad the rest with 1s
-    for (uint64_t j = 0; j < (pir_params_.slot_count - used); j++) {
-      coefficients.push_back(1);
+    uint64_t batch_bytes = min<uint64_t>(pending.size(), count * bytes_per_ptxt);
+    auto bytes = make_shared<vector<uint8_t>>(pending.begin(),
+                                              pending.begin() + batch_bytes);
+    pending.erase(pending.begin(), pending.begin() + batch_bytes);
+
+    vector<future<void>> tasks;
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t offset = i * bytes_per_ptxt;
+      uint64_t process_bytes = min(bytes_per_ptxt, bytes->size() - offset);
+      assert(process_bytes % ele_size == 0);
+      uint64_t index = current_plaintexts + i;
+      Plaintext *plain = compact_residency_ ? nullptr : &(*result)[index];
+      vector<uint64_t> *words = compact_residency_ ? &packed[index] : nullptr;
+      tasks.push_back(pool.submit([this, bytes, offset, process_bytes,
+                                   ele_size, plain, words]() {
+        // empty rows of a sparse id space encode to padding_plain_, so a
+        // plaintext of them is left empty instead
+        const uint8_t *begin = bytes->data() + offset;
+        if (all_of(begin, begin + process_bytes,
+                   [](uint8_t b) { return b == 0; })) {
+          return;
+        }
+        if (words) {
+          Plaintext coefficients;
+          encode_plaintext(begin, process_bytes / ele_size, ele_size,
+                           coefficients, false);
+          pack_plaintext(coefficients, *words);
+        } else {
+          encode_plaintext(begin, process_bytes / ele_size, ele_size, *plain);
+        }
+      }));
     }
-
-    Plaintext plain;
-    encoder_->encode(coefficients, plain);
-    // cout << i << "-th encoded plaintext = " << plain.to_string() << endl;
-    result->push_back(move(plain));
+    current_plaintexts += count;
+    in_flight.push_back(move(tasks));
+  };
+
+  while (consumed < db_size && producer(chunk)) {
+    uint64_t take = min<uint64_t>(chunk.size(), db_size - consumed);
+    pending.insert(pending.end(), chunk.begin(), chunk.begin() + take);
+    consumed += take;
+    vector<uint8_t>().swap(chunk);
+    while (pending.size() >= batch_plaintexts * bytes_per_ptxt) {
+      submit_batch(batch_plaintexts);
+    }
+  }
+  if (consumed < db_size) {
+    throw invalid_argument("database producer stopped after " +
+                           to_string(consumed) + " of " + to_string(db_size) +
+                           " bytes");
+  }
+  if (!pending.empty()) {
+    submit_batch((pending.size() + bytes_per_ptxt - 1) / bytes_per_ptxt);
+  }
+  while (!in_flight.empty()) {
+    wait_oldest();
   }
 
-  // Add padding to make database a matrix
-  uint64_t current_plaintexts = result->size();
   assert(current_plaintexts <= num_of_plaintexts);
 
 #ifdef DEBUG
   cout << "adding: " << matrix_plaintexts - current_plaintexts
        << " FV plaintexts of padding (equivalent to: "
        << (matrix_plaintexts - current_plaintexts) *
-              elements_per_ptxt(logtp, N, ele_size)
+              pir_params_.elements_per_plaintext
        << " elements)" << endl;
 #endif
 
-  vector<uint64_t> padding(N, 1);
+  // The plaintexts past the data, which make the database a matrix, are left
+  // empty as well: padding_plain_ is an empty chunk's plaintext
+
+  set_database(move(result));
+  compact_db_ = move(packed);
+  is_db_preprocessed_ = true;
+}
 
-  for (uint64_t i = 0; i < (matrix_plaintexts - current_plaintexts); i++) {
-    Plaintext plain;
-    vector_to_plaintext(padding, plain);
-    result->push_back(plain);
+void PIRServer::encode_plaintext(const uint8_t *bytes, uint64_t ele_in_chunk,
+                                 uint64_t ele_size, Plaintext &plain,
+                                 bool ntt) {
+  uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
+  uint64_t coeff_per_ele = coefficients_per_element(logt, ele_size);
+  uint64_t coeff_per_ptxt = coefficients_per_ptxt(pir_params_, logt);
+
+  // Get the coefficients of the elements packed in this plaintext and pad the
+  // rest with 1s
+  vector<uint64_t> coefficients(pir_params_.slot_count, 1);
+  fill(coefficients.begin(), coefficients.begin() + coeff_per_ptxt, 0);
+  if (pir_params_.enable_dense_packing) {
+    // the elements are contiguous in bytes, so they pack as one stream
+    bytes_to_coeffs(logt, bytes, ele_in_chunk * ele_size, coefficients.data());
+  } else {
+    for (uint64_t ele = 0; ele < ele_in_chunk; ele++) {
+      bytes_to_coeffs(logt, bytes + (ele_size * ele), ele_size,
+                      coefficients.data() + (coeff_per_ele * ele));
+    }
   }
 
-  set_database(move(result));
+  encoder_->encode(coefficients, plain);
+  if (ntt) {
+    evaluator_->transform_to_ntt_inplace(plain, context_->first_parms_id());
+  }
+}
+
+void PIRServer::set_compact_residency(bool enabled) {
+  compact_residency_ = enabled;
+}
+
+uint64_t PIRServer::compact_words() const {
+  return (enc_params_.poly_modulus_degree() *
+              enc_params_.plain_modulus().bit_count() +
+          63) /
+         64;
+}
+
+const PIRServer::CompactDatabase *PIRServer::compact_database() const {
+  return compact_db_.empty() ? nullptr : &compact_db_;
+}
+
+// Coefficient c sits at bits [c * bits, (c + 1) * bits) of the words
+void PIRServer::pack_plaintext(const Plaintext &plain,
+                               vector<uint64_t> &words) {
+  const uint32_t bits = enc_params_.plain_modulus().bit_count();
+  words.assign(compact_words(), 0);
+  for (size_t c = 0; c < plain.coeff_count(); c++) {
+    uint64_t pos = c * bits;
+    uint32_t shift = pos % 64;
+    words[pos / 64] |= plain[c] << shift;
+    if (shift + bits > 64) {
+      words[pos / 64 + 1] |= plain[c] >> (64 - shift);
+    }
+  }
+}
+
+void PIRServer::unpack_plaintext(const vector<uint64_t> &words,
+                                 Plaintext &plain,
+                                 const MemoryPoolHandle &pool) {
+  const uint32_t bits = enc_params_.plain_modulus().bit_count();
+  const uint64_t mask = (1ULL << bits) - 1;
+  const size_t N = enc_params_.poly_modulus_degree();
+  // back to coefficient form, reusing the storage of the last transform
+  plain.parms_id() = parms_id_zero;
+  plain.resize(N);
+  uint64_t *coeffs = plain.data();
+  for (size_t c = 0; c < N; c++) {
+    uint64_t pos = c * bits;
+    uint32_t shift = pos % 64;
+    uint64_t value = words[pos / 64] >> shift;
+    if (shift + bits > 64) {
+      value |= words[pos / 64 + 1] << (64 - shift);
+    }
+    coeffs[c] = value & mask;
+  }
+  evaluator_->transform_to_ntt_inplace(plain, context_->first_parms_id(), pool);
+}
+
+void PIRServer::set_num_threads(uint32_t num_threads) {
+  num_threads_ = num_threads;
+}
+
+void PIRServer::set_cpu_affinity(vector<uint32_t> cpus) {
+  cpus_ = move(cpus);
+}
+
+void PIRServer::set_chunked_recursion(bool enabled) {
+  chunked_recursion_ = enabled;
 }
 
 void PIRServer::set_galois_key(uint32_t client_id, seal::GaloisKeys galkey) {
-  galoisKeys_[client_id] = galkey;
+  auto key = make_shared<const GaloisKeys>(move(galkey));
+  lock_guard<mutex> lock(galois_keys_mutex_);
+  galoisKeys_[client_id] = move(key);
+}
+
+shared_ptr<const GaloisKeys> PIRServer::get_galois_key(uint32_t client_id) {
+  lock_guard<mutex> lock(galois_keys_mutex_);
+  auto it = galoisKeys_.find(client_id);
+  if (it == galoisKeys_.end()) {
+    throw invalid_argument("no galois key for client " +
+                           to_string(client_id));
+  }
+  return it->second;
 }
 
 PirQuery PIRServer::deserialize_query(stringstream &stream) {
@@ -149,6 +351,10 @@ PirQuery PIRServer::deserialize_query(stringstream &stream) {
     // poly_modulus_degree indexes In most cases this is usually 1.
     uint32_t ctx_per_dimension =
         ceil((pir_params_.nvec[i] + 0.0) / enc_params_.poly_modulus_degree());
+    if (pir_params_.enable_rgsw_folding && i > 0) {
+      ctx_per_dimension = folding_bits(pir_params_.nvec[i]) * 2 *
+                          folding_plan_.expansion_ratio;
+    }
 
     vector<Ciphertext> cs;
     for (uint32_t j = 0; j < ctx_per_dimension; j++) {
@@ -164,6 +370,8 @@ PirQuery PIRServer::deserialize_query(stringstream &stream) {
 }
 
 int PIRServer::serialize_reply(PirReply &reply, stringstream &stream) {
+  PhaseTimer timer(metrics_, PHASE_SERIALIZE);
+  metrics_.add(COUNT_MOD_SWITCH, reply.size());
   int output_size = 0;
   for (int i = 0; i < reply.size(); i++) {
     evaluator_->mod_switch_to_inplace(reply[i], context_->last_parms_id());
@@ -173,140 +381,551 @@ int PIRServer::serialize_reply(PirReply &reply, stringstream &stream) {
 }
 
 PirReply PIRServer::generate_reply(PirQuery &query, uint32_t client_id) {
+  return generate_reply_impl(query, client_id, nullptr, nullptr);
+}
+
+void PIRServer::generate_reply_streaming(PirQuery &query, uint32_t client_id,
+                                         const ReplySink &sink) {
+  CiphertextSink emit = [&](uint64_t index, uint64_t count, Ciphertext &ct) {
+    PhaseTimer timer(metrics_, PHASE_SERIALIZE);
+    metrics_.add(COUNT_MOD_SWITCH);
+    evaluator_->mod_switch_to_inplace(
+        ct, context_->last_parms_id(),
+        MemoryManager::GetPool(mm_prof_opt::mm_force_thread_local));
+    stringstream stream;
+    ct.save(stream);
+    timer.stop();
+    sink(index, count, stream.str());
+  };
+  generate_reply_impl(query, client_id, nullptr, &emit);
+}
+
+PirReply PIRServer::generate_reply_impl(PirQuery &query, uint32_t client_id,
+                                        const Plaintext *mask,
+                                        const CiphertextSink *emit) {
+  if (is_shard()) {
+    throw logic_error("a shard can only produce partial replies");
+  }
+  if (!is_db_preprocessed_) {
+    preprocess_database();
+  }
+  PhaseTimer timer(metrics_, PHASE_REQUEST);
+  metrics_.add(COUNT_REQUESTS);
+  MemoryPoolHandle pool = MemoryPoolHandle::New();
+
   vector<uint64_t> nvec = pir_params_.nvec;
   uint64_t product = 1;
-
   for (uint32_t i = 0; i < nvec.size(); i++) {
     product *= nvec[i];
   }
 
-  auto coeff_count = enc_params_.poly_modulus_degree();
-
-  vector<Plaintext> *cur = db_.get();
-  vector<Plaintext> intermediate_plain; // decompose....
+  vector<Ciphertext> expanded_query =
+      expand_dimension(query, 0, client_id, pool);
+  // with a single dimension the first scan already yields the reply
+  vector<Ciphertext> intermediateCtxts =
+      multiply_dimension(expanded_query, *db_, product / nvec[0], 0, nvec[0],
+                         mask, nvec.size() == 1 ? emit : nullptr, pool,
+                         compact_database());
 
-  auto pool = MemoryManager::GetPool();
+  return finish_reply(intermediateCtxts, query, client_id, mask, emit, pool);
+}
 
+vector<Ciphertext> PIRServer::expand_dimension(PirQuery &query, uint32_t i,
+                                               uint32_t client_id,
+                                               const MemoryPoolHandle &pool) {
   int N = enc_params_.poly_modulus_degree();
+  uint64_t n_i = pir_params_.nvec[i];
+  vector<Ciphertext> expanded_query;
+  PhaseTimer expand_timer(metrics_, PHASE_EXPAND);
+
+  // cout << "Server: n_i = " << n_i << endl;
+  // cout << "Server: expanding " << query[i].size() << " query ctxts" << endl;
+  for (uint32_t j = 0; j < query[i].size(); j++) {
+    uint64_t total = N;
+    if (j == query[i].size() - 1) {
+      total = n_i % N;
+    }
+    // cout << "-- expanding one query ctxt into " << total << " ctxts " << endl;
+    vector<Ciphertext> expanded_query_part =
+        expand_query(query[i][j], total, client_id, pool);
+    expanded_query.insert(
+        expanded_query.end(),
+        make_move_iterator(expanded_query_part.begin()),
+        make_move_iterator(expanded_query_part.end()));
+    expanded_query_part.clear();
+  }
+  // cout << "Server: expansion done " << endl;
+  assert(expanded_query.size() == n_i);
+  expand_timer.stop();
+
+  // Transform expanded query to NTT
+  PhaseTimer ntt_timer(metrics_, PHASE_NTT);
+  metrics_.add(COUNT_NTT_FORWARD, expanded_query.size());
+  for (uint32_t jj = 0; jj < expanded_query.size(); jj++) {
+    evaluator_->transform_to_ntt_inplace(expanded_query[jj]);
+  }
+  return expanded_query;
+}
 
-  int logt = floor(log2(enc_params_.plain_modulus().value()));
-
-  for (uint32_t i = 0; i < nvec.size(); i++) {
-    // cout << "Server: " << i + 1 << "-th recursion level started " << endl;
-
-    vector<Ciphertext> expanded_query;
+vector<Ciphertext>
+PIRServer::multiply_dimension(const vector<Ciphertext> &expanded_query,
+                              const vector<Plaintext> &cur, uint64_t product,
+                              uint64_t row_begin, uint64_t row_end,
+                              const Plaintext *mask,
+                              const CiphertextSink *emit,
+                              const MemoryPoolHandle &pool,
+                              const CompactDatabase *compact) {
+  assert(row_begin < row_end);
+
+  // cur (or compact) holds rows [row_begin, row_end) of this dimension, so
+  // plaintext (k, j) is at k + (j - row_begin) * product
+  vector<Ciphertext> intermediateCtxts = make_ciphertexts(product, pool);
+  Ciphertext temp(pool);
+
+  // A compact plaintext is transformed into scratch just before its product,
+  // so only one NTT-form plaintext is resident and it is still in cache
+  Plaintext scratch(pool);
+  auto padding_at = [&](uint64_t p) {
+    return compact ? (*compact)[p].empty() : is_padding(cur[p]);
+  };
+  auto plaintext_at = [&](uint64_t p) -> const Plaintext & {
+    if (!compact) {
+      return cur[p];
+    }
+    unpack_plaintext((*compact)[p], scratch, pool);
+    return scratch;
+  };
+
+  uint64_t rows = row_end - row_begin;
+  uint64_t occupied = 0;
+  for (uint64_t p = 0; p < rows * product; p++) {
+    occupied += !padding_at(p);
+  }
+  bool has_padding = occupied < rows * product;
+  bool zero_padding = padding_plain_.is_zero();
+
+  // Padding entries all hold padding_plain_, so the padding terms of output k
+  // fold into one product of it with the sum of their selectors, i.e. all
+  // selectors minus those of the occupied rows
+  Ciphertext selectors(pool), padding_ct(pool), mask_ct(pool);
+  if (has_padding || mask) {
+    selectors = sum_selectors(expanded_query, row_begin, row_end, pool);
+  }
+  uint64_t padding_products = 0;
+  if (mask) {
+    evaluator_->multiply_plain(selectors, *mask, mask_ct, pool);
+  }
 
-    uint64_t n_i = nvec[i];
-    // cout << "Server: n_i = " << n_i << endl;
-    // cout << "Server: expanding " << query[i].size() << " query ctxts" << endl;
-    for (uint32_t j = 0; j < query[i].size(); j++) {
-      uint64_t total = N;
-      if (j == query[i].size() - 1) {
-        total = n_i % N;
+  // the scan and the inverse transforms alternate per output, so their times
+  // are summed separately and recorded once per dimension
+  chrono::duration<double> scan_time(0), intt_time(0);
+  for (uint64_t k = 0; k < product; k++) {
+    auto scan_start = chrono::steady_clock::now();
+    bool started = false;
+    bool padded = false;
+    Ciphertext padding_selectors(pool);
+    for (uint64_t j = row_begin; j < row_end; j++) {
+      uint64_t p = k + (j - row_begin) * product;
+      if (padding_at(p)) {
+        padded = true;
+        continue;
       }
-      // cout << "-- expanding one query ctxt into " << total << " ctxts " << endl;
-      vector<Ciphertext> expanded_query_part =
-          expand_query(query[i][j], total, client_id);
-      expanded_query.insert(
-          expanded_query.end(),
-          make_move_iterator(expanded_query_part.begin()),
-          make_move_iterator(expanded_query_part.end()));
-      expanded_query_part.clear();
-    }
-    // cout << "Server: expansion done " << endl;
-    if (expanded_query.size() != n_i) {
-      // cout << " size mismatch!!! " << expanded_query.size() << ", " << n_i << endl;
-    }
-
-    // Transform expanded query to NTT, and ...
-    for (uint32_t jj = 0; jj < expanded_query.size(); jj++) {
-      evaluator_->transform_to_ntt_inplace(expanded_query[jj]);
-    }
-
-    // Transform plaintext to NTT. If database is pre-processed, can skip
-    if ((!is_db_preprocessed_) || i > 0) {
-      for (uint32_t jj = 0; jj < cur->size(); jj++) {
-        evaluator_->transform_to_ntt_inplace((*cur)[jj],
-                                             context_->first_parms_id());
+      const Plaintext &plain = plaintext_at(p);
+      if (!started) {
+        evaluator_->multiply_plain(expanded_query[j], plain,
+                                   intermediateCtxts[k], pool);
+      } else {
+        evaluator_->multiply_plain(expanded_query[j], plain, temp, pool);
+        evaluator_->add_inplace(intermediateCtxts[k],
+                                temp); // Adds to first component.
       }
+      started = true;
     }
 
-    for (uint64_t k = 0; k < product; k++) {
-      if ((*cur)[k].is_zero()) {
-        // cout << k + 1 << "/ " << product << "-th ptxt = 0 " << endl;
+    if (!started) {
+      // outputs without occupied rows share one ciphertext; with a zero
+      // padding plaintext it still has to be a valid encryption of 0
+      if (padding_ct.size() == 0) {
+        if (zero_padding) {
+          padding_ct = encrypt_zero_like(*context_, *evaluator_, selectors, pool);
+        } else {
+          evaluator_->multiply_plain(selectors, padding_plain_, padding_ct,
+                                     pool);
+        }
+        padding_products++;
+      }
+      intermediateCtxts[k] = padding_ct;
+    } else if (padded && !zero_padding) {
+      padding_selectors = selectors;
+      for (uint64_t j = row_begin; j < row_end; j++) {
+        if (!padding_at(k + (j - row_begin) * product)) {
+          evaluator_->sub_inplace(padding_selectors, expanded_query[j]);
+        }
       }
+      evaluator_->multiply_plain_inplace(padding_selectors, padding_plain_,
+                                         pool);
+      evaluator_->add_inplace(intermediateCtxts[k], padding_selectors);
+      padding_products++;
+    }
+    if (mask) {
+      evaluator_->add_inplace(intermediateCtxts[k], mask_ct);
     }
 
-    product /= n_i;
+    auto intt_start = chrono::steady_clock::now();
+    evaluator_->transform_from_ntt_inplace(intermediateCtxts[k]);
+    auto intt_end = chrono::steady_clock::now();
+    scan_time += intt_start - scan_start;
+    intt_time += intt_end - intt_start;
+    if (emit) {
+      (*emit)(k, product, intermediateCtxts[k]);
+    }
+  }
+  metrics_.add(COUNT_MULTIPLY_PLAIN,
+               occupied + padding_products + (mask ? 1 : 0));
+  if (compact) {
+    metrics_.add(COUNT_NTT_FORWARD, occupied);
+    metrics_.add(COUNT_BYTES_SCANNED,
+                 occupied * compact_words() * sizeof(uint64_t));
+  } else {
+    metrics_.add(COUNT_BYTES_SCANNED,
+                 occupied * padding_plain_.coeff_count() * sizeof(uint64_t));
+  }
+  metrics_.add(COUNT_NTT_INVERSE, product);
+  metrics_.observe(PHASE_SCAN, scan_time.count());
+  metrics_.observe(PHASE_INTT, intt_time.count());
+  return intermediateCtxts;
+}
+
+Ciphertext PIRServer::sum_selectors(const vector<Ciphertext> &expanded_query,
+                                    uint64_t row_begin, uint64_t row_end,
+                                    const MemoryPoolHandle &pool) {
+  Ciphertext selectors(expanded_query[row_begin], pool);
+  for (uint64_t j = row_begin + 1; j < row_end; j++) {
+    evaluator_->add_inplace(selectors, expanded_query[j]);
+  }
+  return selectors;
+}
 
-    vector<Ciphertext> intermediateCtxts(product);
-    Ciphertext temp;
+Ciphertext PIRServer::mask_dimension(const vector<Ciphertext> &expanded_query,
+                                     uint64_t row_begin, uint64_t row_end,
+                                     const Plaintext &mask,
+                                     const MemoryPoolHandle &pool) {
+  // multiply_plain distributes over the addition exactly, so this is the
+  // same ciphertext as adding every row's product separately
+  Ciphertext selectors = sum_selectors(expanded_query, row_begin, row_end, pool);
+  evaluator_->multiply_plain_inplace(selectors, mask, pool);
+  return selectors;
+}
 
-    for (uint64_t k = 0; k < product; k++) {
+PirReply PIRServer::finish_reply(vector<Ciphertext> &first_dimension,
+                                 PirQuery &query, uint32_t client_id,
+                                 const Plaintext *mask,
+                                 const CiphertextSink *emit,
+                                 const MemoryPoolHandle &pool) {
+  vector<uint64_t> nvec = pir_params_.nvec;
+  vector<Ciphertext> intermediateCtxts = move(first_dimension);
+  vector<Plaintext> intermediate_plain; // decompose....
 
-      evaluator_->multiply_plain(expanded_query[0], (*cur)[k],
-                                 intermediateCtxts[k]);
+  for (uint32_t i = 1; i < nvec.size(); i++) {
+    // cout << "Server: " << i + 1 << "-th recursion level started " << endl;
+    if (pir_params_.enable_rgsw_folding) {
+      intermediateCtxts = fold_dimension_rgsw(
+          intermediateCtxts, query[i], i,
+          i == nvec.size() - 1 ? emit : nullptr, pool);
+      continue;
+    }
+    if (chunked_recursion_) {
+      vector<Ciphertext> expanded_query =
+          expand_dimension(query, i, client_id, pool);
+      intermediateCtxts = fold_dimension_chunked(
+          intermediateCtxts, expanded_query, i, mask,
+          i == nvec.size() - 1 ? emit : nullptr, pool);
+      continue;
+    }
 
-      for (uint64_t j = 1; j < n_i; j++) {
-        evaluator_->multiply_plain(expanded_query[j], (*cur)[k + j * product],
-                                   temp);
-        evaluator_->add_inplace(intermediateCtxts[k],
-                                temp); // Adds to first component.
+    uint64_t product = intermediateCtxts.size();
+    // the plaintexts of the previous level are overwritten in place
+    uint64_t ratio =
+        decomposition_plan_.expansion_ratio * intermediateCtxts[0].size();
+    intermediate_plain.reserve(ratio * product);
+    while (intermediate_plain.size() < ratio * product) {
+      intermediate_plain.emplace_back(pool);
+    }
+    intermediate_plain.resize(ratio * product);
+
+    for (uint64_t rr = 0; rr < product; rr++) {
+      if (pir_params_.enable_mswitching) {
+        PhaseTimer timer(metrics_, PHASE_MOD_SWITCH);
+        metrics_.add(COUNT_MOD_SWITCH);
+        evaluator_->mod_switch_to_inplace(intermediateCtxts[rr],
+                                          context_->last_parms_id(), pool);
       }
+
+      PhaseTimer timer(metrics_, PHASE_DECOMPOSE);
+      decompose_to_plaintexts(decomposition_plan_, intermediateCtxts[rr],
+                              &intermediate_plain[rr * ratio]);
     }
+    product = intermediate_plain.size(); // multiply by expansion rate.
 
-/* 
-    return ?
- */
+    vector<Ciphertext> expanded_query =
+        expand_dimension(query, i, client_id, pool);
 
-    for (uint32_t jj = 0; jj < intermediateCtxts.size(); jj++) {
-      evaluator_->transform_from_ntt_inplace(intermediateCtxts[jj]);
-      // print intermediate ctxts?
-      // // cout << "const term of ctxt " << jj << " = " <<
-      // intermediateCtxts[jj][0] << endl;
+    // Transform plaintext to NTT
+    PhaseTimer ntt_timer(metrics_, PHASE_NTT);
+    metrics_.add(COUNT_NTT_FORWARD, intermediate_plain.size());
+    for (uint32_t jj = 0; jj < intermediate_plain.size(); jj++) {
+      evaluator_->transform_to_ntt_inplace(intermediate_plain[jj],
+                                           context_->first_parms_id(), pool);
     }
+    ntt_timer.stop();
 
-    if (i == nvec.size() - 1) {
-      return intermediateCtxts;
-    } else {
-      intermediate_plain.clear();
-      intermediate_plain.reserve(pir_params_.expansion_ratio * product);
-      cur = &intermediate_plain;
-
-      for (uint64_t rr = 0; rr < product; rr++) {
-        EncryptionParameters parms;
-        if (pir_params_.enable_mswitching) {
-          evaluator_->mod_switch_to_inplace(intermediateCtxts[rr],
-                                            context_->last_parms_id());
-          parms = context_->last_context_data()->parms();
-        } else {
-          parms = context_->first_context_data()->parms();
-        }
+    product /= nvec[i];
+    intermediateCtxts = multiply_dimension(
+        expanded_query, intermediate_plain, product, 0, nvec[i], mask,
+        i == nvec.size() - 1 ? emit : nullptr, pool);
+    // cout << "Server: " << i + 1 << "-th recursion level finished " << endl;
+  }
+  // cout << "reply generated!  " << endl;
+  return intermediateCtxts;
+}
 
-        vector<Plaintext> plains =
-            decompose_to_plaintexts(parms, intermediateCtxts[rr]);
+vector<Ciphertext>
+PIRServer::fold_dimension_chunked(vector<Ciphertext> &previous,
+                                  const vector<Ciphertext> &expanded_query,
+                                  uint32_t i, const Plaintext *mask,
+                                  const CiphertextSink *emit,
+                                  const MemoryPoolHandle &pool) {
+  // Plaintext p of this level is piece p % ratio of previous[p / ratio]; it
+  // belongs to row j = p / product and output k = p % product. Previous
+  // ciphertexts are consumed in order, so outputs complete in index order
+  // once their last row has been accumulated.
+  uint64_t ratio = decomposition_plan_.expansion_ratio * previous[0].size();
+  uint64_t rows = pir_params_.nvec[i];
+  // as in the unchunked fold, pieces beyond rows * product are never read
+  uint64_t product = previous.size() * ratio / rows;
+  vector<Ciphertext> result = make_ciphertexts(product, pool);
+  vector<Plaintext> plains; // reused for every previous ciphertext
+  for (uint64_t jj = 0; jj < ratio; jj++) {
+    plains.emplace_back(pool);
+  }
+  Ciphertext temp(pool);
+  Ciphertext mask_ct(pool);
+  if (mask) {
+    metrics_.add(COUNT_MULTIPLY_PLAIN);
+    mask_ct = mask_dimension(expanded_query, 0, rows, *mask, pool);
+  }
+  uint64_t next_emit = 0;
+
+  for (uint64_t rr = 0; rr < previous.size(); rr++) {
+    if (pir_params_.enable_mswitching) {
+      PhaseTimer timer(metrics_, PHASE_MOD_SWITCH);
+      metrics_.add(COUNT_MOD_SWITCH);
+      evaluator_->mod_switch_to_inplace(previous[rr],
+                                        context_->last_parms_id(), pool);
+    }
+    PhaseTimer decompose_timer(metrics_, PHASE_DECOMPOSE);
+    decompose_to_plaintexts(decomposition_plan_, previous[rr], plains.data());
+    decompose_timer.stop();
+    previous[rr].release();
+
+    PhaseTimer ntt_timer(metrics_, PHASE_NTT);
+    metrics_.add(COUNT_NTT_FORWARD, plains.size());
+    for (auto &plain : plains) {
+      evaluator_->transform_to_ntt_inplace(plain, context_->first_parms_id(),
+                                           pool);
+    }
+    ntt_timer.stop();
+
+    PhaseTimer scan_timer(metrics_, PHASE_SCAN);
+    uint64_t used = min<uint64_t>(plains.size(),
+                                  rows * product - min(rows * product, rr * ratio));
+    metrics_.add(COUNT_MULTIPLY_PLAIN, used);
+    metrics_.add(COUNT_BYTES_SCANNED,
+                 used * plains[0].coeff_count() * sizeof(uint64_t));
+    for (uint64_t jj = 0; jj < plains.size(); jj++) {
+      uint64_t p = rr * ratio + jj;
+      uint64_t j = p / product, k = p % product;
+      if (j >= rows) {
+        break;
+      }
+      if (j == 0) {
+        evaluator_->multiply_plain(expanded_query[j], plains[jj], result[k],
+                                   pool);
+      } else {
+        evaluator_->multiply_plain(expanded_query[j], plains[jj], temp, pool);
+        evaluator_->add_inplace(result[k], temp);
+      }
+    }
+    scan_timer.stop();
+
+    // outputs whose last row has been added are final
+    uint64_t last_row_start = (rows - 1) * product;
+    uint64_t done = rr * ratio + plains.size();
+    while (next_emit < product && last_row_start + next_emit < done) {
+      if (mask) {
+        evaluator_->add_inplace(result[next_emit], mask_ct);
+      }
+      PhaseTimer timer(metrics_, PHASE_INTT);
+      metrics_.add(COUNT_NTT_INVERSE);
+      evaluator_->transform_from_ntt_inplace(result[next_emit]);
+      timer.stop();
+      if (emit) {
+        (*emit)(next_emit, product, result[next_emit]);
+      }
+      next_emit++;
+    }
+  }
+  assert(next_emit == product);
+  return result;
+}
 
-        for (uint32_t jj = 0; jj < plains.size(); jj++) {
-          intermediate_plain.emplace_back(plains[jj]);
+vector<Ciphertext>
+PIRServer::fold_dimension_rgsw(vector<Ciphertext> &previous,
+                               const vector<Ciphertext> &rgsw_bits,
+                               uint32_t i, const CiphertextSink *emit,
+                               const MemoryPoolHandle &pool) {
+  uint64_t rows = pir_params_.nvec[i];
+  uint32_t bits = folding_bits(rows);
+  uint64_t per_bit = 2 * folding_plan_.expansion_ratio;
+  if (rgsw_bits.size() != bits * per_bit) {
+    throw invalid_argument("query does not hold the RGSW bits of a dimension");
+  }
+  // Previous ciphertext j * product + k is row j of output k
+  uint64_t product = previous.size() / rows;
+  vector<Ciphertext> result;
+  result.reserve(product);
+  vector<Plaintext> digits;
+  for (uint64_t jj = 0; jj < per_bit; jj++) {
+    digits.emplace_back(pool);
+  }
+  Ciphertext selected(pool);
+
+  for (uint64_t k = 0; k < product; k++) {
+    // Level b pairs rows 2m and 2m + 1 by bit b of the row index:
+    // row 2m + bit * (row 2m + 1 - row 2m). An unpaired last row is kept.
+    auto row = [&](uint64_t j) -> Ciphertext & {
+      return previous[j * product + k];
+    };
+    uint64_t count = rows;
+    for (uint32_t b = 0; b < bits; b++) {
+      for (uint64_t m = 0; 2 * m < count; m++) {
+        if (2 * m + 1 < count) {
+          evaluator_->sub_inplace(row(2 * m + 1), row(2 * m));
+          external_product(row(2 * m + 1), &rgsw_bits[b * per_bit], digits,
+                           selected, pool);
+          evaluator_->add_inplace(row(2 * m), selected);
+          row(2 * m + 1).release();
+        }
+        if (m > 0) {
+          row(m) = move(row(2 * m));
         }
       }
-      product = intermediate_plain.size(); // multiply by expansion rate.
+      count = (count + 1) / 2;
+    }
+    result.push_back(move(row(0)));
+    if (emit) {
+      (*emit)(k, product, result.back());
     }
-    // cout << "Server: " << i + 1 << "-th recursion level finished " << endl;
-    // cout << endl;
   }
-  // cout << "reply generated!  " << endl;
-  // This should never get here
-  assert(0);
-  vector<Ciphertext> fail(1);
-  return fail;
+  return result;
+}
+
+void PIRServer::external_product(const Ciphertext &ct, const Ciphertext *rows,
+                                 vector<Plaintext> &digits,
+                                 Ciphertext &destination,
+                                 const MemoryPoolHandle &pool) {
+  // Digit e of the decomposition times row e, which encrypts the bit times
+  // the gadget value of that digit; the sum recomposes bit * ct
+  PhaseTimer decompose_timer(metrics_, PHASE_DECOMPOSE);
+  decompose_to_plaintexts(folding_plan_, ct, digits.data());
+  decompose_timer.stop();
+
+  PhaseTimer ntt_timer(metrics_, PHASE_NTT);
+  metrics_.add(COUNT_NTT_FORWARD, digits.size());
+  for (auto &digit : digits) {
+    evaluator_->transform_to_ntt_inplace(digit, context_->first_parms_id(),
+                                         pool);
+  }
+  ntt_timer.stop();
+
+  PhaseTimer scan_timer(metrics_, PHASE_SCAN);
+  metrics_.add(COUNT_MULTIPLY_PLAIN, digits.size());
+  Ciphertext temp(pool);
+  evaluator_->multiply_plain(rows[0], digits[0], destination, pool);
+  for (size_t e = 1; e < digits.size(); e++) {
+    evaluator_->multiply_plain(rows[e], digits[e], temp, pool);
+    evaluator_->add_inplace(destination, temp);
+  }
+  scan_timer.stop();
+
+  PhaseTimer intt_timer(metrics_, PHASE_INTT);
+  metrics_.add(COUNT_NTT_INVERSE);
+  evaluator_->transform_from_ntt_inplace(destination);
+}
+
+void PIRServer::set_shard(uint64_t row_begin, uint64_t row_end) {
+  if (row_begin >= row_end || row_end > pir_params_.nvec[0]) {
+    throw invalid_argument("invalid shard row range");
+  }
+  row_begin_ = row_begin;
+  row_end_ = row_end;
+}
+
+bool PIRServer::is_shard() const {
+  return row_begin_ != 0 || row_end_ != pir_params_.nvec[0];
+}
+
+vector<Ciphertext> PIRServer::generate_partial_reply(PirQuery &query,
+                                                     uint32_t client_id) {
+  if (!is_db_preprocessed_) {
+    preprocess_database();
+  }
+  PhaseTimer timer(metrics_, PHASE_REQUEST);
+  metrics_.add(COUNT_REQUESTS);
+  MemoryPoolHandle pool = MemoryPoolHandle::New();
+
+  uint64_t product = 1;
+  for (uint32_t i = 0; i < pir_params_.nvec.size(); i++) {
+    product *= pir_params_.nvec[i];
+  }
+
+  vector<Ciphertext> expanded_query =
+      expand_dimension(query, 0, client_id, pool);
+  return multiply_dimension(expanded_query, *db_,
+                            product / pir_params_.nvec[0], row_begin_,
+                            row_end_, nullptr, nullptr, pool,
+                            compact_database());
+}
+
+PirReply
+PIRServer::merge_partial_replies(vector<vector<Ciphertext>> &partial_replies,
+                                 PirQuery &query, uint32_t client_id) {
+  if (partial_replies.empty()) {
+    throw invalid_argument("no partial replies to merge");
+  }
+
+  vector<Ciphertext> merged = move(partial_replies[0]);
+  for (size_t s = 1; s < partial_replies.size(); s++) {
+    if (partial_replies[s].size() != merged.size()) {
+      throw invalid_argument("partial replies have different sizes");
+    }
+    for (size_t k = 0; k < merged.size(); k++) {
+      evaluator_->add_inplace(merged[k], partial_replies[s][k]);
+    }
+  }
+
+  return finish_reply(merged, query, client_id, nullptr, nullptr,
+                      MemoryPoolHandle::New());
 }
 
 inline vector<Ciphertext> PIRServer::expand_query(const Ciphertext &encrypted,
                                                   uint32_t m,
-                                                  uint32_t client_id) {
+                                                  uint32_t client_id,
+                                                  MemoryPoolHandle pool) {
 
-  GaloisKeys &galkey = galoisKeys_[client_id];
+  // hold a reference so a concurrent key upload cannot free it mid-query
+  shared_ptr<const GaloisKeys> galkey_ref = get_galois_key(client_id);
+  const GaloisKeys &galkey = *galkey_ref;
 
   // Assume that m is a power of 2. If not, round it to the next power of 2.
   uint32_t logm = ceil(log2(m));
@@ -322,15 +941,15 @@ inline vector<Ciphertext> PIRServer::expand_query(const Ciphertext &encrypted,
                           exponentiate_uint(2, i));
   }
 
+  uint64_t galois_count = 0;
   vector<Ciphertext> temp;
-  temp.push_back(encrypted);
-  Ciphertext tempctxt;
-  Ciphertext tempctxt_rotated;
-  Ciphertext tempctxt_shifted;
-  Ciphertext tempctxt_rotatedshifted;
+  temp.emplace_back(encrypted, pool);
+  Ciphertext tempctxt_rotated(pool);
+  Ciphertext tempctxt_shifted(pool);
+  Ciphertext tempctxt_rotatedshifted(pool);
 
   for (uint32_t i = 0; i < logm - 1; i++) {
-    vector<Ciphertext> newtemp(temp.size() << 1);
+    vector<Ciphertext> newtemp = make_ciphertexts(temp.size() << 1, pool);
     // temp[a] = (j0 = a (mod 2**i) ? ) : Enc(x^{j0 - a}) else Enc(0).  With
     // some scaling....
     int index_raw = (n << 1) - (1 << i);
@@ -338,8 +957,9 @@ inline vector<Ciphertext> PIRServer::expand_query(const Ciphertext &encrypted,
 
     for (uint32_t a = 0; a < temp.size(); a++) {
 
+      galois_count++;
       evaluator_->apply_galois(temp[a], galois_elts[i], galkey,
-                               tempctxt_rotated);
+                               tempctxt_rotated, pool);
 
       // cout << "rotate " <<
       // client.decryptor_->invariant_noise_budget(tempctxt_rotated) << ", ";
@@ -360,7 +980,7 @@ inline vector<Ciphertext> PIRServer::expand_query(const Ciphertext &encrypted,
       evaluator_->add(tempctxt_shifted, tempctxt_rotatedshifted,
                       newtemp[a + temp.size()]);
     }
-    temp = newtemp;
+    temp = move(newtemp);
     /*
     cout << "end: ";
     for (int h = 0; h < temp.size();h++){
@@ -370,17 +990,18 @@ inline vector<Ciphertext> PIRServer::expand_query(const Ciphertext &encrypted,
     */
   }
   // Last step of the loop
-  vector<Ciphertext> newtemp(temp.size() << 1);
+  vector<Ciphertext> newtemp = make_ciphertexts(temp.size() << 1, pool);
   int index_raw = (n << 1) - (1 << (logm - 1));
   int index = (index_raw * galois_elts[logm - 1]) % (n << 1);
   for (uint32_t a = 0; a < temp.size(); a++) {
     if (a >= (m - (1 << (logm - 1)))) { // corner case.
-      evaluator_->multiply_plain(temp[a], two,
-                                 newtemp[a]); // plain multiplication by 2.
+      evaluator_->multiply_plain(temp[a], two, newtemp[a],
+                                 pool); // plain multiplication by 2.
       // cout << client.decryptor_->invariant_noise_budget(newtemp[a]) << ", ";
     } else {
+      galois_count++;
       evaluator_->apply_galois(temp[a], galois_elts[logm - 1], galkey,
-                               tempctxt_rotated);
+                               tempctxt_rotated, pool);
       evaluator_->add(temp[a], tempctxt_rotated, newtemp[a]);
       multiply_power_of_X(temp[a], tempctxt_shifted, index_raw);
       multiply_power_of_X(tempctxt_rotated, tempctxt_rotatedshifted, index);
@@ -389,11 +1010,11 @@ inline vector<Ciphertext> PIRServer::expand_query(const Ciphertext &encrypted,
     }
   }
 
-  vector<Ciphertext>::const_iterator first = newtemp.begin();
-  vector<Ciphertext>::const_iterator last = newtemp.begin() + m;
-  vector<Ciphertext> newVec(first, last);
+  // keep the first m in place: copies would leave the pool
+  newtemp.resize(m);
 
-  return newVec;
+  metrics_.add(COUNT_APPLY_GALOIS, galois_count);
+  return newtemp;
 }
 
 inline void PIRServer::multiply_power_of_X(const Ciphertext &encrypted,
@@ -423,6 +1044,9 @@ inline void PIRServer::multiply_power_of_X(const Ciphertext &encrypted,
 }
 
 void PIRServer::simple_set(uint64_t index, Plaintext pt) {
+  if (compact_database()) {
+    throw logic_error("a compact database cannot be modified in place");
+  }
   if (is_db_preprocessed_) {
     evaluator_->transform_to_ntt_inplace(pt, context_->first_parms_id());
   }
@@ -432,8 +1056,15 @@ void PIRServer::simple_set(uint64_t index, Plaintext pt) {
 Ciphertext PIRServer::simple_query(uint64_t index) {
   // There is no transform_from_ntt that takes a plaintext
   Ciphertext ct;
-  Plaintext pt = db_->operator[](index);
-  evaluator_->multiply_plain(one_, pt, ct);
+  Plaintext pt;
+  if (compact_database()) {
+    if (!compact_db_[index].empty()) {
+      unpack_plaintext(compact_db_[index], pt, MemoryManager::GetPool());
+    }
+  } else {
+    pt = db_->operator[](index);
+  }
+  evaluator_->multiply_plain(one_, is_padding(pt) ? padding_plain_ : pt, ct);
   evaluator_->transform_from_ntt_inplace(ct);
   return ct;
 }
@@ -447,86 +1078,134 @@ void PIRServer::set_one_ct(Ciphertext one) {
     Above are the codes of SealPIR; below are the new codes for the current project.
  */
 
+vector<uint64_t> PIRServer::gen_rand_shares(uint32_t party_count) {
+    if (party_count < 2) {
+        throw invalid_argument("masking needs at least two parties");
+    }
+    // party_count - 1 randoms under plain modulus; the first share cancels them.
+    const Modulus &mod = enc_params_.plain_modulus();
+    vector<uint64_t> shares(party_count, 0);
+    for (uint32_t i = 1; i < party_count; i++) {
+        shares[i] = uniform_mod(*trio_prng_, mod.value());
+        shares[0] = sub_uint_mod(shares[0], shares[i], mod);
+    }
+    return shares;
+}
+
 void PIRServer::gen_rand_trio(uint64_t &dest_rand1, uint64_t &dest_rand2, uint64_t &dest_rand3) {
-    auto now = chrono::system_clock::now();
-    auto timestamp = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()).count();
-    mt19937 gen(static_cast<uint64_t>(timestamp));
-    uniform_int_distribution<uint64_t> dis(1, numeric_limits<uint64_t>::max());
-
-    // generate two randoms under plain modulus.
-    uint64_t mod = enc_params_.plain_modulus().value();
-    dest_rand1 = dis(gen) % mod;
-    dest_rand2 = dis(gen) % mod;
-    dest_rand3 = (2 * mod - dest_rand1 - dest_rand2) % mod;
+    vector<uint64_t> shares = gen_rand_shares(3);
+    dest_rand1 = shares[1];
+    dest_rand2 = shares[2];
+    dest_rand3 = shares[0];
     // cout << "Server: r1+r2+r3: " << dest_rand1 + dest_rand2 + dest_rand3 << endl;
     // cout << "Server: Modulus in `gen_rand_trio` is: " << mod << endl;
     // cout << "Server: r1+r2+r3 (mod plain_modulus): " << (dest_rand1+dest_rand2+dest_rand3) % mod << endl;
 }
 
-void PIRServer::output_rand_vec_to_send(vector<uint64_t> &rand_vec_to_send1, vector<uint64_t> &rand_vec_to_send2) {
-    // rand_vec_to_send1 = rand_vec_to_send1_;
-    // rand_vec_to_send2 = rand_vec_to_send2_;
-    rand_vec_to_send1.resize(rand_vec_to_send1_.size());
-    rand_vec_to_send2.resize(rand_vec_to_send2_.size());
-    copy(rand_vec_to_send1_.begin(), rand_vec_to_send1_.end(), rand_vec_to_send1.begin());
-    copy(rand_vec_to_send2_.begin(), rand_vec_to_send2_.end(), rand_vec_to_send2.begin());
+vector<MaskSeed> PIRServer::output_mask_seeds() const {
+    if (!is_mask_host_) {
+        throw logic_error("mask seeds were not drawn by this server");
+    }
+    return mask_seeds_;
 }
 
-void PIRServer::set_rand_vec_to_use(vector<uint64_t> &rand_vec_to_use) {
-    rand_vec_to_use_.resize(rand_vec_to_use.size());
-    copy(rand_vec_to_use.begin(), rand_vec_to_use.end(), rand_vec_to_use_.begin());
+void PIRServer::output_mask_seeds(MaskSeed &seed_to_send1, MaskSeed &seed_to_send2) const {
+    vector<MaskSeed> seeds = output_mask_seeds();
+    if (seeds.size() != 2) {
+        throw logic_error("mask seeds were drawn for " +
+                          to_string(seeds.size() + 1) + " parties");
+    }
+    seed_to_send1 = seeds[0];
+    seed_to_send2 = seeds[1];
+}
+
+void PIRServer::set_mask_seed(const MaskSeed &seed) {
+    mask_streams_.clear();
+    mask_streams_.emplace_back(seed, enc_params_.plain_modulus());
+    is_mask_host_ = false;
     is_refreshed_ = true;
 }
 
-Plaintext PIRServer::gen_rand_pt(uint64_t rand_num) {
+uint64_t PIRServer::next_mask() {
+    if (mask_streams_.empty()) {
+        throw logic_error("no mask seed is set");
+    }
+    if (!is_mask_host_) {
+        return mask_streams_[0].next();
+    }
+    const Modulus &mod = enc_params_.plain_modulus();
+    uint64_t mask = 0;
+    for (auto &stream : mask_streams_) {
+        mask = sub_uint_mod(mask, stream.next(), mod);
+    }
+    return mask;
+}
+
+Plaintext PIRServer::encode_mask_template() {
     uint32_t logt = floor(log2(enc_params_.plain_modulus().value()));
     uint32_t N = enc_params_.poly_modulus_degree();
     uint64_t ele_per_ptxt = pir_params_.elements_per_plaintext;
     uint64_t ele_size = pir_params_.ele_size;
     uint64_t coeff_per_ele = coefficients_per_element(logt, ele_size);
-    uint64_t coeff_per_ptxt = ele_per_ptxt * coeff_per_ele;
+    uint64_t coeff_per_ptxt = coefficients_per_ptxt(pir_params_, logt);
     assert(coeff_per_ptxt <= N);
 
     // The coefficients of the elements that will be packed in random plaintext.
     vector<uint64_t> coefficients(coeff_per_ptxt);
-    vector<uint64_t> padding(coeff_per_ele-1, 0);
-    for (uint64_t i = 0UL; i < ele_per_ptxt; i ++) {
-        copy(padding.begin(), padding.end(), 
-                coefficients.begin() + coeff_per_ele * i);
-        coefficients[(i + 1) * coeff_per_ele - 1] = rand_num;
+    if (pir_params_.enable_dense_packing) {
+        // elements share coefficients, so every coefficient is masked
+        fill(coefficients.begin(), coefficients.end(), 1);
+    } else {
+        vector<uint64_t> padding(coeff_per_ele-1, 0);
+        for (uint64_t i = 0UL; i < ele_per_ptxt; i ++) {
+            copy(padding.begin(), padding.end(), 
+                    coefficients.begin() + coeff_per_ele * i);
+            coefficients[(i + 1) * coeff_per_ele - 1] = 1;
+        }
     }
-    Plaintext rand_pt;
-    encoder_->encode(coefficients, rand_pt);
+    Plaintext template_pt;
+    encoder_->encode(coefficients, template_pt);
 
-    return rand_pt;
+    return template_pt;
 }
 
-void PIRServer::refresh_and_set_rand_vec(size_t batch_query_size) {
-    uint64_t r1, r2, r3;
-    uint64_t mod = enc_params_.plain_modulus().value();
-    rand_vec_to_send1_.clear();
-    rand_vec_to_send2_.clear();
-
-    for (size_t i = 0; i < batch_query_size; i ++) {
-        gen_rand_trio(r1, r2, r3);
-        rand_vec_to_send1_.push_back(r1);
-        rand_vec_to_send2_.push_back(r2);
-        rand_vec_to_use_.push_back(r3);
+Plaintext PIRServer::gen_rand_pt(uint64_t rand_num) {
+    // encoding is linear mod t, so scaling the encoded template equals
+    // encoding the scaled slots
+    const Modulus &t = enc_params_.plain_modulus();
+    uint64_t scalar = barrett_reduce_64(rand_num, t);
+    Plaintext rand_pt(mask_template_.coeff_count());
+    for (size_t i = 0; i < mask_template_.coeff_count(); i++) {
+        rand_pt[i] = multiply_uint_mod(mask_template_[i], scalar, t);
     }
 
+    return rand_pt;
+}
+
+void PIRServer::refresh_mask_seeds(uint32_t party_count) {
+    if (party_count < 2) {
+        throw invalid_argument("masking needs at least two parties");
+    }
+    mask_seeds_.clear();
+    mask_streams_.clear();
+    for (uint32_t i = 1; i < party_count; i++) {
+        mask_seeds_.push_back(random_mask_seed());
+        mask_streams_.emplace_back(mask_seeds_.back(), enc_params_.plain_modulus());
+    }
+    is_mask_host_ = true;
     is_refreshed_ = true;
 }
 
 vector<PirReply> PIRServer::gen_batch_reply(vector<PirQuery> &batch_pir_query, uint32_t client_id){
     vector<PirReply> batch_pir_reply;
     if (!is_refreshed_) {
-        cout << "Server: The random number vector is not set yet!" << endl;
+        cout << "Server: The mask seed is not set yet!" << endl;
         return batch_pir_reply;
     }
 
     for (size_t i = 0; i < batch_pir_query.size(); i++) {
-        uint64_t random_number = rand_vec_to_use_[i];
-        PirReply reply = generate_reply_with_add_confusion(batch_pir_query[i], client_id, i);
+        uint64_t random_number = next_mask();
+        PirReply reply = generate_reply_with_add_confusion(batch_pir_query[i], client_id, random_number);
         batch_pir_reply.push_back(reply);
     }
 
@@ -536,132 +1215,12 @@ vector<PirReply> PIRServer::gen_batch_reply(vector<PirQuery> &batch_pir_query, u
 }
 
 PirReply PIRServer::generate_reply_with_add_confusion(PirQuery &query, uint32_t client_id, uint64_t rand_num) {
-  vector<uint64_t> nvec = pir_params_.nvec;
-  uint64_t product = 1;
-
-  for (uint32_t i = 0; i < nvec.size(); i++) {
-    product *= nvec[i];
+  if (rand_num % enc_params_.plain_modulus().value() == 0) {
+    // a zero mask would make multiply_plain produce transparent ciphertexts
+    return generate_reply_impl(query, client_id, nullptr, nullptr);
   }
-
-  auto coeff_count = enc_params_.poly_modulus_degree();
-
-  vector<Plaintext> *cur = db_.get();
-  vector<Plaintext> intermediate_plain; // decompose....
   Plaintext rand_pt = gen_rand_pt(rand_num);
   evaluator_->transform_to_ntt_inplace(rand_pt, context_->first_parms_id());
 
-  auto pool = MemoryManager::GetPool();
-
-  int N = enc_params_.poly_modulus_degree();
-
-  int logt = floor(log2(enc_params_.plain_modulus().value()));
-
-  for (uint32_t i = 0; i < nvec.size(); i++) {
-    // cout << "Server: " << i + 1 << "-th recursion level started " << endl;
-
-    vector<Ciphertext> expanded_query;
-
-    uint64_t n_i = nvec[i];
-    // cout << "Server: n_i = " << n_i << endl;
-    // cout << "Server: expanding " << query[i].size() << " query ctxts" << endl;
-    for (uint32_t j = 0; j < query[i].size(); j++) {
-      uint64_t total = N;
-      if (j == query[i].size() - 1) {
-        total = n_i % N;
-      }
-      // cout << "-- expanding one query ctxt into " << total << " ctxts " << endl;
-      vector<Ciphertext> expanded_query_part =
-          expand_query(query[i][j], total, client_id);
-      expanded_query.insert(
-          expanded_query.end(),
-          make_move_iterator(expanded_query_part.begin()),
-          make_move_iterator(expanded_query_part.end()));
-      expanded_query_part.clear();
-    }
-    // cout << "Server: expansion done " << endl;
-    if (expanded_query.size() != n_i) {
-      cout << " size mismatch!!! " << expanded_query.size() << ", " << n_i << endl;
-    }
-
-    // Transform expanded query to NTT, and ...
-    for (uint32_t jj = 0; jj < expanded_query.size(); jj++) {
-      evaluator_->transform_to_ntt_inplace(expanded_query[jj]);
-    }
-
-    // Transform plaintext to NTT. If database is pre-processed, can skip
-    if ((!is_db_preprocessed_) || i > 0) {
-      for (uint32_t jj = 0; jj < cur->size(); jj++) {
-        evaluator_->transform_to_ntt_inplace((*cur)[jj],
-                                             context_->first_parms_id());
-      }
-    }
-
-    for (uint64_t k = 0; k < product; k++) {
-      if ((*cur)[k].is_zero()) {
-        // cout << k + 1 << "/ " << product << "-th ptxt = 0 " << endl;
-      }
-    }
-
-    product /= n_i;
-
-    vector<Ciphertext> intermediateCtxts(product);
-    Ciphertext temp, _temp;
-
-    for (uint64_t k = 0; k < product; k++) {
-      evaluator_->multiply_plain(expanded_query[0], rand_pt, _temp);
-      evaluator_->multiply_plain(expanded_query[0], (*cur)[k],
-                                 intermediateCtxts[k]);
-      evaluator_->add_inplace(intermediateCtxts[k], _temp);
-
-      for (uint64_t j = 1; j < n_i; j++) {
-        evaluator_->multiply_plain(expanded_query[j], (*cur)[k + j * product],
-                                   temp);
-        evaluator_->multiply_plain(expanded_query[j], rand_pt, _temp);
-        evaluator_->add_inplace(intermediateCtxts[k],
-                                temp); // Adds to first component.
-        evaluator_->add_inplace(intermediateCtxts[k], _temp);
-      }
-    }
-
-    for (uint32_t jj = 0; jj < intermediateCtxts.size(); jj++) {
-      evaluator_->transform_from_ntt_inplace(intermediateCtxts[jj]);
-      // print intermediate ctxts?
-      // // cout << "const term of ctxt " << jj << " = " <<
-      // intermediateCtxts[jj][0] << endl;
-    }
-
-    if (i == nvec.size() - 1) {
-      return intermediateCtxts;
-    } else {
-      intermediate_plain.clear();
-      intermediate_plain.reserve(pir_params_.expansion_ratio * product);
-      cur = &intermediate_plain;
-
-      for (uint64_t rr = 0; rr < product; rr++) {
-        EncryptionParameters parms;
-        if (pir_params_.enable_mswitching) {
-          evaluator_->mod_switch_to_inplace(intermediateCtxts[rr],
-                                            context_->last_parms_id());
-          parms = context_->last_context_data()->parms();
-        } else {
-          parms = context_->first_context_data()->parms();
-        }
-
-        vector<Plaintext> plains =
-            decompose_to_plaintexts(parms, intermediateCtxts[rr]);
-
-        for (uint32_t jj = 0; jj < plains.size(); jj++) {
-          intermediate_plain.emplace_back(plains[jj]);
-        }
-      }
-      product = intermediate_plain.size(); // multiply by expansion rate.
-    }
-    // cout << "Server: " << i + 1 << "-th recursion level finished " << endl;
-    // cout << endl;
-  }
-  // cout << "reply generated!  " << endl;
-  // This should never get here
-  assert(0);
-  vector<Ciphertext> fail(1);
-  return fail;
-}
\ No newline at end of file
+  return generate_reply_impl(query, client_id, &rand_pt, nullptr);
+}
@@ -2,33 +2,99 @@
 
 #include "pir.hpp"
 #include "pir_client.hpp"
+#include "pir_mask.hpp"
+#include "pir_metrics.hpp"
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
+// Feeds the streaming database build: fills `chunk` with the next rows of the
+// database (a whole number of elements) and returns false once exhausted.
+typedef std::function<bool(std::vector<std::uint8_t> &chunk)> DatabaseProducer;
+
+// Receives the serialized reply ciphertexts one at a time, in index order,
+// as soon as each is final. count is the total number of reply ciphertexts.
+typedef std::function<void(std::uint64_t index, std::uint64_t count,
+                           const std::string &ciphertext)>
+    ReplySink;
+
 class PIRServer {
 public:
   PIRServer(const seal::EncryptionParameters &enc_params,
             const PirParams &pir_params);
 
   // NOTE: server takes over ownership of db and frees it when it exits.
-  // Caller cannot free db
+  // Caller cannot free db. An empty plaintext in db is a padding plaintext
+  // (see padding_plain_).
   void set_database(std::unique_ptr<std::vector<seal::Plaintext>> &&db);
   void set_database(const std::unique_ptr<const std::uint8_t[]> &bytes,
                     std::uint64_t ele_num, std::uint64_t ele_size);
+  // Plaintexts whose elements are all zero bytes, as the unused ids of a
+  // sparse id space are, are kept as padding plaintexts.
+  // Builds the database in one pass: the producer keeps reading while the
+  // chunks already read are packed, encoded and NTT'd on the worker threads,
+  // and raw bytes are dropped once encoded, so only a few batches of them are
+  // resident at a time. Throws if the producer ends before ele_num elements.
+  // The resulting database is already preprocessed.
+  void set_database(const DatabaseProducer &producer, std::uint64_t ele_num,
+                    std::uint64_t ele_size);
   void preprocess_database();
 
-  std::vector<seal::Ciphertext> expand_query(const seal::Ciphertext &encrypted,
-                                             std::uint32_t m,
-                                             std::uint32_t client_id);
+  // Number of worker threads used to build the database (0 = one per core)
+  void set_num_threads(std::uint32_t num_threads);
+  // Pins those build threads to the given CPUs, so the plaintexts they encode
+  // are first touched, and placed, on the CPUs' NUMA node
+  void set_cpu_affinity(std::vector<std::uint32_t> cpus);
+  // Folds the recursion levels after the first one piece by piece: each
+  // intermediate ciphertext is decomposed, transformed and accumulated into
+  // the next level's ciphertexts before the next one is decomposed, so the
+  // expanded plaintexts of a whole level are never resident at once
+  void set_chunked_recursion(bool enabled);
+  // Keeps the plaintexts of a database built from bytes bit-packed in
+  // coefficient form, at the bit width of t, instead of in NTT form: about
+  // six times less memory, for one forward NTT per occupied plaintext per
+  // reply, done as the scan reaches it. Must be set before set_database.
+  void set_compact_residency(bool enabled);
+
+  // Every ciphertext and temporary of the expansion is allocated from pool
+  std::vector<seal::Ciphertext>
+  expand_query(const seal::Ciphertext &encrypted, std::uint32_t m,
+               std::uint32_t client_id,
+               seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
 
   PirQuery deserialize_query(std::stringstream &stream);
   PirReply generate_reply(PirQuery &query, std::uint32_t client_id);
+  // Same reply, but each ciphertext is mod switched, serialized and handed to
+  // the sink while the rest of the last level is still being computed
+  void generate_reply_streaming(PirQuery &query, std::uint32_t client_id,
+                                const ReplySink &sink);
+
+  // Sharded deployment: the server holds only rows [row_begin, row_end) of
+  // the first dimension. Must be called before set_database, which then
+  // expects the bytes of the elements in shard_element_range.
+  void set_shard(std::uint64_t row_begin, std::uint64_t row_end);
+  bool is_shard() const;
+  // First-dimension result over the rows this server holds; only query[0]
+  // is read
+  std::vector<seal::Ciphertext> generate_partial_reply(PirQuery &query,
+                                                       std::uint32_t client_id);
+  // Coordinator side: adds the shards' partial results and runs the
+  // remaining recursion levels. Needs no database, only the galois key.
+  PirReply
+  merge_partial_replies(std::vector<std::vector<seal::Ciphertext>> &partial_replies,
+                        PirQuery &query, std::uint32_t client_id);
 
   // Serializes the reply into the provided stream and returns the number of
   // bytes written
   int serialize_reply(PirReply &reply, std::stringstream &stream);
 
+  // Operation counts and per-phase latencies of every reply so far
+  PirMetrics &metrics() { return metrics_; }
+
+  // Thread-safe with respect to concurrent generate_reply calls
   void set_galois_key(std::uint32_t client_id, seal::GaloisKeys galkey);
 
   // Below simple operations are for interacting with the database WITHOUT PIR.
@@ -39,11 +105,21 @@ public:
   void set_one_ct(seal::Ciphertext one);
 
   PirReply generate_reply_with_add_confusion(PirQuery &query, std::uint32_t client_id, std::uint64_t rand_num);
+  // Masks the i-th query of the batch with the i-th mask of the current seeds
   std::vector<PirReply> gen_batch_reply(std::vector<PirQuery> &batch_pir_query, std::uint32_t client_id);
-  void refresh_and_set_rand_vec(size_t batch_query_size) ;
+  // Batch masking among party_count servers: the host draws one seed per
+  // peer for each batch and sends each peer its seed; the host's own masks
+  // are minus the sum of the peers', so the masks of every reply cancel mod t.
+  void refresh_mask_seeds(std::uint32_t party_count = 3);
+  // One seed per peer, in party order
+  std::vector<MaskSeed> output_mask_seeds() const;
+  void output_mask_seeds(MaskSeed &seed_to_send1, MaskSeed &seed_to_send2) const;
+  void set_mask_seed(const MaskSeed &seed);
+  // Next mask of the current batch, derived on demand from the seeds
+  std::uint64_t next_mask();
+  // party_count random values that sum to 0 mod t
+  std::vector<std::uint64_t> gen_rand_shares(std::uint32_t party_count);
   void gen_rand_trio(std::uint64_t &dest_rand1, std::uint64_t &dest_rand2, std::uint64_t &dest_rand3);
-  void set_rand_vec_to_use(std::vector<std::uint64_t> &rand_vec_to_use);
-  void output_rand_vec_to_send(std::vector<std::uint64_t> &rand_vec_to_send1, std::vector<std::uint64_t> &rand_vec_to_send2);
   seal::Plaintext gen_rand_pt(std::uint64_t rand_num);
   
 private:
@@ -51,19 +127,128 @@ private:
   PirParams pir_params_;                  // PIR parameters
   std::unique_ptr<Database> db_;
   bool is_db_preprocessed_;
-  std::map<int, seal::GaloisKeys> galoisKeys_;
+  // Keys may be uploaded while other clients' replies are being computed
+  std::map<int, std::shared_ptr<const seal::GaloisKeys>> galoisKeys_;
+  std::mutex galois_keys_mutex_;
   std::unique_ptr<seal::Evaluator> evaluator_;
   std::unique_ptr<seal::BatchEncoder> encoder_;
   std::shared_ptr<seal::SEALContext> context_;
 
-  std::vector<std::uint64_t> rand_vec_to_send1_;
-  std::vector<std::uint64_t> rand_vec_to_send2_;
-  std::vector<std::uint64_t> rand_vec_to_use_;
+  std::vector<MaskSeed> mask_seeds_; // seeds the host sends to its peers
+  std::vector<MaskStream> mask_streams_;
+  bool is_mask_host_;
+  std::shared_ptr<seal::UniformRandomGenerator> trio_prng_;
+  // gen_rand_pt(1): every mask plaintext is a multiple of it mod t
+  seal::Plaintext mask_template_;
+  // The plaintext of elements that are all zero bytes, in NTT form. Database
+  // entries left empty stand for it, so sparse regions and the padding that
+  // makes the database a matrix cost no memory, and the scan folds all of a
+  // column's padding terms into one product.
+  seal::Plaintext padding_plain_;
   bool is_refreshed_;
+  std::uint32_t num_threads_;
+  std::vector<std::uint32_t> cpus_;
+  bool chunked_recursion_;
+  bool compact_residency_;
+  // Bit-packed coefficient-form plaintexts of a compact database, in db_
+  // order; an empty entry is a padding plaintext. db_ is then empty.
+  typedef std::vector<std::vector<std::uint64_t>> CompactDatabase;
+  CompactDatabase compact_db_;
+  std::uint64_t row_begin_; // rows of the first dimension held by this server
+  std::uint64_t row_end_;
+  PirMetrics metrics_;
+  // Splits the ciphertexts between recursion levels
+  DecompositionPlan decomposition_plan_;
+  // Gadget digits of the RGSW external product, at the first data level
+  DecompositionPlan folding_plan_;
 
   // This is only used for simple_query
   seal::Ciphertext one_;
 
+  std::shared_ptr<const seal::GaloisKeys> get_galois_key(std::uint32_t client_id);
+
+  // Called with each ciphertext of the last level as soon as it is done
+  typedef std::function<void(std::uint64_t index, std::uint64_t count,
+                             seal::Ciphertext &ct)>
+      CiphertextSink;
+
+  // Each request allocates from its own memory pool, so concurrent replies
+  // do not contend on the global pool's lock; the pool and everything in it
+  // are freed together once the reply is released.
+  PirReply generate_reply_impl(PirQuery &query, std::uint32_t client_id,
+                               const seal::Plaintext *mask,
+                               const CiphertextSink *emit);
+  // Expands the query ciphertexts of dimension i and transforms them to NTT
+  std::vector<seal::Ciphertext> expand_dimension(PirQuery &query, std::uint32_t i,
+                                                 std::uint32_t client_id,
+                                                 const seal::MemoryPoolHandle &pool);
+  // Folds one dimension over rows [row_begin, row_end); the result is out of
+  // NTT form
+  std::vector<seal::Ciphertext>
+  multiply_dimension(const std::vector<seal::Ciphertext> &expanded_query,
+                     const std::vector<seal::Plaintext> &cur, std::uint64_t product,
+                     std::uint64_t row_begin, std::uint64_t row_end,
+                     const seal::Plaintext *mask, const CiphertextSink *emit,
+                     const seal::MemoryPoolHandle &pool,
+                     const CompactDatabase *compact = nullptr);
+  // Folds dimension i (> 0) directly from the previous level's ciphertexts,
+  // which are consumed; the result is out of NTT form
+  std::vector<seal::Ciphertext>
+  fold_dimension_chunked(std::vector<seal::Ciphertext> &previous,
+                         const std::vector<seal::Ciphertext> &expanded_query,
+                         std::uint32_t i, const seal::Plaintext *mask,
+                         const CiphertextSink *emit,
+                         const seal::MemoryPoolHandle &pool);
+  // Folds dimension i (> 0) with a CMux tree over the RGSW encrypted bits of
+  // its index, so each output is one previous ciphertext rather than the
+  // pieces of one; the previous ciphertexts are consumed
+  std::vector<seal::Ciphertext>
+  fold_dimension_rgsw(std::vector<seal::Ciphertext> &previous,
+                      const std::vector<seal::Ciphertext> &rgsw_bits,
+                      std::uint32_t i, const CiphertextSink *emit,
+                      const seal::MemoryPoolHandle &pool);
+  // ct times the bit encrypted by rows, out of NTT form; digits is scratch
+  // space of rgsw_ciphertexts_per_bit plaintexts
+  void external_product(const seal::Ciphertext &ct, const seal::Ciphertext *rows,
+                        std::vector<seal::Plaintext> &digits,
+                        seal::Ciphertext &destination,
+                        const seal::MemoryPoolHandle &pool);
+  seal::Ciphertext sum_selectors(const std::vector<seal::Ciphertext> &expanded_query,
+                                 std::uint64_t row_begin, std::uint64_t row_end,
+                                 const seal::MemoryPoolHandle &pool);
+  // The mask term every output of a dimension receives:
+  // sum_j expanded_query[j] * mask over rows [row_begin, row_end), computed
+  // as one product of the summed selectors
+  seal::Ciphertext mask_dimension(const std::vector<seal::Ciphertext> &expanded_query,
+                                  std::uint64_t row_begin, std::uint64_t row_end,
+                                  const seal::Plaintext &mask,
+                                  const seal::MemoryPoolHandle &pool);
+  // Runs the recursion levels after the first dimension
+  PirReply finish_reply(std::vector<seal::Ciphertext> &first_dimension,
+                        PirQuery &query, std::uint32_t client_id,
+                        const seal::Plaintext *mask,
+                        const CiphertextSink *emit,
+                        const seal::MemoryPoolHandle &pool);
+
+  // Mask plaintext for rand_num = 1: one at the last slot of every element
+  seal::Plaintext encode_mask_template();
+
+  // Packs ele_in_chunk elements starting at bytes into a plaintext, in NTT
+  // form unless ntt is false
+  void encode_plaintext(const std::uint8_t *bytes, std::uint64_t ele_in_chunk,
+                        std::uint64_t ele_size, seal::Plaintext &plain,
+                        bool ntt = true);
+
+  // compact_db_, or null if the database is held in NTT form
+  const CompactDatabase *compact_database() const;
+  std::uint64_t compact_words() const;
+  void pack_plaintext(const seal::Plaintext &plain,
+                      std::vector<std::uint64_t> &words);
+  // Unpacks words into plain and transforms it to NTT form
+  void unpack_plaintext(const std::vector<std::uint64_t> &words,
+                        seal::Plaintext &plain,
+                        const seal::MemoryPoolHandle &pool);
+
   void multiply_power_of_X(const seal::Ciphertext &encrypted,
                            seal::Ciphertext &destination, std::uint32_t index);
 };
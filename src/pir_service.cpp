@@ -0,0 +1,541 @@
+#include "pir_service.hpp"
+#include "net.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace seal;
+
+// epoll user data of the two internal descriptors; connections count from 2
+static const uint64_t kListenId = 0;
+static const uint64_t kWakeId = 1;
+
+// Upper bound on a serialized galois key or query upload. SEAL may compress
+// them, so the uncompressed size plus some header room is always enough.
+static uint64_t max_request_size(const EncryptionParameters &enc_params,
+                                 const PirParams &pir_params) {
+  const uint64_t slack = 1024; // per-object serialization header
+  uint64_t N = enc_params.poly_modulus_degree();
+  uint64_t k = enc_params.coeff_modulus().size();
+  uint64_t ct_size = 2 * N * k * sizeof(uint64_t) + slack;
+
+  // one key per power of two, each with a key-switching ciphertext per
+  // data-level prime
+  uint64_t galois_size = util::get_power_of_two(N) * (k - 1) * ct_size + slack;
+
+  uint64_t query_size = sizeof(uint64_t);
+  for (uint32_t i = 0; i < pir_params.d; i++) {
+    uint64_t cts = (pir_params.nvec[i] + N - 1) / N;
+    if (pir_params.enable_rgsw_folding && i > 0) {
+      cts = folding_bits(pir_params.nvec[i]) * rgsw_ciphertexts_per_bit(enc_params);
+    }
+    query_size += sizeof(uint64_t) + cts * ct_size;
+  }
+  // the slack also covers the client and request ids
+  return max(galois_size, query_size) + slack;
+}
+
+PIRService::PIRService(PIRServer &server, const EncryptionParameters &enc_params,
+                       const PirParams &pir_params, uint32_t num_workers)
+    : server_(server), context_(enc_params, true), listen_fd_(-1),
+      epoll_fd_(-1), wake_fd_(-1), stopping_(false),
+      max_frame_size_(max_request_size(enc_params, pir_params)),
+      max_in_flight_(8), max_connections_(1024), next_connection_id_(2),
+      workers_(num_workers) {
+  // replies are computed concurrently, so the database must not be
+  // transformed lazily by the first query
+  server_.preprocess_database();
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || wake_fd_ < 0) {
+    throw runtime_error("service: cannot create epoll/eventfd");
+  }
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = kWakeId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+}
+
+PIRService::~PIRService() {
+  for (auto &entry : connections_) {
+    tcp_close(entry.second.fd);
+  }
+  tcp_close(listen_fd_);
+  tcp_close(wake_fd_);
+  tcp_close(epoll_fd_);
+}
+
+void PIRService::set_max_in_flight(uint32_t max_in_flight) {
+  if (max_in_flight == 0) {
+    throw invalid_argument("max_in_flight must be positive");
+  }
+  max_in_flight_ = max_in_flight;
+}
+
+void PIRService::set_max_connections(uint32_t max_connections) {
+  max_connections_ = max_connections;
+}
+
+uint16_t PIRService::listen(const string &host, uint16_t port) {
+  listen_fd_ = tcp_listen(host, port, 1024);
+  fcntl(listen_fd_, F_SETFL, fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = kListenId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+  return tcp_local_port(listen_fd_);
+}
+
+void PIRService::run() {
+  const int max_events = 64;
+  epoll_event events[max_events];
+
+  while (!stopping_) {
+    int n = epoll_wait(epoll_fd_, events, max_events, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw runtime_error("service: epoll_wait failed");
+    }
+
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kListenId) {
+        accept_connections();
+      } else if (id == kWakeId) {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) > 0) {
+        }
+        drain_completed();
+      } else {
+        if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+          close_connection(id);
+          continue;
+        }
+        if (events[i].events & EPOLLIN) {
+          read_connection(id);
+        }
+        if ((events[i].events & EPOLLOUT) && connections_.count(id)) {
+          write_connection(id);
+        }
+      }
+    }
+  }
+}
+
+void PIRService::stop() {
+  stopping_ = true;
+  wake();
+}
+
+void PIRService::wake() {
+  uint64_t one = 1;
+  ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+  (void)ignored;
+}
+
+void PIRService::accept_connections() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // EAGAIN: backlog drained; anything else is a per-connection failure
+      return;
+    }
+    if (connections_.size() >= max_connections_) {
+      tcp_close(fd);
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    uint64_t id = next_connection_id_++;
+    Connection &conn = connections_[id];
+    conn.fd = fd;
+    conn.events = EPOLLIN;
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+void PIRService::read_connection(uint64_t id) {
+  Connection &conn = connections_[id];
+  char buffer[1 << 16];
+
+  while (true) {
+    // hand every complete frame to the workers while under the limit
+    size_t pos = 0;
+    while (conn.in_flight < max_in_flight_ &&
+           conn.in.size() - pos >= kFrameHeaderSize) {
+      size_t field = pos + 1;
+      uint64_t size = get_u64(conn.in, field);
+      if (size > max_frame_size_) {
+        close_connection(id);
+        return;
+      }
+      if (conn.in.size() - pos - kFrameHeaderSize < size) {
+        break;
+      }
+      uint8_t type = static_cast<uint8_t>(conn.in[pos]);
+      dispatch(id, type, conn.in.substr(pos + kFrameHeaderSize, size));
+      pos += kFrameHeaderSize + size;
+    }
+    conn.in.erase(0, pos);
+
+    // at the limit, leave the rest in the socket until replies drain
+    if (conn.in_flight >= max_in_flight_) {
+      break;
+    }
+    ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      conn.in.append(buffer, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    // peer closed or socket error
+    close_connection(id);
+    return;
+  }
+  update_events(id);
+}
+
+void PIRService::write_connection(uint64_t id) {
+  Connection &conn = connections_[id];
+
+  while (conn.out_pos < conn.out.size()) {
+    ssize_t n = send(conn.fd, conn.out.data() + conn.out_pos,
+                     conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+    if (n > 0) {
+      conn.out_pos += n;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    close_connection(id);
+    return;
+  }
+
+  if (conn.out_pos == conn.out.size()) {
+    conn.out.clear();
+    conn.out_pos = 0;
+  }
+  update_events(id);
+}
+
+void PIRService::update_events(uint64_t id) {
+  Connection &conn = connections_[id];
+  uint32_t events = 0;
+  if (conn.in_flight < max_in_flight_) {
+    events |= EPOLLIN;
+  }
+  if (conn.out_pos < conn.out.size()) {
+    events |= EPOLLOUT;
+  }
+  if (events != conn.events) {
+    epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.events = events;
+  }
+}
+
+void PIRService::close_connection(uint64_t id) {
+  auto it = connections_.find(id);
+  if (it == connections_.end()) {
+    return;
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+  tcp_close(it->second.fd);
+  connections_.erase(it);
+
+  // the client ids become free to be claimed by a new connection
+  for (auto owner = key_owners_.begin(); owner != key_owners_.end();) {
+    if (owner->second == id) {
+      owner = key_owners_.erase(owner);
+    } else {
+      ++owner;
+    }
+  }
+}
+
+void PIRService::drain_completed() {
+  vector<Completed> completed;
+  {
+    lock_guard<mutex> lock(completed_mutex_);
+    completed.swap(completed_);
+  }
+  for (auto &entry : completed) {
+    auto it = connections_.find(entry.id);
+    if (it == connections_.end()) {
+      continue; // the client went away while its request was running
+    }
+    it->second.out.append(entry.frame);
+    write_connection(entry.id);
+    if (!entry.last || !connections_.count(entry.id)) {
+      continue;
+    }
+    // frames may be waiting in the buffer for the slot just freed
+    connections_[entry.id].in_flight--;
+    read_connection(entry.id);
+  }
+}
+
+void PIRService::complete(uint64_t id, uint8_t type, const string &payload,
+                          bool last) {
+  string frame = frame_header(type, payload.size());
+  frame.append(payload);
+  {
+    lock_guard<mutex> lock(completed_mutex_);
+    completed_.push_back({id, move(frame), last});
+  }
+  wake();
+}
+
+void PIRService::fail(uint64_t id, uint64_t request_id, const string &message) {
+  string answer;
+  put_u64(answer, request_id);
+  answer.append(message);
+  complete(id, SERVICE_ERROR, answer);
+}
+
+void PIRService::dispatch(uint64_t id, uint8_t type, string payload) {
+  // counted until its answer is queued in drain_completed, errors included
+  connections_[id].in_flight++;
+
+  uint32_t client_id = 0;
+  uint64_t request_id = 0;
+  try {
+    size_t pos = 0;
+    client_id = get_u32(payload, pos);
+    request_id = get_u64(payload, pos);
+  } catch (const exception &e) {
+    fail(id, request_id, e.what());
+    return;
+  }
+
+  if (type == SERVICE_METRICS) {
+    string answer;
+    put_u64(answer, request_id);
+    answer.append(server_.metrics().prometheus("pir_server"));
+    complete(id, SERVICE_METRICS, answer);
+    return;
+  }
+
+  auto owner = key_owners_.find(client_id);
+  if (type == SERVICE_GALOIS_KEY) {
+    if (owner != key_owners_.end() && owner->second != id) {
+      fail(id, request_id,
+           "client " + to_string(client_id) + " belongs to another connection");
+      return;
+    }
+    key_owners_[client_id] = id;
+  } else if (type == SERVICE_QUERY) {
+    if (owner == key_owners_.end() || owner->second != id) {
+      fail(id, request_id,
+           "no galois key for client " + to_string(client_id) +
+               " on this connection");
+      return;
+    }
+  } else {
+    fail(id, request_id, "unknown message type " + to_string(type));
+    return;
+  }
+
+  workers_.submit([this, id, type, client_id, request_id, payload]() {
+    try {
+      // skip the ids parsed above
+      size_t pos = sizeof(uint32_t) + sizeof(uint64_t);
+      string answer;
+      put_u64(answer, request_id);
+      if (type == SERVICE_GALOIS_KEY) {
+        GaloisKeys galkey;
+        istringstream input(get_bytes(payload, pos));
+        galkey.load(context_, input);
+        server_.set_galois_key(client_id, move(galkey));
+        complete(id, SERVICE_ACK, answer);
+      } else {
+        PirQuery query = deserialize_query(get_bytes(payload, pos), context_);
+        // each ciphertext goes out while the next ones are computed
+        server_.generate_reply_streaming(
+            query, client_id,
+            [&](uint64_t index, uint64_t count, const string &ct) {
+              string part = answer;
+              put_u64(part, index);
+              put_u64(part, count);
+              part.append(ct);
+              complete(id, SERVICE_REPLY_PART, part, index + 1 == count);
+            });
+      }
+    } catch (const exception &e) {
+      fail(id, request_id, e.what());
+    }
+  });
+}
+
+static ReplyPart parse_part(uint64_t request_id, const string &body) {
+  ReplyPart part;
+  size_t pos = 0;
+  part.request_id = request_id;
+  part.index = get_u64(body, pos);
+  part.count = get_u64(body, pos);
+  part.ciphertext = body.substr(pos);
+  return part;
+}
+
+PIRServiceClient::PIRServiceClient(const EncryptionParameters &enc_params,
+                                   const string &host, uint16_t port)
+    : context_(enc_params, true), fd_(tcp_connect(host, port)),
+      next_request_id_(1) {}
+
+PIRServiceClient::~PIRServiceClient() { tcp_close(fd_); }
+
+uint64_t PIRServiceClient::receive(uint8_t &type, string &body) {
+  string payload;
+  if (!recv_frame(fd_, type, payload)) {
+    throw runtime_error("service closed the connection");
+  }
+  size_t pos = 0;
+  uint64_t request_id = get_u64(payload, pos);
+  body = payload.substr(pos);
+  if (type == SERVICE_ERROR) {
+    throw runtime_error("service error (request " + to_string(request_id) +
+                        "): " + body);
+  }
+  return request_id;
+}
+
+void PIRServiceClient::upload_galois_key(uint32_t client_id,
+                                         const GaloisKeys &galkey) {
+  ostringstream output;
+  galkey.save(output);
+  uint64_t request_id = next_request_id_++;
+  string payload;
+  put_u32(payload, client_id);
+  put_u64(payload, request_id);
+  put_bytes(payload, output.str());
+  send_frame(fd_, SERVICE_GALOIS_KEY, payload);
+
+  // replies of queries sent earlier may arrive before the acknowledgement
+  while (true) {
+    uint8_t type;
+    string body;
+    uint64_t id = receive(type, body);
+    if (type == SERVICE_REPLY_PART) {
+      early_parts_.push_back(parse_part(id, body));
+    } else if (id == request_id) {
+      return;
+    }
+  }
+}
+
+uint64_t PIRServiceClient::send_query(uint32_t client_id, const PirQuery &query) {
+  uint64_t request_id = next_request_id_++;
+  string payload;
+  put_u32(payload, client_id);
+  put_u64(payload, request_id);
+  put_bytes(payload, serialize_query(query));
+  send_frame(fd_, SERVICE_QUERY, payload);
+  return request_id;
+}
+
+ReplyPart PIRServiceClient::receive_reply_part() {
+  if (!early_parts_.empty()) {
+    ReplyPart part = move(early_parts_.front());
+    early_parts_.pop_front();
+    return part;
+  }
+  while (true) {
+    uint8_t type;
+    string body;
+    uint64_t request_id = receive(type, body);
+    if (type == SERVICE_REPLY_PART) {
+      return parse_part(request_id, body);
+    }
+  }
+}
+
+uint64_t PIRServiceClient::receive_reply(PirReply &reply) {
+  if (!early_replies_.empty()) {
+    auto it = early_replies_.begin();
+    uint64_t request_id = it->first;
+    reply = move(it->second);
+    early_replies_.erase(it);
+    return request_id;
+  }
+  return assemble_reply(reply);
+}
+
+uint64_t PIRServiceClient::assemble_reply(PirReply &reply) {
+  while (true) {
+    ReplyPart part = receive_reply_part();
+    auto &entry = assembling_[part.request_id];
+    if (entry.first.empty()) {
+      entry.first.resize(part.count);
+    }
+    if (part.index >= entry.first.size()) {
+      throw runtime_error("reply part out of range");
+    }
+    istringstream input(part.ciphertext);
+    entry.first[part.index].load(context_, input);
+    if (++entry.second == entry.first.size()) {
+      reply = move(entry.first);
+      assembling_.erase(part.request_id);
+      return part.request_id;
+    }
+  }
+}
+
+PirReply PIRServiceClient::query(uint32_t client_id, const PirQuery &query) {
+  uint64_t request_id = send_query(client_id, query);
+  // replies of other requests in flight are parked for receive_reply
+  while (true) {
+    PirReply reply;
+    uint64_t id = assemble_reply(reply);
+    if (id == request_id) {
+      return reply;
+    }
+    early_replies_[id] = move(reply);
+  }
+}
+
+string PIRServiceClient::metrics() {
+  uint64_t request_id = next_request_id_++;
+  string payload;
+  put_u32(payload, 0);
+  put_u64(payload, request_id);
+  send_frame(fd_, SERVICE_METRICS, payload);
+
+  while (true) {
+    uint8_t type;
+    string body;
+    uint64_t id = receive(type, body);
+    if (type == SERVICE_REPLY_PART) {
+      early_parts_.push_back(parse_part(id, body));
+    } else if (id == request_id) {
+      return body;
+    }
+  }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "thread_pool.hpp"
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Network front end for a PIRServer. Requests travel in the frames of
+// net.hpp; every request carries a client-chosen request id that is echoed in
+// the answer, so a connection may keep many queries in flight and receive the
+// replies in completion order. Reply ciphertexts are streamed one frame each
+// as the server finishes them.
+enum ServiceMessage : std::uint8_t {
+  SERVICE_GALOIS_KEY = 1, // u32 client id, u64 request id, galois keys
+  SERVICE_QUERY = 2,      // u32 client id, u64 request id, serialized query
+  SERVICE_REPLY_PART = 3, // u64 request id, u64 index, u64 count, ciphertext
+  SERVICE_ACK = 4,        // u64 request id
+  SERVICE_ERROR = 5,      // u64 request id, error message
+  SERVICE_METRICS = 6,    // request: u32 unused, u64 request id;
+                          // answer: u64 request id, Prometheus text
+};
+
+// Event-driven server: one epoll thread does all socket I/O and hands
+// decoded requests to a worker pool that computes the replies.
+class PIRService {
+public:
+  // The server must already hold its database. num_workers == 0 means one
+  // worker per hardware thread.
+  PIRService(PIRServer &server, const seal::EncryptionParameters &enc_params,
+             const PirParams &pir_params, std::uint32_t num_workers = 0);
+  ~PIRService();
+
+  // Requests a connection may have queued or running before the service
+  // stops reading from it (default 8)
+  void set_max_in_flight(std::uint32_t max_in_flight);
+  // Connections beyond this are closed right after accept (default 1024)
+  void set_max_connections(std::uint32_t max_connections);
+
+  // Binds host:port (0 = ephemeral) and returns the bound port
+  std::uint16_t listen(const std::string &host, std::uint16_t port);
+
+  // Runs the event loop on the calling thread until stop() is called
+  void run();
+  // Can be called from any thread
+  void stop();
+
+private:
+  struct Connection {
+    int fd;
+    std::string in;
+    std::string out;
+    std::size_t out_pos = 0;
+    std::uint32_t in_flight = 0;
+    std::uint32_t events = 0; // current epoll interest
+  };
+
+  PIRServer &server_;
+  seal::SEALContext context_;
+  int listen_fd_;
+  int epoll_fd_;
+  int wake_fd_;
+  std::atomic<bool> stopping_;
+  std::uint64_t max_frame_size_; // largest galois key or query upload
+  std::uint32_t max_in_flight_;
+  std::uint32_t max_connections_;
+
+  std::map<std::uint64_t, Connection> connections_;
+  std::uint64_t next_connection_id_;
+  // Each client id belongs to the connection that uploaded its galois key, so
+  // nobody else can replace the key or query with it
+  std::map<std::uint32_t, std::uint64_t> key_owners_;
+
+  // frames finished by the workers, waiting to be queued on their connection
+  std::mutex completed_mutex_;
+  struct Completed {
+    std::uint64_t id;
+    std::string frame;
+    bool last; // the request is finished and leaves the in-flight count
+  };
+  std::vector<Completed> completed_;
+
+  // declared last so the workers are joined before the state they touch goes
+  ThreadPool workers_;
+
+  void accept_connections();
+  void read_connection(std::uint64_t id);
+  void write_connection(std::uint64_t id);
+  void close_connection(std::uint64_t id);
+  void update_events(std::uint64_t id);
+  void drain_completed();
+  void dispatch(std::uint64_t id, std::uint8_t type, std::string payload);
+  void complete(std::uint64_t id, std::uint8_t type, const std::string &payload,
+                bool last = true);
+  void fail(std::uint64_t id, std::uint64_t request_id, const std::string &message);
+  void wake();
+};
+
+struct ReplyPart {
+  std::uint64_t request_id;
+  std::uint64_t index; // position in the reply
+  std::uint64_t count; // number of ciphertexts in the reply
+  std::string ciphertext;
+};
+
+// Blocking client for PIRService
+class PIRServiceClient {
+public:
+  PIRServiceClient(const seal::EncryptionParameters &enc_params,
+                   const std::string &host, std::uint16_t port);
+  ~PIRServiceClient();
+
+  void upload_galois_key(std::uint32_t client_id, const seal::GaloisKeys &galkey);
+
+  // Pipelined use: send any number of queries, then collect the replies in
+  // whatever order the server finishes them
+  std::uint64_t send_query(std::uint32_t client_id, const PirQuery &query);
+  // Blocks until a whole reply has arrived and returns its request id
+  std::uint64_t receive_reply(PirReply &reply);
+  // Streaming use: the next reply ciphertext of any request, e.g. to feed a
+  // PIRReplyDecoder while the rest of the reply is still being computed.
+  // Parts of one request arrive in index order.
+  ReplyPart receive_reply_part();
+
+  // Sends one query and waits for its reply
+  PirReply query(std::uint32_t client_id, const PirQuery &query);
+
+  // The server's metrics in Prometheus text format
+  std::string metrics();
+
+private:
+  seal::SEALContext context_;
+  int fd_;
+  std::uint64_t next_request_id_;
+  std::deque<ReplyPart> early_parts_; // arrived while awaiting an ack
+  std::map<std::uint64_t, std::pair<PirReply, std::uint64_t>> assembling_;
+  // completed while query() was waiting for another request's reply
+  std::map<std::uint64_t, PirReply> early_replies_;
+
+  // Reads one frame; throws if the server reported an error
+  std::uint64_t receive(std::uint8_t &type, std::string &body);
+  // Next whole reply read off the connection, ignoring early_replies_
+  std::uint64_t assemble_reply(PirReply &reply);
+};
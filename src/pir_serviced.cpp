@@ -0,0 +1,61 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_service.hpp"
+
+#include <csignal>
+#include <random>
+#include <seal/seal.h>
+
+using namespace std;
+using namespace seal;
+
+static PIRService *running_service = nullptr;
+
+static void handle_signal(int) {
+    if (running_service) {
+        running_service->stop();
+    }
+}
+
+// Serves a random database over TCP. Clients must be configured with the same
+// parameters: pir_serviced [port] [log2 items] [item size] [workers] [N] [logt] [d]
+int main(int argc, char *argv[]) {
+    uint16_t port = argc > 1 ? stoi(argv[1]) : 7070;
+    uint8_t dim_of_items_number = argc > 2 ? stoi(argv[2]) : 16;
+    uint64_t number_of_items = 1UL << dim_of_items_number;
+    uint64_t size_per_item = argc > 3 ? stoi(argv[3]) : 288; // in bytes
+    uint32_t num_workers = argc > 4 ? stoi(argv[4]) : 0;
+    uint32_t N = argc > 5 ? stoi(argv[5]) : 4096;
+    uint32_t logt = argc > 6 ? stoi(argv[6]) : 20;
+    uint32_t d = argc > 7 ? stoi(argv[7]) : 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+
+    PIRServer server(enc_params, pir_params);
+    server.set_num_threads(num_workers);
+    server.set_database(move(db), number_of_items, size_per_item);
+
+    PIRService service(server, enc_params, pir_params, num_workers);
+    uint16_t bound = service.listen("0.0.0.0", port);
+    cout << "Main: Serving " << number_of_items << " items on port " << bound
+         << endl;
+
+    running_service = &service;
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    service.run();
+    running_service = nullptr;
+    cout << "Main: Service stopped" << endl;
+    return 0;
+}
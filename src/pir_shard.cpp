@@ -0,0 +1,132 @@
+#include "pir_shard.hpp"
+#include "net.hpp"
+
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+
+using namespace std;
+using namespace seal;
+
+vector<pair<uint64_t, uint64_t>> shard_row_ranges(const PirParams &pir_params,
+                                                  uint32_t num_shards) {
+  uint64_t rows = pir_params.nvec[0];
+  if (num_shards == 0 || num_shards > rows) {
+    throw invalid_argument("number of shards must be in [1, nvec[0]]");
+  }
+  vector<pair<uint64_t, uint64_t>> ranges;
+  uint64_t begin = 0;
+  for (uint32_t s = 0; s < num_shards; s++) {
+    uint64_t end = begin + rows / num_shards + (s < rows % num_shards ? 1 : 0);
+    ranges.emplace_back(begin, end);
+    begin = end;
+  }
+  return ranges;
+}
+
+void serve_shard(PIRServer &server, const EncryptionParameters &enc_params,
+                 int listen_fd, uint32_t max_connections) {
+  SEALContext context(enc_params, true);
+
+  for (uint32_t served = 0; max_connections == 0 || served < max_connections;
+       served++) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      throw runtime_error("shard: accept failed");
+    }
+
+    uint8_t type;
+    string payload;
+    while (recv_frame(fd, type, payload)) {
+      try {
+        size_t pos = 0;
+        uint32_t client_id = get_u32(payload, pos);
+        if (type == SHARD_GALOIS_KEY) {
+          GaloisKeys galkey;
+          istringstream input(get_bytes(payload, pos));
+          galkey.load(context, input);
+          server.set_galois_key(client_id, galkey);
+          send_frame(fd, SHARD_ACK, "");
+        } else if (type == SHARD_QUERY) {
+          PirQuery query(1);
+          query[0] = deserialize_ciphertexts(get_bytes(payload, pos), context);
+          vector<Ciphertext> partial =
+              server.generate_partial_reply(query, client_id);
+          send_frame(fd, SHARD_PARTIAL_REPLY, serialize_ciphertexts(partial));
+        } else {
+          throw invalid_argument("unknown message type " + to_string(type));
+        }
+      } catch (const exception &e) {
+        send_frame(fd, SHARD_ERROR, e.what());
+      }
+    }
+    tcp_close(fd);
+  }
+}
+
+ShardCoordinator::ShardCoordinator(
+    const EncryptionParameters &enc_params, const PirParams &pir_params,
+    const vector<pair<string, uint16_t>> &shards) {
+  context_ = make_shared<SEALContext>(enc_params, true);
+  server_ = make_unique<PIRServer>(enc_params, pir_params);
+  for (const auto &shard : shards) {
+    fds_.push_back(tcp_connect(shard.first, shard.second));
+  }
+}
+
+ShardCoordinator::~ShardCoordinator() {
+  for (int fd : fds_) {
+    tcp_close(fd);
+  }
+}
+
+string ShardCoordinator::expect_frame(int fd, uint8_t expected) {
+  uint8_t type;
+  string payload;
+  if (!recv_frame(fd, type, payload)) {
+    throw runtime_error("shard closed the connection");
+  }
+  if (type == SHARD_ERROR) {
+    throw runtime_error("shard error: " + payload);
+  }
+  if (type != expected) {
+    throw runtime_error("unexpected message from shard");
+  }
+  return payload;
+}
+
+void ShardCoordinator::set_galois_key(uint32_t client_id,
+                                      const GaloisKeys &galkey) {
+  ostringstream output;
+  galkey.save(output);
+  string payload;
+  put_u32(payload, client_id);
+  put_bytes(payload, output.str());
+
+  for (int fd : fds_) {
+    send_frame(fd, SHARD_GALOIS_KEY, payload);
+  }
+  for (int fd : fds_) {
+    expect_frame(fd, SHARD_ACK);
+  }
+  server_->set_galois_key(client_id, galkey);
+}
+
+PirReply ShardCoordinator::generate_reply(PirQuery &query, uint32_t client_id) {
+  string payload;
+  put_u32(payload, client_id);
+  // the later dimensions are only used by the coordinator
+  put_bytes(payload, serialize_ciphertexts(query[0]));
+
+  // every shard works on the query concurrently before any reply is read
+  for (int fd : fds_) {
+    send_frame(fd, SHARD_QUERY, payload);
+  }
+  vector<vector<Ciphertext>> partial_replies;
+  for (int fd : fds_) {
+    partial_replies.push_back(deserialize_ciphertexts(
+        expect_frame(fd, SHARD_PARTIAL_REPLY), *context_));
+  }
+
+  return server_->merge_partial_replies(partial_replies, query, client_id);
+}
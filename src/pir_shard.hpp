@@ -0,0 +1,52 @@
+#pragma once
+
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Sharded PIR: the database is split by rows of the first dimension across
+// several server processes. Each shard answers with its partial
+// first-dimension result and the coordinator adds them up and runs the
+// remaining recursion levels.
+
+enum ShardMessage : std::uint8_t {
+  SHARD_GALOIS_KEY = 1, // u32 client id, galois keys
+  SHARD_QUERY = 2,      // u32 client id, first-dimension query ciphertexts
+  SHARD_PARTIAL_REPLY = 3,
+  SHARD_ACK = 4,
+  SHARD_ERROR = 5, // error message
+};
+
+// Splits the first dimension into num_shards contiguous, near-equal row
+// ranges
+std::vector<std::pair<std::uint64_t, std::uint64_t>>
+shard_row_ranges(const PirParams &pir_params, std::uint32_t num_shards);
+
+// Answers coordinator requests on a listening socket, one connection at a
+// time, until max_connections connections have been served (0 = forever)
+void serve_shard(PIRServer &server, const seal::EncryptionParameters &enc_params,
+                 int listen_fd, std::uint32_t max_connections = 0);
+
+class ShardCoordinator {
+public:
+  ShardCoordinator(const seal::EncryptionParameters &enc_params,
+                   const PirParams &pir_params,
+                   const std::vector<std::pair<std::string, std::uint16_t>> &shards);
+  ~ShardCoordinator();
+
+  // Forwards the key to every shard and keeps a copy for the later levels
+  void set_galois_key(std::uint32_t client_id, const seal::GaloisKeys &galkey);
+
+  // Sends the query to all shards at once, then merges their partial replies
+  PirReply generate_reply(PirQuery &query, std::uint32_t client_id);
+
+private:
+  std::shared_ptr<seal::SEALContext> context_;
+  std::unique_ptr<PIRServer> server_;
+  std::vector<int> fds_;
+
+  std::string expect_frame(int fd, std::uint8_t expected);
+};
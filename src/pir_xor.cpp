@@ -0,0 +1,165 @@
+#include "pir_xor.hpp"
+
+#include <seal/randomgen.h>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+using namespace seal;
+
+static uint64_t words_for_bits(uint64_t bits) { return (bits + 63) / 64; }
+
+// XORs rows [row_begin, row_end) selected by each query into its
+// accumulator. The selection bit becomes an all-ones or all-zeros word, so
+// the scan is branch free and every row is read once for all queries.
+static void xor_scan(const uint64_t *rows, uint64_t row_words,
+                     uint64_t row_begin, uint64_t row_end,
+                     const vector<XorQuery> &queries,
+                     vector<vector<uint64_t>> &accumulators) {
+  for (uint64_t r = row_begin; r < row_end; r++) {
+    const uint64_t *row = rows + r * row_words;
+    for (size_t q = 0; q < queries.size(); q++) {
+      const uint64_t mask = 0 - ((queries[q][r >> 6] >> (r & 63)) & 1);
+      uint64_t *acc = accumulators[q].data();
+      for (uint64_t w = 0; w < row_words; w++) {
+        acc[w] ^= row[w] & mask;
+      }
+    }
+  }
+}
+
+XorPirServer::XorPirServer()
+    : ele_num_(0), ele_size_(0), row_words_(0), num_threads_(0) {}
+
+void XorPirServer::set_database(const unique_ptr<const uint8_t[]> &bytes,
+                                uint64_t ele_num, uint64_t ele_size) {
+  if (!bytes || ele_num == 0 || ele_size == 0) {
+    throw invalid_argument("database cannot be empty");
+  }
+  ele_num_ = ele_num;
+  ele_size_ = ele_size;
+  row_words_ = words_for_bits(ele_size * 8);
+  rows_.assign(ele_num * row_words_, 0);
+  for (uint64_t i = 0; i < ele_num; i++) {
+    memcpy(rows_.data() + i * row_words_, bytes.get() + i * ele_size,
+           ele_size);
+  }
+  if (!pool_) {
+    pool_ = make_unique<ThreadPool>(num_threads_);
+  }
+}
+
+void XorPirServer::set_num_threads(uint32_t num_threads) {
+  num_threads_ = num_threads;
+  pool_ = make_unique<ThreadPool>(num_threads_);
+}
+
+XorReply XorPirServer::generate_reply(const XorQuery &query) const {
+  return generate_replies(vector<XorQuery>{query})[0];
+}
+
+vector<XorReply>
+XorPirServer::generate_replies(const vector<XorQuery> &queries) const {
+  if (rows_.empty()) {
+    throw logic_error("database is not set");
+  }
+  for (const auto &query : queries) {
+    if (query.size() != words_for_bits(ele_num_)) {
+      throw invalid_argument("query does not match the database size");
+    }
+  }
+
+  // Each worker scans a contiguous block of rows into its own accumulators
+  uint64_t blocks = min<uint64_t>(pool_->size(), ele_num_);
+  vector<vector<vector<uint64_t>>> partial(
+      blocks, vector<vector<uint64_t>>(queries.size(),
+                                       vector<uint64_t>(row_words_, 0)));
+  pool_->parallel_for(0, blocks, [&](uint64_t b) {
+    xor_scan(rows_.data(), row_words_, ele_num_ * b / blocks,
+             ele_num_ * (b + 1) / blocks, queries, partial[b]);
+  });
+
+  vector<XorReply> replies;
+  for (size_t q = 0; q < queries.size(); q++) {
+    vector<uint64_t> &acc = partial[0][q];
+    for (uint64_t b = 1; b < blocks; b++) {
+      for (uint64_t w = 0; w < row_words_; w++) {
+        acc[w] ^= partial[b][q][w];
+      }
+    }
+    const uint8_t *acc_bytes = reinterpret_cast<const uint8_t *>(acc.data());
+    replies.emplace_back(acc_bytes, acc_bytes + ele_size_);
+  }
+  return replies;
+}
+
+XorReply XorPirServer::generate_reply(const DpfKey &key) const {
+  if (rows_.empty()) {
+    throw logic_error("database is not set");
+  }
+  if (key.domain_bits != dpf_domain_bits(ele_num_)) {
+    throw invalid_argument("DPF key does not match the database size");
+  }
+  return generate_reply(dpf_eval_full(key, ele_num_, *pool_));
+}
+
+XorPirClient::XorPirClient(uint64_t ele_num, uint64_t ele_size,
+                           uint32_t num_servers)
+    : ele_num_(ele_num), ele_size_(ele_size), num_servers_(num_servers) {
+  if (num_servers < 2) {
+    throw invalid_argument("XOR PIR needs at least two servers");
+  }
+}
+
+vector<XorQuery> XorPirClient::generate_query(uint64_t index) {
+  if (index >= ele_num_) {
+    throw invalid_argument("index out of range");
+  }
+  uint64_t words = words_for_bits(ele_num_);
+  auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
+
+  // num_servers - 1 uniformly random vectors; the last one makes the XOR of
+  // all of them the unit vector of index
+  vector<XorQuery> queries(num_servers_, XorQuery(words, 0));
+  XorQuery &last = queries.back();
+  last[index >> 6] = uint64_t(1) << (index & 63);
+  for (uint32_t s = 0; s + 1 < num_servers_; s++) {
+    prng->generate(words * sizeof(uint64_t),
+                   reinterpret_cast<seal_byte *>(queries[s].data()));
+    if (ele_num_ % 64) {
+      // bits past the last element are never read
+      queries[s].back() &= (uint64_t(1) << (ele_num_ % 64)) - 1;
+    }
+    for (uint64_t w = 0; w < words; w++) {
+      last[w] ^= queries[s][w];
+    }
+  }
+  return queries;
+}
+
+vector<DpfKey> XorPirClient::generate_dpf_query(uint64_t index) {
+  if (num_servers_ != 2) {
+    throw logic_error("DPF queries need exactly two servers");
+  }
+  if (index >= ele_num_) {
+    throw invalid_argument("index out of range");
+  }
+  auto keys = dpf_gen(index, dpf_domain_bits(ele_num_));
+  return {keys.first, keys.second};
+}
+
+vector<uint8_t> XorPirClient::decode_reply(const vector<XorReply> &replies) const {
+  if (replies.size() != num_servers_) {
+    throw invalid_argument("expected one reply per server");
+  }
+  vector<uint8_t> element(ele_size_, 0);
+  for (const auto &reply : replies) {
+    if (reply.size() != ele_size_) {
+      throw invalid_argument("reply has the wrong size");
+    }
+    for (uint64_t i = 0; i < ele_size_; i++) {
+      element[i] ^= reply[i];
+    }
+  }
+  return element;
+}
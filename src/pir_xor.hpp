@@ -0,0 +1,67 @@
+#pragma once
+
+#include "pir_dpf.hpp"
+#include "thread_pool.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Information-theoretic PIR over a database replicated on num_servers
+// non-colluding servers. The client sends each server a random selection
+// bit vector; the vectors XOR to the unit vector of the wanted element, so
+// no single server learns anything about it. Each server XORs the selected
+// rows in one pass over the database and the client XORs the replies. No
+// homomorphic operations are involved.
+//
+// With two servers the selection vectors can instead be sent as DPF keys
+// (see pir_dpf.hpp), which are logarithmic in the database size; each server
+// expands its key to the selection vector before the scan.
+
+// Bit i of word i / 64 selects element i
+typedef std::vector<std::uint64_t> XorQuery;
+typedef std::vector<std::uint8_t> XorReply;
+
+class XorPirServer {
+public:
+  XorPirServer();
+
+  // Copies the elements into word-aligned rows
+  void set_database(const std::unique_ptr<const std::uint8_t[]> &bytes,
+                    std::uint64_t ele_num, std::uint64_t ele_size);
+
+  // Worker threads of the scan (0 = one per core); the workers are kept for
+  // the server's lifetime
+  void set_num_threads(std::uint32_t num_threads);
+
+  XorReply generate_reply(const XorQuery &query) const;
+  // Answers all queries in the same pass over the database
+  std::vector<XorReply> generate_replies(const std::vector<XorQuery> &queries) const;
+  // Expands the key over the whole database on the scan workers, then scans
+  XorReply generate_reply(const DpfKey &key) const;
+
+private:
+  std::uint64_t ele_num_;
+  std::uint64_t ele_size_;
+  std::uint64_t row_words_; // ele_size rounded up to whole words
+  std::vector<std::uint64_t> rows_;
+  std::uint32_t num_threads_;
+  std::unique_ptr<ThreadPool> pool_;
+};
+
+class XorPirClient {
+public:
+  XorPirClient(std::uint64_t ele_num, std::uint64_t ele_size,
+               std::uint32_t num_servers);
+
+  // One query per server
+  std::vector<XorQuery> generate_query(std::uint64_t index);
+  // One DPF key per server; needs exactly two servers
+  std::vector<DpfKey> generate_dpf_query(std::uint64_t index);
+  // Replies in any order, one per server
+  std::vector<std::uint8_t> decode_reply(const std::vector<XorReply> &replies) const;
+
+private:
+  std::uint64_t ele_num_;
+  std::uint64_t ele_size_;
+  std::uint32_t num_servers_;
+};
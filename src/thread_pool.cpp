@@ -0,0 +1,112 @@
+#include "thread_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+static void pin_thread(thread &worker, const vector<uint32_t> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (uint32_t cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) {
+      throw invalid_argument("cpu " + to_string(cpu) + " out of range");
+    }
+    CPU_SET(cpu, &set);
+  }
+  int err = pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set);
+  if (err != 0) {
+    throw runtime_error("pthread_setaffinity_np failed: " + to_string(err));
+  }
+}
+
+ThreadPool::ThreadPool(uint32_t num_threads, vector<uint32_t> cpus)
+    : stop_(false) {
+  if (num_threads == 0) {
+    num_threads = cpus.empty() ? max(1U, thread::hardware_concurrency())
+                               : cpus.size();
+  }
+  workers_.reserve(num_threads);
+  for (uint32_t i = 0; i < num_threads; i++) {
+    workers_.emplace_back(&ThreadPool::worker_loop, this);
+    if (cpus.empty()) {
+      continue;
+    }
+    try {
+      pin_thread(workers_.back(), cpus);
+    } catch (...) {
+      shutdown();
+      throw;
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() { shutdown(); }
+
+void ThreadPool::shutdown() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+future<void> ThreadPool::submit(function<void()> task) {
+  packaged_task<void()> packaged(move(task));
+  future<void> result = packaged.get_future();
+  {
+    lock_guard<mutex> lock(mutex_);
+    tasks_.push(move(packaged));
+  }
+  cv_.notify_one();
+  return result;
+}
+
+void ThreadPool::parallel_for(uint64_t begin, uint64_t end,
+                              const function<void(uint64_t)> &fn) {
+  if (begin >= end) {
+    return;
+  }
+  uint64_t total = end - begin;
+  uint64_t blocks = min<uint64_t>(workers_.size(), total);
+  uint64_t block_size = (total + blocks - 1) / blocks;
+
+  vector<future<void>> pending;
+  pending.reserve(blocks);
+  for (uint64_t lo = begin; lo < end; lo += block_size) {
+    uint64_t hi = min(end, lo + block_size);
+    pending.push_back(submit([lo, hi, &fn]() {
+      for (uint64_t i = lo; i < hi; i++) {
+        fn(i);
+      }
+    }));
+  }
+  // wait for every block before rethrowing so no task outlives `fn`
+  for (auto &f : pending) {
+    f.wait();
+  }
+  for (auto &f : pending) {
+    f.get();
+  }
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    packaged_task<void()> task;
+    {
+      unique_lock<mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty()) {
+        return;
+      }
+      task = move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed-size pool of worker threads. Tasks are run in submission order by
+// whichever worker is free; exceptions thrown by a task are delivered through
+// the returned future.
+class ThreadPool {
+public:
+  // num_threads == 0 means one thread per hardware thread, or one per CPU
+  // when cpus is given. With cpus, every worker is pinned to that CPU set.
+  explicit ThreadPool(std::uint32_t num_threads = 0,
+                      std::vector<std::uint32_t> cpus = {});
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::future<void> submit(std::function<void()> task);
+
+  // Runs fn(i) for every i in [begin, end) split into contiguous blocks, one
+  // per worker, and waits for all of them.
+  void parallel_for(std::uint64_t begin, std::uint64_t end,
+                    const std::function<void(std::uint64_t)> &fn);
+
+  std::uint32_t size() const { return workers_.size(); }
+
+private:
+  std::vector<std::thread> workers_;
+  std::queue<std::packaged_task<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+
+  void worker_loop();
+  void shutdown();
+};
@@ -0,0 +1,114 @@
+#include "pir.hpp"
+#include "pir_aggregate.hpp"
+
+#include <seal/seal.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace std::chrono;
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = argc > 1 ? stoull(argv[1]) : (1UL << 14) + 13;
+    uint64_t cohort_size = argc > 2 ? stoull(argv[2]) : 1000;
+    uint64_t size_per_item = 2; // phone count, blacklist byte (1 = not listed)
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+
+    EncryptionParameters enc_params(scheme_type::bfv);
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    uint64_t t = enc_params.plain_modulus().value();
+
+    random_device rd;
+    AggregateClient client(enc_params, number_of_items);
+    GaloisKeys galois_keys = client.generate_galois_keys();
+
+    vector<uint64_t> cohort;
+    for (uint64_t i = 0; i < cohort_size; i++) {
+        cohort.push_back(rd() % number_of_items);
+    }
+    sort(cohort.begin(), cohort.end());
+    cohort.erase(unique(cohort.begin(), cohort.end()), cohort.end());
+    AggregateQuery query = client.generate_query(cohort);
+
+    // three datasets, as in the A + B + C phone count use case; the masks of
+    // the three replies sum to zero mod t
+    uint64_t masks[3] = {rd() % t, rd() % t, 0};
+    masks[2] = (2 * t - masks[0] - masks[1]) % t;
+    uint64_t expected_sum = 0, expected_count = 0;
+    vector<Ciphertext> sum_replies, count_replies;
+    for (uint32_t s = 0; s < 3; s++) {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items; i++) {
+            db.get()[i * size_per_item] = rd() % 16;
+            db.get()[i * size_per_item + 1] = rd() % 10 ? 1 : rd() % 256;
+        }
+        unique_ptr<const uint8_t[]> bytes(move(db));
+        for (uint64_t index : cohort) {
+            expected_sum += bytes.get()[index * size_per_item];
+            expected_count += bytes.get()[index * size_per_item + 1] != 1;
+        }
+
+        AggregateServer sums(enc_params), counts(enc_params);
+        sums.set_database(bytes, number_of_items, size_per_item,
+                          aggregate_field_bytes(0, 1));
+        counts.set_database(bytes, number_of_items, size_per_item,
+                            [](const uint8_t *element) -> uint64_t { return element[1] != 1; });
+        sums.set_galois_keys(0, galois_keys);
+        counts.set_galois_keys(0, galois_keys);
+
+        auto start = high_resolution_clock::now();
+        sum_replies.push_back(sums.generate_reply(query, 0, masks[s]));
+        auto end = high_resolution_clock::now();
+        count_replies.push_back(counts.generate_reply(query, 0));
+        cout << "Main: server " << s << " aggregated " << cohort.size() << " of "
+             << number_of_items << " elements in "
+             << duration_cast<milliseconds>(end - start).count() << " ms" << endl;
+        if (s == 0 && client.decode_reply(sum_replies[0]) == expected_sum % t) {
+            cout << "Main: a single masked reply reveals its total" << endl;
+            return -1;
+        }
+    }
+
+    uint64_t sum = client.decode_replies(sum_replies);
+    uint64_t count = client.decode_replies(count_replies);
+    cout << "Main: total " << sum << ", blacklisted " << count << endl;
+    if (sum != expected_sum % t || count != expected_count % t) {
+        cout << "Main: expected total " << expected_sum << ", blacklisted "
+             << expected_count << endl;
+        return -1;
+    }
+
+    // zero field plaintexts are skipped; with no others the total is still
+    // a valid encryption of 0
+    {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        unique_ptr<const uint8_t[]> bytes(move(db));
+        AggregateServer zeros(enc_params);
+        zeros.set_database(bytes, number_of_items, size_per_item,
+                           aggregate_field_bytes(0, 1));
+        zeros.set_galois_keys(0, galois_keys);
+        if (client.decode_reply(zeros.generate_reply(query, 0)) != 0) {
+            cout << "Main: total over zero fields is not 0" << endl;
+            return -1;
+        }
+    }
+
+    AggregateServer server(enc_params);
+    auto small(make_unique<uint8_t[]>(2));
+    unique_ptr<const uint8_t[]> small_bytes(move(small));
+    server.set_database(small_bytes, 1, 2, aggregate_field_bytes(0, 2));
+    server.set_galois_keys(0, galois_keys);
+    try {
+        server.generate_reply(query, 0);
+        cout << "Main: query for another database size was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+
+    cout << "Main: aggregate result correct!" << endl;
+    return 0;
+}
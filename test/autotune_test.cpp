@@ -0,0 +1,68 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+#include "pir_autotune.hpp"
+
+#include <seal/seal.h>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+// Retrieves one element with the tuned parameters
+static bool tuned_retrieval_works(const TuneResult &tuned, uint64_t number_of_items,
+                                  uint64_t size_per_item) {
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+    uint64_t ele_index = rd() % number_of_items;
+    vector<uint8_t> expected(db.get() + ele_index * size_per_item,
+                             db.get() + (ele_index + 1) * size_per_item);
+
+    PIRClient client(tuned.enc_params, tuned.pir_params);
+    PIRServer server(tuned.enc_params, tuned.pir_params);
+    server.set_galois_key(0, client.generate_galois_keys());
+    server.set_database(move(db), number_of_items, size_per_item);
+
+    PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+    PirReply reply = server.generate_reply(query, 0);
+    return client.decode_reply(reply, client.get_fv_offset(ele_index)) == expected;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 14;
+    uint64_t size_per_item = 288; // in bytes
+
+    TuneOptions options;
+    options.poly_degrees = {4096};
+    options.plain_bits = {16, 20};
+    options.max_d = 2;
+
+    options.objective = TUNE_LATENCY;
+    TuneResult fastest = autotune_pir_params(number_of_items, size_per_item, options);
+    options.objective = TUNE_BANDWIDTH;
+    TuneResult smallest = autotune_pir_params(number_of_items, size_per_item, options);
+
+    for (const TuneResult *tuned : {&fastest, &smallest}) {
+        print_pir_params(tuned->pir_params);
+        cout << "Main: estimated " << tuned->server_seconds * 1000 << " ms, "
+             << tuned->query_bytes << " query bytes, " << tuned->reply_bytes
+             << " reply bytes" << endl;
+        if (!tuned_retrieval_works(*tuned, number_of_items, size_per_item)) {
+            cout << "Main: tuned parameters retrieve the wrong element" << endl;
+            return -1;
+        }
+    }
+
+    // each objective must win on its own measure
+    if (fastest.server_seconds > smallest.server_seconds ||
+        smallest.query_bytes + smallest.reply_bytes >
+            fastest.query_bytes + fastest.reply_bytes) {
+        cout << "Main: objectives did not rank the candidates consistently" << endl;
+        return -1;
+    }
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
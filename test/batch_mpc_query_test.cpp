@@ -88,14 +88,14 @@ int main(int argc, char *argv[]) {
     cout << "Main: Number of batched pir queries is " << batch_pir_query.size() << endl;
     cout << endl;
 
-    server_A.refresh_and_set_rand_vec(batch_pir_query.size());
-    vector<uint64_t> rand_vec_B, rand_vec_C;
-    server_A.output_rand_vec_to_send(rand_vec_B, rand_vec_C);
-    server_B.set_rand_vec_to_use(rand_vec_B);
-    server_C.set_rand_vec_to_use(rand_vec_C);
-    cout << "Main: Assume Server A is the server who provides random trio vector." << endl;
-    cout << "Server A: Outputted random trio vector to Server B,C." << endl;
-    cout << "Server B/C: Set random trio vector received from Server A." << endl;
+    server_A.refresh_mask_seeds();
+    MaskSeed seed_B, seed_C;
+    server_A.output_mask_seeds(seed_B, seed_C);
+    server_B.set_mask_seed(seed_B);
+    server_C.set_mask_seed(seed_C);
+    cout << "Main: Assume Server A is the server who provides the mask seeds." << endl;
+    cout << "Server A: Outputted one " << sizeof(MaskSeed) << "-byte mask seed to each of Server B,C." << endl;
+    cout << "Server B/C: Set mask seed received from Server A." << endl;
     cout << endl;
 
     PirBatchReply reply_A = server_A.gen_batch_reply(batch_pir_query, 0);
@@ -0,0 +1,138 @@
+#include "pir.hpp"
+
+#include <chrono>
+#include <random>
+
+using namespace std;
+using namespace std::chrono;
+
+// The original bit-at-a-time converters, kept as the reference layout.
+vector<uint64_t> reference_bytes_to_coeffs(uint32_t limit, const uint8_t *bytes,
+                                           uint64_t size) {
+    uint64_t size_out = coefficients_per_element(limit, size);
+    vector<uint64_t> output(size_out);
+    uint32_t room = limit;
+    uint64_t *target = &output[0];
+
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t src = bytes[i];
+        uint32_t rest = 8;
+        while (rest) {
+            if (room == 0) {
+                target++;
+                room = limit;
+            }
+            uint32_t shift = rest;
+            if (room < rest) {
+                shift = room;
+            }
+            *target = *target << shift;
+            *target = *target | (src >> (8 - shift));
+            src = src << shift;
+            room -= shift;
+            rest -= shift;
+        }
+    }
+    *target = *target << room;
+    return output;
+}
+
+void reference_coeffs_to_bytes(uint32_t limit, const vector<uint64_t> &coeffs,
+                               uint8_t *output, uint32_t size_out, uint32_t ele_size) {
+    uint32_t room = 8;
+    uint32_t j = 0;
+    uint8_t *target = output;
+    uint32_t bits_left = ele_size * 8;
+    for (uint32_t i = 0; i < coeffs.size(); i++) {
+        if (bits_left == 0) {
+            bits_left = ele_size * 8;
+        }
+        uint64_t src = coeffs[i];
+        uint32_t rest = min(limit, bits_left);
+        while (rest && j < size_out) {
+            uint32_t shift = rest;
+            if (room < rest) {
+                shift = room;
+            }
+            target[j] = target[j] << shift;
+            target[j] = target[j] | (src >> (limit - shift));
+            src = src << shift;
+            room -= shift;
+            rest -= shift;
+            bits_left -= shift;
+            if (room == 0) {
+                j++;
+                room = 8;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    mt19937_64 gen(42);
+    bool failed = false;
+
+    for (uint32_t logt = 8; logt <= 30; logt++) {
+        for (uint64_t ele_size : {1UL, 2UL, 3UL, 7UL, 20UL, 33UL, 288UL, 1024UL}) {
+            uint64_t ele_num = 5;
+            vector<uint8_t> bytes(ele_num * ele_size);
+            for (auto &b : bytes) {
+                b = gen();
+            }
+
+            vector<uint64_t> coeffs, ref_coeffs;
+            for (uint64_t e = 0; e < ele_num; e++) {
+                vector<uint64_t> c = bytes_to_coeffs(logt, bytes.data() + e * ele_size, ele_size);
+                vector<uint64_t> r = reference_bytes_to_coeffs(logt, bytes.data() + e * ele_size, ele_size);
+                coeffs.insert(coeffs.end(), c.begin(), c.end());
+                ref_coeffs.insert(ref_coeffs.end(), r.begin(), r.end());
+            }
+            if (coeffs != ref_coeffs) {
+                cout << "Main: bytes_to_coeffs mismatch, logt " << logt
+                     << ", ele_size " << ele_size << endl;
+                failed = true;
+            }
+
+            // trailing coefficients, as in a padded plaintext, must be ignored
+            coeffs.insert(coeffs.end(), 3, (1ULL << logt) - 1);
+            vector<uint8_t> out(bytes.size()), ref_out(bytes.size());
+            coeffs_to_bytes(logt, coeffs, out.data(), out.size(), ele_size);
+            reference_coeffs_to_bytes(logt, coeffs, ref_out.data(), ref_out.size(), ele_size);
+            if (out != ref_out || out != bytes) {
+                cout << "Main: coeffs_to_bytes mismatch, logt " << logt
+                     << ", ele_size " << ele_size << endl;
+                failed = true;
+            }
+        }
+    }
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: packers match the reference layout." << endl;
+
+    // throughput for the parameters used by the tests
+    for (uint32_t logt : {16U, 20U}) {
+        uint64_t ele_size = 1024;
+        uint64_t ele_num = 1 << 14;
+        uint64_t cpe = coefficients_per_element(logt, ele_size);
+        vector<uint8_t> bytes(ele_num * ele_size);
+        for (auto &b : bytes) {
+            b = gen();
+        }
+        vector<uint64_t> coeffs(ele_num * cpe);
+
+        auto t0 = high_resolution_clock::now();
+        for (uint64_t e = 0; e < ele_num; e++) {
+            bytes_to_coeffs(logt, bytes.data() + e * ele_size, ele_size, coeffs.data() + e * cpe);
+        }
+        auto t1 = high_resolution_clock::now();
+        coeffs_to_bytes(logt, coeffs.data(), coeffs.size(), bytes.data(), bytes.size(), ele_size);
+        auto t2 = high_resolution_clock::now();
+
+        double mb = bytes.size() / 1e6;
+        cout << "Main: logt " << logt << ": pack "
+             << mb / (duration_cast<microseconds>(t1 - t0).count() / 1e6) << " MB/s, unpack "
+             << mb / (duration_cast<microseconds>(t2 - t1).count() / 1e6) << " MB/s" << endl;
+    }
+    return 0;
+}
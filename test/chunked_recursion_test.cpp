@@ -0,0 +1,83 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 11;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+
+    for (uint32_t d = 2; d <= 3; d++) {
+        EncryptionParameters enc_params(scheme_type::bfv);
+        PirParams pir_params;
+        gen_encryption_params(N, logt, enc_params);
+        verify_encryption_params(enc_params);
+        gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+        print_pir_params(pir_params);
+
+        PIRClient client(enc_params, pir_params);
+        PIRServer server(enc_params, pir_params);
+        server.set_galois_key(0, client.generate_galois_keys());
+        auto bytes(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        copy(db.get(), db.get() + number_of_items * size_per_item, bytes.get());
+        server.set_database(move(bytes), number_of_items, size_per_item);
+
+        uint64_t ele_index = rd() % number_of_items;
+        uint64_t offset = client.get_fv_offset(ele_index);
+        PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+
+        PirReply reference_reply = server.generate_reply(query, 0);
+        uint64_t reference_mults =
+            server.metrics().snapshot().counters[COUNT_MULTIPLY_PLAIN];
+        vector<uint8_t> reference = client.decode_reply(reference_reply, offset);
+
+        server.set_chunked_recursion(true);
+        server.metrics().reset();
+        PirReply reply = server.generate_reply(query, 0);
+        if (reply.size() != reference_reply.size() ||
+            server.metrics().snapshot().counters[COUNT_MULTIPLY_PLAIN] !=
+                reference_mults) {
+            cout << "Main: chunked recursion changed the amount of work (d = " << d
+                 << ")" << endl;
+            return -1;
+        }
+        vector<uint8_t> elems = client.decode_reply(reply, offset);
+
+        // streamed outputs must still arrive in index order
+        PIRReplyDecoder decoder(client);
+        uint64_t expected_index = 0;
+        server.generate_reply_streaming(
+            query, 0, [&](uint64_t index, uint64_t count, const string &ct) {
+                assert(index == expected_index);
+                expected_index++;
+                decoder.add(ct);
+            });
+        vector<uint8_t> streamed = client.extract_bytes(decoder.result(), offset);
+
+        for (uint64_t i = 0; i < size_per_item; i++) {
+            uint8_t expected = db.get()[ele_index * size_per_item + i];
+            if (reference[i] != expected || elems[i] != expected ||
+                streamed[i] != expected) {
+                cout << "Main: chunked reply wrong at byte " << i << " (d = " << d
+                     << ")" << endl;
+                return -1;
+            }
+        }
+        cout << "Main: d = " << d << " chunked recursion matches" << endl;
+    }
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <chrono>
+#include <random>
+
+using namespace std::chrono;
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 12;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 1; // only the database is scanned
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+
+    // the first plaintext holds no data, so it is padding
+    random_device rd;
+    vector<uint8_t> db(number_of_items * size_per_item);
+    for (uint64_t i = pir_params.elements_per_plaintext * size_per_item; i < db.size(); i++) {
+        db[i] = rd() % 256;
+    }
+    auto copy_db = [&]() {
+        auto bytes(make_unique<uint8_t[]>(db.size()));
+        copy(db.begin(), db.end(), bytes.get());
+        return bytes;
+    };
+
+    PIRClient client(enc_params, pir_params);
+    GaloisKeys galois_keys = client.generate_galois_keys();
+    PIRServer ntt_server(enc_params, pir_params);
+    PIRServer compact_server(enc_params, pir_params);
+    ntt_server.set_galois_key(0, galois_keys);
+    compact_server.set_galois_key(0, galois_keys);
+    compact_server.set_compact_residency(true);
+    ntt_server.set_database(copy_db(), number_of_items, size_per_item);
+    compact_server.set_database(copy_db(), number_of_items, size_per_item);
+
+    bool failed = false;
+    double ntt_ms = 0, compact_ms = 0;
+    for (uint64_t ele_index : {uint64_t(0), rd() % number_of_items, number_of_items - 1}) {
+        uint64_t index = client.get_fv_index(ele_index);
+        uint64_t offset = client.get_fv_offset(ele_index);
+        PirQuery query = client.generate_query(index);
+
+        auto start = high_resolution_clock::now();
+        PirReply ntt_reply = ntt_server.generate_reply(query, 0);
+        auto middle = high_resolution_clock::now();
+        PirReply compact_reply = compact_server.generate_reply(query, 0);
+        auto end = high_resolution_clock::now();
+        ntt_ms += duration_cast<microseconds>(middle - start).count() / 1000.0;
+        compact_ms += duration_cast<microseconds>(end - middle).count() / 1000.0;
+
+        vector<uint8_t> elems = client.decode_reply(compact_reply, offset);
+        if (!equal(elems.begin(), elems.end(), db.begin() + ele_index * size_per_item) ||
+            elems != client.decode_reply(ntt_reply, offset)) {
+            cout << "Main: element " << ele_index << " was not retrieved" << endl;
+            failed = true;
+        }
+
+        // a compact plaintext answers plain queries as well
+        if (ele_index > 0) {
+            compact_server.set_one_ct(client.get_one());
+            Plaintext pt = client.decrypt(compact_server.simple_query(index));
+            vector<uint8_t> simple = client.extract_bytes(pt, offset);
+            if (!equal(simple.begin(), simple.end(), db.begin() + ele_index * size_per_item)) {
+                cout << "Main: simple query of " << ele_index << " differs" << endl;
+                failed = true;
+            }
+        }
+    }
+
+    // the first dimension reads the resident plaintexts once per reply
+    MetricsSnapshot ntt_stats = ntt_server.metrics().snapshot();
+    MetricsSnapshot compact_stats = compact_server.metrics().snapshot();
+    double ratio = (double)ntt_stats.counters[COUNT_BYTES_SCANNED] /
+                   compact_stats.counters[COUNT_BYTES_SCANNED];
+    cout << "Main: compact residency reads " << ratio << "x fewer bytes; replies took "
+         << compact_ms << " ms against " << ntt_ms << " ms in NTT form" << endl;
+    if (ratio < 5) {
+        cout << "Main: compact plaintexts are not compact" << endl;
+        failed = true;
+    }
+
+    try {
+        compact_server.simple_set(0, Plaintext());
+        cout << "Main: compact database was modified in place" << endl;
+        failed = true;
+    } catch (const logic_error &) {
+    }
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: compact database retrieval correct!" << endl;
+    return 0;
+}
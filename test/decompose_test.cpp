@@ -0,0 +1,80 @@
+#include "pir.hpp"
+
+#include <seal/seal.h>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+
+    SEALContext context(enc_params, true);
+    KeyGenerator keygen(context);
+    PublicKey public_key;
+    keygen.create_public_key(public_key);
+    Encryptor encryptor(context, public_key);
+    Evaluator evaluator(context);
+
+    random_device rd;
+    Plaintext pt(N);
+    for (uint32_t i = 0; i < N; i++) {
+        pt[i] = rd() % enc_params.plain_modulus().value();
+    }
+    Ciphertext ct;
+    encryptor.encrypt(pt, ct);
+
+    // the first and the mod switched level of a reply
+    vector<Ciphertext> levels = {ct, ct};
+    evaluator.mod_switch_to_inplace(levels[1], context.last_parms_id());
+
+    for (auto &level : levels) {
+        EncryptionParameters parms = context.get_context_data(level.parms_id())->parms();
+        DecompositionPlan plan = make_decomposition_plan(parms);
+
+        // matches the ratio the PIR parameters are derived from
+        uint32_t expected_ratio = 0;
+        for (auto &q : parms.coeff_modulus()) {
+            expected_ratio += ceil(log2(q.value()) / logt);
+        }
+        if (plan.expansion_ratio != expected_ratio) {
+            cout << "Main: plan ratio " << plan.expansion_ratio << " != " << expected_ratio
+                 << endl;
+            return -1;
+        }
+
+        // the plan output matches the allocating form, also when the storage
+        // was left NTT transformed by a previous level
+        vector<Plaintext> reference = decompose_to_plaintexts(parms, level);
+        vector<Plaintext> plains(reference.size());
+        for (int round = 0; round < 2; round++) {
+            decompose_to_plaintexts(plan, level, plains.data());
+            for (size_t i = 0; i < plains.size(); i++) {
+                if (plains[i] != reference[i]) {
+                    cout << "Main: plaintext " << i << " differs" << endl;
+                    return -1;
+                }
+                evaluator.transform_to_ntt_inplace(plains[i], context.first_parms_id());
+            }
+        }
+
+        Ciphertext composed(context, level.parms_id());
+        compose_to_ciphertext(plan, reference.begin(), level.size(), composed);
+        for (size_t poly = 0; poly < level.size(); poly++) {
+            for (size_t c = 0; c < N * parms.coeff_modulus().size(); c++) {
+                if (composed.data(poly)[c] != level.data(poly)[c]) {
+                    cout << "Main: composed ciphertext differs" << endl;
+                    return -1;
+                }
+            }
+        }
+        cout << "Main: " << parms.coeff_modulus().size() << " moduli, "
+             << plan.expansion_ratio << " plaintexts per polynomial" << endl;
+    }
+    cout << "Main: decomposition round trip correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 1;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+
+    random_device rd;
+    bool failed = false;
+    // 1 and 2 byte records are the per-phone sums and blacklist flags; 3 and
+    // 7 straddle coefficients at every offset; 288 is the default record
+    for (uint64_t size_per_item : {1, 2, 3, 7, 288}) {
+        uint64_t number_of_items = 3 * elements_per_ptxt(logt, N, size_per_item, true) + 5;
+        PirParams sparse_params, pir_params;
+        gen_pir_params(number_of_items, size_per_item, d, enc_params, sparse_params);
+        gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params,
+                       false, true, true, false, true);
+        cout << "Main: " << size_per_item << "-byte elements: "
+             << pir_params.elements_per_plaintext << " per plaintext, "
+             << pir_params.num_of_plaintexts << " plaintexts ("
+             << sparse_params.num_of_plaintexts << " without dense packing)"
+             << endl;
+        if (pir_params.num_of_plaintexts > sparse_params.num_of_plaintexts ||
+            pir_params.elements_per_plaintext * 8 * size_per_item > N * logt ||
+            coefficients_per_ptxt(pir_params, logt) > N) {
+            cout << "Main: dense packing does not fit" << endl;
+            return -1;
+        }
+        // the bits of an element are wasted only at the end of a plaintext
+        if (size_per_item == 1 && pir_params.elements_per_plaintext != N * logt / 8) {
+            cout << "Main: 1-byte elements are not packed densely" << endl;
+            return -1;
+        }
+
+        vector<uint8_t> db(number_of_items * size_per_item);
+        for (auto &b : db) {
+            b = rd() % 256;
+        }
+        auto bytes(make_unique<uint8_t[]>(db.size()));
+        copy(db.begin(), db.end(), bytes.get());
+        unique_ptr<const uint8_t[]> db_bytes(move(bytes));
+
+        PIRClient client(enc_params, pir_params);
+        GaloisKeys galois_keys = client.generate_galois_keys();
+        PIRServer server(enc_params, pir_params);
+        server.set_galois_key(0, galois_keys);
+        server.set_database(db_bytes, number_of_items, size_per_item);
+
+        // a plaintext's first and last elements, the last element of the
+        // database and a random one
+        uint64_t per_ptxt = pir_params.elements_per_plaintext;
+        for (uint64_t ele_index : {per_ptxt, 2 * per_ptxt - 1, number_of_items - 1,
+                                   rd() % number_of_items}) {
+            uint64_t index = client.get_fv_index(ele_index);
+            uint64_t offset = client.get_fv_offset(ele_index);
+            PirQuery query = client.generate_query(index);
+
+            PirReply reply = server.generate_reply(query, 0);
+            Plaintext result = client.decode_reply(reply);
+            vector<uint8_t> elems = client.extract_bytes(result, offset);
+            if (!equal(elems.begin(), elems.end(), db.begin() + ele_index * size_per_item)) {
+                cout << "Main: element " << ele_index << " of size " << size_per_item
+                     << " was not retrieved" << endl;
+                failed = true;
+            }
+
+            // elements share coefficients, so the mask must cover all of them
+            uint64_t mod = enc_params.plain_modulus().value();
+            uint64_t r = rd() % (mod - 1) + 1;
+            PirReply masked = server.generate_reply_with_add_confusion(query, 0, r);
+            vector<uint64_t> plain = client.extract_coeffs(result);
+            vector<uint64_t> confused = client.extract_coeffs(client.decode_reply(masked));
+            for (uint64_t i = 0; i < coefficients_per_ptxt(pir_params, logt); i++) {
+                if ((plain[i] + r) % mod != confused[i]) {
+                    cout << "Main: coefficient " << i << " is not masked" << endl;
+                    failed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: densely packed elements retrieved correctly!" << endl;
+    return 0;
+}
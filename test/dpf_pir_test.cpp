@@ -0,0 +1,108 @@
+#include "pir_xor.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace std::chrono;
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = argc > 1 ? stoull(argv[1]) : (1UL << 16) + 13;
+    uint64_t size_per_item = argc > 2 ? stoull(argv[2]) : 100;
+
+    // FIPS-197 appendix C.1 on both AES implementations
+    const uint8_t aes_key[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    const uint8_t aes_expected[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+                                      0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+    DpfBlock plain;
+    uint8_t *plain_bytes = reinterpret_cast<uint8_t *>(&plain);
+    for (int i = 0; i < 16; i++) {
+        plain_bytes[i] = 0x11 * i;
+    }
+    for (bool aesni : {true, false}) {
+        dpf_use_aesni(aesni);
+        DpfBlock cipher;
+        dpf_aes128_encrypt(aes_key, &plain, &cipher, 1);
+        if (!equal(aes_expected, aes_expected + 16, reinterpret_cast<uint8_t *>(&cipher))) {
+            cout << "Main: AES known answer failed (aesni " << aesni << ")" << endl;
+            return -1;
+        }
+    }
+    dpf_use_aesni(true);
+    cout << "Main: AES-NI " << (dpf_aesni_available() ? "available" : "not available") << endl;
+
+    // the two keys XOR to the unit vector, point by point and over the domain
+    random_device rd;
+    ThreadPool pool(4);
+    for (uint64_t domain_size : {1UL, 100UL, 128UL, 129UL, 5000UL}) {
+        uint32_t bits = dpf_domain_bits(domain_size);
+        uint64_t alpha = rd() % domain_size;
+        auto keys = dpf_gen(alpha, bits);
+        vector<uint64_t> full0 = dpf_eval_full(keys.first, domain_size, pool);
+        dpf_use_aesni(false);
+        vector<uint64_t> full1 = dpf_eval_full(keys.second, domain_size, pool);
+        dpf_use_aesni(true);
+        for (uint64_t x = 0; x < domain_size; x++) {
+            bool share0 = dpf_eval(keys.first, x);
+            bool share1 = dpf_eval(keys.second, x);
+            if ((share0 ^ share1) != (x == alpha) ||
+                share0 != ((full0[x >> 6] >> (x & 63)) & 1) ||
+                share1 != ((full1[x >> 6] >> (x & 63)) & 1)) {
+                cout << "Main: DPF evaluation wrong at " << x << " of " << domain_size << endl;
+                return -1;
+            }
+        }
+        DpfKey copy = deserialize_dpf_key(serialize_dpf_key(keys.first));
+        if (dpf_eval_full(copy, domain_size, pool) != full0) {
+            cout << "Main: DPF key serialization is lossy" << endl;
+            return -1;
+        }
+    }
+
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+    unique_ptr<const uint8_t[]> bytes(move(db));
+
+    vector<XorPirServer> servers(2);
+    servers[0].set_num_threads(1);
+    servers[1].set_num_threads(4);
+    for (auto &server : servers) {
+        server.set_database(bytes, number_of_items, size_per_item);
+    }
+    XorPirClient client(number_of_items, size_per_item, 2);
+
+    for (uint64_t index : {uint64_t(0), number_of_items - 1, rd() % number_of_items}) {
+        vector<DpfKey> keys = client.generate_dpf_query(index);
+        uint64_t key_bytes = serialize_dpf_key(keys[0]).size();
+        auto start = high_resolution_clock::now();
+        vector<XorReply> replies = {servers[0].generate_reply(keys[0]),
+                                    servers[1].generate_reply(keys[1])};
+        auto end = high_resolution_clock::now();
+        vector<uint8_t> elem = client.decode_reply(replies);
+        if (!equal(elem.begin(), elem.end(), bytes.get() + index * size_per_item)) {
+            cout << "Main: element " << index << " is wrong" << endl;
+            return -1;
+        }
+        cout << "Main: element " << index << " with " << key_bytes << " byte keys in "
+             << duration_cast<microseconds>(end - start).count() << " us" << endl;
+    }
+
+    try {
+        servers[0].generate_reply(dpf_gen(0, dpf_domain_bits(number_of_items) + 1).first);
+        cout << "Main: key for another domain was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+    try {
+        XorPirClient(number_of_items, size_per_item, 3).generate_dpf_query(0);
+        cout << "Main: DPF query for three servers was accepted" << endl;
+        return -1;
+    } catch (const logic_error &) {
+    }
+
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -16,7 +16,7 @@ int main()
 {
 
     uint8_t dim_of_items_number = 32;
-    uint64_t number_of_items = 1 << dim_of_items_number;
+    uint64_t number_of_items = 1UL << dim_of_items_number;
     uint64_t size_per_item = 1024; // in bytes
     uint32_t N = 4096;
     uint32_t logt = 20;
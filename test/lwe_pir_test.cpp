@@ -0,0 +1,75 @@
+#include "pir_lwe.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace std::chrono;
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = argc > 1 ? stoull(argv[1]) : (1UL << 14) + 13;
+    uint64_t size_per_item = argc > 2 ? stoull(argv[2]) : 3;
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+    unique_ptr<const uint8_t[]> bytes(move(db));
+
+    LwePirServer server;
+    server.set_num_threads(4);
+    auto start = high_resolution_clock::now();
+    server.set_database(bytes, number_of_items, size_per_item);
+    auto end = high_resolution_clock::now();
+    string hint_bytes = serialize_lwe_hint(server.hint());
+    cout << "Main: " << server.hint().rows << " x " << server.hint().cols << " matrix, "
+         << hint_bytes.size() << " byte hint in "
+         << duration_cast<milliseconds>(end - start).count() << " ms" << endl;
+
+    // the client works from the downloaded hint
+    LwePirClient client(deserialize_lwe_hint(hint_bytes));
+
+    vector<uint64_t> indices = {0, number_of_items - 1, rd() % number_of_items,
+                                rd() % number_of_items};
+    vector<LweQuery> queries;
+    vector<LweQuerySecret> secrets(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        queries.push_back(client.generate_query(indices[i], secrets[i]));
+    }
+
+    start = high_resolution_clock::now();
+    vector<LweReply> replies = server.generate_replies(queries);
+    end = high_resolution_clock::now();
+    cout << "Main: " << indices.size() << " queries answered in "
+         << duration_cast<microseconds>(end - start).count() << " us" << endl;
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        vector<uint8_t> elem = client.decode_reply(replies[i], secrets[i]);
+        if (!equal(elem.begin(), elem.end(), bytes.get() + indices[i] * size_per_item)) {
+            cout << "Main: element " << indices[i] << " is wrong" << endl;
+            return -1;
+        }
+        if (server.generate_reply(queries[i]) != replies[i]) {
+            cout << "Main: batched and single replies differ" << endl;
+            return -1;
+        }
+    }
+
+    try {
+        server.generate_reply(LweQuery(1));
+        cout << "Main: short query was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+    try {
+        deserialize_lwe_hint(hint_bytes.substr(0, hint_bytes.size() - 1));
+        cout << "Main: truncated hint was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "pir.hpp"
+#include "pir_client.hpp"
+#include "pir_server.hpp"
+#include "pir_mask.hpp"
+
+#include <seal/seal.h>
+#include <random>
+#include <set>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 10;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 1;
+    uint32_t batch_size = 10000;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+    gen_encryption_params(N, logt, enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    uint64_t mod = enc_params.plain_modulus().value();
+
+    PIRServer server_A(enc_params, pir_params);
+    PIRServer server_B(enc_params, pir_params);
+    PIRServer server_C(enc_params, pir_params);
+    PIRServer server_B2(enc_params, pir_params);
+
+    bool failed = false;
+    MaskSeed previous_B{};
+    for (int batch = 0; batch < 2; batch++) {
+        server_A.refresh_mask_seeds();
+        MaskSeed seed_B, seed_C;
+        server_A.output_mask_seeds(seed_B, seed_C);
+        if (seed_B == seed_C || seed_B == previous_B) {
+            cout << "Main: mask seeds repeat" << endl;
+            failed = true;
+        }
+        previous_B = seed_B;
+        server_B.set_mask_seed(seed_B);
+        server_C.set_mask_seed(seed_C);
+        server_B2.set_mask_seed(seed_B);
+
+        set<uint64_t> distinct;
+        for (uint32_t i = 0; i < batch_size; i++) {
+            uint64_t a = server_A.next_mask();
+            uint64_t b = server_B.next_mask();
+            uint64_t c = server_C.next_mask();
+            if (a >= mod || b >= mod || c >= mod || (a + b + c) % mod != 0) {
+                cout << "Main: masks " << i << " do not cancel" << endl;
+                return -1;
+            }
+            // a peer holding the same seed derives the same masks
+            if (server_B2.next_mask() != b) {
+                cout << "Main: mask " << i << " differs between holders of a seed" << endl;
+                return -1;
+            }
+            distinct.insert(b);
+        }
+        // birthday bound: about batch_size^2 / 2t collisions are expected
+        if (distinct.size() < batch_size - 100) {
+            cout << "Main: only " << distinct.size() << " distinct masks" << endl;
+            failed = true;
+        }
+    }
+
+    uint64_t r1, r2, r3, s1, s2, s3;
+    server_A.gen_rand_trio(r1, r2, r3);
+    server_A.gen_rand_trio(s1, s2, s3);
+    if ((r1 + r2 + r3) % mod != 0 || (s1 + s2 + s3) % mod != 0 ||
+        (r1 == s1 && r2 == s2)) {
+        cout << "Main: random trios are wrong" << endl;
+        failed = true;
+    }
+
+    // the scaled template matches encoding the mask slots directly
+    SEALContext context(enc_params, true);
+    BatchEncoder encoder(context);
+    uint64_t coeff_per_ele = coefficients_per_element(logt, size_per_item);
+    vector<uint64_t> slots(pir_params.elements_per_plaintext * coeff_per_ele, 0);
+    for (uint64_t i = 1; i <= pir_params.elements_per_plaintext; i++) {
+        slots[i * coeff_per_ele - 1] = r1;
+    }
+    Plaintext expected;
+    encoder.encode(slots, expected);
+    if (server_A.gen_rand_pt(r1) != expected) {
+        cout << "Main: mask plaintext differs from the encoded mask" << endl;
+        failed = true;
+    }
+
+    // masks r and -r cancel in the decoded replies
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+    PIRClient client(enc_params, pir_params);
+    server_A.set_galois_key(0, client.generate_galois_keys());
+    server_A.set_database(move(db), number_of_items, size_per_item);
+    PirQuery query = client.generate_query(client.get_fv_index(rd() % number_of_items));
+
+    vector<vector<uint64_t>> decoded;
+    for (uint64_t r : {uint64_t(0), r1, mod - r1}) {
+        PirReply reply = server_A.generate_reply_with_add_confusion(query, 0, r);
+        vector<uint64_t> values;
+        encoder.decode(client.decode_reply(reply), values);
+        decoded.push_back(move(values));
+    }
+    for (size_t i = 0; i < decoded[0].size(); i++) {
+        if ((decoded[1][i] + decoded[2][i]) % mod != 2 * decoded[0][i] % mod) {
+            cout << "Main: masked replies do not cancel at slot " << i << endl;
+            failed = true;
+            break;
+        }
+    }
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: masks of " << batch_size << " queries derived from "
+         << sizeof(MaskSeed) << "-byte seeds cancel." << endl;
+    return 0;
+}
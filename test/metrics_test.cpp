@@ -0,0 +1,90 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+#include "pir_metrics.hpp"
+
+#include <seal/seal.h>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 11;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+
+    PIRClient client(enc_params, pir_params);
+    PIRServer server(enc_params, pir_params);
+    server.set_galois_key(0, client.generate_galois_keys());
+    server.set_database(move(db), number_of_items, size_per_item);
+
+    PirQuery query = client.generate_query(client.get_fv_index(0));
+    PirReply reply = server.generate_reply(query, 0);
+    client.decode_reply(reply, client.get_fv_offset(0));
+
+    MetricsSnapshot stats = server.metrics().snapshot();
+    uint64_t n0 = pir_params.nvec[0], n1 = pir_params.nvec[1];
+    uint64_t second_level = reply.size() * n1; // decomposed plaintexts scanned
+    bool failed = false;
+    auto expect = [&](bool ok, const string &what) {
+        if (!ok) {
+            cout << "Main: unexpected " << what << endl;
+            failed = true;
+        }
+    };
+
+    expect(stats.counters[COUNT_REQUESTS] == 1, "request count");
+    // the padding plaintexts of a column fold into one product; every column
+    // holds data here, as the database covers at least its first row
+    uint64_t padded_columns = min(n1, n0 * n1 - pir_params.num_of_plaintexts);
+    expect(stats.counters[COUNT_MULTIPLY_PLAIN] ==
+               pir_params.num_of_plaintexts + padded_columns + second_level,
+           "multiply_plain count");
+    expect(stats.counters[COUNT_NTT_INVERSE] == n1 + reply.size(), "inverse NTT count");
+    expect(stats.counters[COUNT_NTT_FORWARD] == n0 + n1 + second_level,
+           "forward NTT count");
+    expect(stats.counters[COUNT_APPLY_GALOIS] > 0, "apply_galois count");
+    expect(stats.counters[COUNT_BYTES_SCANNED] > 0, "scanned bytes");
+    for (MetricPhase phase : {PHASE_EXPAND, PHASE_NTT, PHASE_SCAN, PHASE_INTT,
+                              PHASE_MOD_SWITCH, PHASE_DECOMPOSE, PHASE_REQUEST}) {
+        expect(stats.phases[phase].count > 0, string(metric_phase_name(phase)) + " timing");
+    }
+    expect(stats.phases[PHASE_REQUEST].count == 1, "request timing count");
+
+    MetricsSnapshot client_stats = client.metrics().snapshot();
+    expect(client_stats.phases[PHASE_QUERY].count == 1, "query timing count");
+    expect(client_stats.counters[COUNT_DECRYPT] == reply.size() + 1, "decrypt count");
+
+    string text = server.metrics().prometheus("pir_server");
+    cout << text;
+    expect(text.find("pir_server_requests_total 1\n") != string::npos,
+           "Prometheus counter");
+    expect(text.find("pir_server_phase_seconds_bucket{phase=\"request\",le=\"+Inf\"} 1\n") !=
+               string::npos,
+           "Prometheus histogram");
+
+    server.metrics().reset();
+    expect(server.metrics().snapshot().counters[COUNT_REQUESTS] == 0, "reset");
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: metrics consistent." << endl;
+    return 0;
+}
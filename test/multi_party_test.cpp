@@ -0,0 +1,105 @@
+#include "pir.hpp"
+#include "pir_client.hpp"
+#include "pir_multiparty.hpp"
+#include "pir_server.hpp"
+
+#include <seal/seal.h>
+#include <chrono>
+#include <random>
+
+using namespace std::chrono;
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 12;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 1;
+    uint32_t party_count = argc > 1 ? stoi(argv[1]) : 4;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+    uint64_t mod = enc_params.plain_modulus().value();
+
+    PIRClient client(enc_params, pir_params);
+    GaloisKeys galois_keys = client.generate_galois_keys();
+
+    // Each party holds its own share of the database
+    random_device rd;
+    vector<vector<uint8_t>> dbs(party_count);
+    vector<unique_ptr<PIRServer>> servers;
+    for (uint32_t p = 0; p < party_count; p++) {
+        auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+        for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+            db.get()[i] = rd() % 256;
+        }
+        dbs[p].assign(db.get(), db.get() + number_of_items * size_per_item);
+        servers.push_back(make_unique<PIRServer>(enc_params, pir_params));
+        servers[p]->set_galois_key(0, galois_keys);
+        servers[p]->set_database(move(db), number_of_items, size_per_item);
+        servers[p]->preprocess_database();
+    }
+
+    // k-way masks: party 0 draws the seeds and hands one to every other party
+    servers[0]->refresh_mask_seeds(party_count);
+    vector<MaskSeed> seeds = servers[0]->output_mask_seeds();
+    for (uint32_t p = 1; p < party_count; p++) {
+        servers[p]->set_mask_seed(seeds[p - 1]);
+    }
+
+    MultiPartyQuery orchestrator(client);
+    for (uint32_t p = 0; p < party_count; p++) {
+        PIRServer *server = servers[p].get();
+        orchestrator.add_party([server](PirQuery &query) {
+            return server->generate_reply_with_add_confusion(query, 0, server->next_mask());
+        });
+    }
+
+    uint64_t ele_index = rd() % number_of_items;
+    uint64_t offset = client.get_fv_offset(ele_index);
+    PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+
+    auto start = high_resolution_clock::now();
+    vector<uint8_t> elem = orchestrator.query(query, offset);
+    auto end = high_resolution_clock::now();
+    cout << "Main: " << party_count << "-party query took "
+         << duration_cast<milliseconds>(end - start).count() << " ms" << endl;
+
+    // The result is the sum of the parties' element coefficients mod t
+    uint64_t coeff_per_ele = coefficients_per_element(logt, size_per_item);
+    vector<uint64_t> sum(coeff_per_ele, 0);
+    for (uint32_t p = 0; p < party_count; p++) {
+        vector<uint64_t> coeffs = bytes_to_coeffs(
+            logt, dbs[p].data() + ele_index * size_per_item, size_per_item);
+        for (uint64_t i = 0; i < coeff_per_ele; i++) {
+            sum[i] = (sum[i] + coeffs[i]) % mod;
+        }
+    }
+    vector<uint8_t> expected(size_per_item);
+    coeffs_to_bytes(logt, sum.data(), coeff_per_ele, expected.data(), size_per_item,
+                    size_per_item);
+    if (elem != expected) {
+        cout << "Main: multi-party result is wrong" << endl;
+        return -1;
+    }
+
+    // A failing party surfaces as an exception from the query
+    orchestrator.add_party([](PirQuery &) -> PirReply {
+        throw runtime_error("party unavailable");
+    });
+    try {
+        orchestrator.query(query, offset);
+        cout << "Main: failing party was not reported" << endl;
+        return -1;
+    } catch (const runtime_error &e) {
+        cout << "Main: failing party reported: " << e.what() << endl;
+    }
+
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "pir.hpp"
+#include "pir_client.hpp"
+#include "pir_numa.hpp"
+
+#include <seal/seal.h>
+#include <random>
+#include <thread>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 12;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    if (parse_cpu_list("0-3,8,10-11") != vector<uint32_t>{0, 1, 2, 3, 8, 10, 11}) {
+        cout << "Main: cpu list parsed wrong" << endl;
+        return -1;
+    }
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+
+    random_device rd;
+    vector<uint8_t> db(number_of_items * size_per_item);
+    for (auto &b : db) {
+        b = rd() % 256;
+    }
+    auto bytes(make_unique<uint8_t[]>(db.size()));
+    copy(db.begin(), db.end(), bytes.get());
+    unique_ptr<const uint8_t[]> const_bytes(move(bytes));
+
+    vector<NumaNode> nodes = numa_nodes();
+    cout << "Main: " << nodes.size() << " NUMA node(s)" << endl;
+    // The host topology, and three nodes simulated on the first node's CPUs
+    // so the split and merge are exercised on a single-node machine too
+    vector<vector<NumaNode>> topologies = {
+        nodes, {{0, nodes[0].cpus}, {1, nodes[0].cpus}, {2, nodes[0].cpus}}};
+
+    PIRClient client(enc_params, pir_params);
+    GaloisKeys galois_keys = client.generate_galois_keys();
+
+    bool failed = false;
+    for (auto &topology : topologies) {
+        NumaServer server(enc_params, pir_params, topology);
+        server.set_galois_key(0, galois_keys);
+        server.set_database(const_bytes, number_of_items, size_per_item);
+
+        // the replies are generated two at a time, on concurrent requests
+        vector<uint64_t> ele_indices = {0, rd() % number_of_items, number_of_items - 1};
+        vector<PirQuery> queries;
+        for (uint64_t ele_index : ele_indices) {
+            queries.push_back(client.generate_query(client.get_fv_index(ele_index)));
+        }
+        vector<PirReply> replies(ele_indices.size());
+        for (size_t t = 0; t < ele_indices.size(); t += 2) {
+            vector<thread> requests;
+            for (size_t u = t; u < min(t + 2, ele_indices.size()); u++) {
+                requests.emplace_back([&, u]() { replies[u] = server.generate_reply(queries[u], 0); });
+            }
+            for (auto &request : requests) {
+                request.join();
+            }
+        }
+        vector<vector<uint8_t>> results;
+        for (size_t t = 0; t < ele_indices.size(); t++) {
+            results.push_back(client.decode_reply(replies[t], client.get_fv_offset(ele_indices[t])));
+        }
+
+        for (size_t t = 0; t < ele_indices.size(); t++) {
+            if (!equal(results[t].begin(), results[t].begin() + size_per_item,
+                       db.begin() + ele_indices[t] * size_per_item)) {
+                cout << "Main: PIR result wrong for element " << ele_indices[t]
+                     << " with " << server.num_nodes() << " node(s)" << endl;
+                failed = true;
+            }
+        }
+    }
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: NUMA PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+#include "pir_service.hpp"
+
+#include <seal/seal.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 11;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t num_clients = 3;
+    uint32_t queries_per_client = 4;
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    auto db_copy(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+        db_copy.get()[i] = db.get()[i];
+    }
+
+    PIRServer server(enc_params, pir_params);
+    server.set_database(move(db), number_of_items, size_per_item);
+
+    PIRService service(server, enc_params, pir_params, 2);
+    service.set_max_in_flight(2); // below queries_per_client to exercise backpressure
+    uint16_t port = service.listen("127.0.0.1", 0);
+    thread loop([&]() { service.run(); });
+
+    // Each client pipelines all its queries on one connection before reading
+    // any reply.
+    atomic<bool> failed(false);
+    vector<thread> clients;
+    for (uint32_t c = 0; c < num_clients; c++) {
+        clients.emplace_back([&, c]() {
+            try {
+                PIRClient client(enc_params, pir_params);
+                PIRServiceClient connection(enc_params, "127.0.0.1", port);
+                connection.upload_galois_key(c, client.generate_galois_keys());
+
+                mt19937_64 gen(c);
+                map<uint64_t, uint64_t> expected; // request id -> element
+                for (uint32_t q = 0; q < queries_per_client; q++) {
+                    uint64_t ele_index = gen() % number_of_items;
+                    PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+                    expected[connection.send_query(c, query)] = ele_index;
+                }
+                // the first client decodes the streamed parts as they come
+                map<uint64_t, PIRReplyDecoder> decoders;
+                uint32_t finished = 0;
+                while (finished < queries_per_client) {
+                    uint64_t request_id;
+                    Plaintext result;
+                    if (c == 0) {
+                        ReplyPart part = connection.receive_reply_part();
+                        request_id = part.request_id;
+                        auto it = decoders.emplace(request_id, PIRReplyDecoder(client)).first;
+                        it->second.add(part.ciphertext);
+                        if (!it->second.done()) {
+                            continue;
+                        }
+                        result = it->second.result();
+                    } else {
+                        PirReply reply;
+                        request_id = connection.receive_reply(reply);
+                        result = client.decode_reply(reply);
+                    }
+                    finished++;
+
+                    uint64_t ele_index = expected.at(request_id);
+                    vector<uint8_t> elems =
+                        client.extract_bytes(result, client.get_fv_offset(ele_index));
+                    for (uint64_t i = 0; i < size_per_item; i++) {
+                        if (elems[i] != db_copy.get()[ele_index * size_per_item + i]) {
+                            cout << "Main: client " << c << " got a wrong element "
+                                 << ele_index << endl;
+                            failed = true;
+                            break;
+                        }
+                    }
+                }
+
+                // a blocking query while another reply is in flight: the
+                // other reply, if it arrives first, is kept for receive_reply
+                {
+                    uint64_t index_a = gen() % number_of_items;
+                    uint64_t index_b = gen() % number_of_items;
+                    uint64_t request_a = connection.send_query(
+                        c, client.generate_query(client.get_fv_index(index_a)));
+                    PirReply reply_b = connection.query(
+                        c, client.generate_query(client.get_fv_index(index_b)));
+                    PirReply reply_a;
+                    if (connection.receive_reply(reply_a) != request_a) {
+                        cout << "Main: client " << c << " got the wrong pipelined reply" << endl;
+                        failed = true;
+                    }
+                    for (auto &[ele_index, reply] :
+                         {make_pair(index_a, &reply_a), make_pair(index_b, &reply_b)}) {
+                        vector<uint8_t> elems =
+                            client.decode_reply(*reply, client.get_fv_offset(ele_index));
+                        if (!equal(elems.begin(), elems.begin() + size_per_item,
+                                   db_copy.get() + ele_index * size_per_item)) {
+                            cout << "Main: client " << c << " got a wrong element "
+                                 << ele_index << " next to a pipelined query" << endl;
+                            failed = true;
+                        }
+                    }
+                }
+
+                // an unknown client id is reported, not fatal for the service
+                try {
+                    connection.query(num_clients + c, client.generate_query(0));
+                    cout << "Main: missing galois key was not reported" << endl;
+                    failed = true;
+                } catch (const runtime_error &) {
+                }
+
+                // another connection can neither replace this client's key
+                // nor query with it
+                PIRServiceClient intruder(enc_params, "127.0.0.1", port);
+                try {
+                    intruder.upload_galois_key(c, client.generate_galois_keys());
+                    cout << "Main: galois key of client " << c << " was replaced" << endl;
+                    failed = true;
+                } catch (const runtime_error &) {
+                }
+                try {
+                    intruder.query(c, client.generate_query(0));
+                    cout << "Main: query with a foreign client id was served" << endl;
+                    failed = true;
+                } catch (const runtime_error &) {
+                }
+            } catch (const exception &e) {
+                cout << "Main: client " << c << " failed: " << e.what() << endl;
+                failed = true;
+            }
+        });
+    }
+    for (auto &t : clients) {
+        t.join();
+    }
+
+    {
+        PIRServiceClient observer(enc_params, "127.0.0.1", port);
+        string text = observer.metrics();
+        if (text.find("pir_server_requests_total " +
+                      to_string(num_clients * (queries_per_client + 2))) == string::npos) {
+            cout << "Main: service metrics do not count the queries" << endl;
+            failed = true;
+        }
+    }
+    service.stop();
+    loop.join();
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "pir.hpp"
+#include "pir_psi.hpp"
+
+#include <seal/seal.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+
+using namespace std::chrono;
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint32_t N = argc > 1 ? stoi(argv[1]) : 8192;
+    uint32_t logt = 20;
+    uint64_t blacklist_size = argc > 2 ? stoull(argv[2]) : 20000;
+
+    EncryptionParameters enc_params(scheme_type::bfv);
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+
+    // ids are database indices `x || 0`, as import_blacklist returns them
+    mt19937_64 rng(random_device{}());
+    set<uint64_t> blacklist_set;
+    while (blacklist_set.size() < blacklist_size) {
+        blacklist_set.insert(rng() & 0xfffffffe);
+    }
+    vector<uint64_t> blacklist(blacklist_set.begin(), blacklist_set.end());
+
+    PsiServer server(enc_params);
+    auto start = high_resolution_clock::now();
+    server.set_blacklist(blacklist);
+    auto end = high_resolution_clock::now();
+    cout << "Main: " << blacklist_size << " ids in " << server.partition_count()
+         << " partitions, set up in " << duration_cast<milliseconds>(end - start).count()
+         << " ms" << endl;
+
+    PsiClient client(enc_params);
+    server.set_relin_keys(0, client.generate_relin_keys());
+
+    // half members, half (almost surely) not, plus a repeated id
+    vector<uint64_t> ids;
+    vector<bool> expected;
+    while (ids.size() + 1 < client.capacity()) {
+        bool in = ids.size() % 2 == 0;
+        uint64_t id = in ? blacklist[rng() % blacklist.size()] : rng() & 0xfffffffe;
+        if (!in && blacklist_set.count(id)) {
+            continue;
+        }
+        ids.push_back(id);
+        expected.push_back(in);
+    }
+    ids.push_back(ids[1]);
+    expected.push_back(expected[1]);
+
+    PsiQuery query = client.generate_query(ids);
+    start = high_resolution_clock::now();
+    PsiReply reply = server.generate_reply(query, 0);
+    end = high_resolution_clock::now();
+    vector<bool> member = client.decode_reply(reply);
+    cout << "Main: " << ids.size() << " membership tests in "
+         << duration_cast<milliseconds>(end - start).count() << " ms, "
+         << query.size() << " query and " << reply.size() << " reply ciphertexts" << endl;
+
+    uint64_t false_positives = 0;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (expected[i] && !member[i]) {
+            cout << "Main: blacklisted id " << ids[i] << " was missed" << endl;
+            return -1;
+        }
+        false_positives += !expected[i] && member[i];
+    }
+    // about (bin load) / t per test
+    if (false_positives > ids.size() / 100) {
+        cout << "Main: " << false_positives << " false positives" << endl;
+        return -1;
+    }
+
+    try {
+        client.generate_query(vector<uint64_t>(client.capacity() + 1));
+        cout << "Main: oversized query was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+    try {
+        server.generate_reply(query, 1);
+        cout << "Main: reply without relinearization keys" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+
+    cout << "Main: PSI result correct!" << endl;
+    return 0;
+}
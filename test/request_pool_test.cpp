@@ -0,0 +1,87 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <atomic>
+#include <random>
+#include <thread>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 11;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    uint32_t num_threads = 4;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+    auto db_copy(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    copy(db.get(), db.get() + number_of_items * size_per_item, db_copy.get());
+
+    PIRClient client(enc_params, pir_params);
+    PIRServer server(enc_params, pir_params);
+    server.set_galois_key(0, client.generate_galois_keys());
+    server.set_database(move(db_copy), number_of_items, size_per_item);
+    server.preprocess_database();
+
+    vector<uint64_t> indices;
+    vector<PirQuery> queries;
+    for (uint32_t t = 0; t < num_threads; t++) {
+        indices.push_back(rd() % number_of_items);
+        queries.push_back(client.generate_query(client.get_fv_index(indices[t])));
+    }
+
+    // Replies draw from their own pools: the global pool must not grow
+    // while concurrent requests run, in either recursion mode.
+    for (bool chunked : {false, true}) {
+        server.set_chunked_recursion(chunked);
+        uint64_t global_before = MemoryManager::GetPool().alloc_byte_count();
+
+        vector<PirReply> replies(num_threads);
+        vector<thread> workers;
+        for (uint32_t t = 0; t < num_threads; t++) {
+            workers.emplace_back(
+                [&, t]() { replies[t] = server.generate_reply(queries[t], 0); });
+        }
+        for (auto &w : workers) {
+            w.join();
+        }
+
+        uint64_t global_after = MemoryManager::GetPool().alloc_byte_count();
+        if (global_after != global_before) {
+            cout << "Main: replies allocated " << global_after - global_before
+                 << " bytes from the global pool (chunked = " << chunked << ")" << endl;
+            return -1;
+        }
+
+        for (uint32_t t = 0; t < num_threads; t++) {
+            vector<uint8_t> elems =
+                client.decode_reply(replies[t], client.get_fv_offset(indices[t]));
+            for (uint64_t i = 0; i < size_per_item; i++) {
+                if (elems[i] != db.get()[indices[t] * size_per_item + i]) {
+                    cout << "Main: reply " << t << " wrong at byte " << i << endl;
+                    return -1;
+                }
+            }
+        }
+        cout << "Main: " << num_threads << " concurrent replies correct (chunked = "
+             << chunked << ")" << endl;
+    }
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <random>
+#include <sstream>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 11;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+
+    for (uint32_t d = 2; d <= 3; d++) {
+        for (bool symmetric : {false, true}) {
+            EncryptionParameters enc_params(scheme_type::bfv);
+            PirParams pir_params;
+            gen_encryption_params(N, logt, enc_params);
+            verify_encryption_params(enc_params);
+            gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params,
+                           symmetric, true, true, true);
+            print_pir_params(pir_params);
+
+            PIRClient client(enc_params, pir_params);
+            PIRServer server(enc_params, pir_params);
+            server.set_galois_key(0, client.generate_galois_keys());
+            auto bytes(make_unique<uint8_t[]>(number_of_items * size_per_item));
+            copy(db.get(), db.get() + number_of_items * size_per_item, bytes.get());
+            server.set_database(move(bytes), number_of_items, size_per_item);
+
+            for (uint64_t ele_index : {uint64_t(0), number_of_items - 1,
+                                       rd() % number_of_items}) {
+                uint64_t offset = client.get_fv_offset(ele_index);
+                uint64_t fv_index = client.get_fv_index(ele_index);
+
+                // the serialized query goes through the server's parser
+                stringstream query_stream;
+                client.generate_serialized_query(fv_index, query_stream);
+                PirQuery query = server.deserialize_query(query_stream);
+                for (uint32_t i = 1; i < d; i++) {
+                    if (query[i].size() != folding_bits(pir_params.nvec[i]) *
+                                               rgsw_ciphertexts_per_bit(enc_params)) {
+                        cout << "Main: wrong number of RGSW rows (d = " << d << ")" << endl;
+                        return -1;
+                    }
+                }
+
+                PirReply reply = server.generate_reply(query, 0);
+                if (reply.size() != 1) {
+                    cout << "Main: folded reply has " << reply.size()
+                         << " ciphertexts (d = " << d << ")" << endl;
+                    return -1;
+                }
+                stringstream reply_stream;
+                int reply_bytes = server.serialize_reply(reply, reply_stream);
+
+                vector<uint8_t> elems = client.decode_reply(reply, offset);
+                // streamed replies decode with the same single layer
+                PIRReplyDecoder decoder(client);
+                server.generate_reply_streaming(
+                    query, 0,
+                    [&](uint64_t index, uint64_t count, const string &ct) {
+                        assert(index == 0 && count == 1);
+                        decoder.add(ct);
+                    });
+                vector<uint8_t> streamed = client.extract_bytes(decoder.result(), offset);
+
+                for (uint64_t i = 0; i < size_per_item; i++) {
+                    uint8_t expected = db.get()[ele_index * size_per_item + i];
+                    if (elems[i] != expected || streamed[i] != expected) {
+                        cout << "Main: folded reply wrong at byte " << i << " (d = " << d
+                             << ", element " << ele_index << ")" << endl;
+                        return -1;
+                    }
+                }
+                cout << "Main: d = " << d << ", element " << ele_index << ": "
+                     << reply_bytes << " byte reply" << endl;
+            }
+        }
+    }
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+#include "pir_shard.hpp"
+#include "net.hpp"
+
+#include <seal/seal.h>
+#include <random>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 12;
+    uint64_t size_per_item = 288; // in bytes
+    uint32_t num_shards = 3;
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+
+    random_device rd;
+    vector<uint8_t> db(number_of_items * size_per_item);
+    for (auto &b : db) {
+        b = rd() % 256;
+    }
+
+    // One process per shard, each listening on its own loopback port.
+    auto ranges = shard_row_ranges(pir_params, num_shards);
+    vector<pair<string, uint16_t>> endpoints;
+    vector<pid_t> children;
+    for (auto &range : ranges) {
+        int listen_fd = tcp_listen("127.0.0.1", 0);
+        endpoints.emplace_back("127.0.0.1", tcp_local_port(listen_fd));
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            uint64_t first_element, num_elements;
+            shard_element_range(pir_params, range.first, range.second, first_element, num_elements);
+            auto bytes(make_unique<uint8_t[]>(num_elements * size_per_item));
+            copy(db.begin() + first_element * size_per_item,
+                 db.begin() + (first_element + num_elements) * size_per_item, bytes.get());
+
+            PIRServer shard(enc_params, pir_params);
+            shard.set_shard(range.first, range.second);
+            shard.set_database(move(bytes), num_elements, size_per_item);
+            serve_shard(shard, enc_params, listen_fd, 1);
+            _exit(0);
+        }
+        tcp_close(listen_fd);
+        children.push_back(pid);
+        cout << "Main: Shard for rows [" << range.first << ", " << range.second
+             << ") on port " << endpoints.back().second << endl;
+    }
+
+    bool failed = false;
+    {
+        PIRClient client(enc_params, pir_params);
+        ShardCoordinator coordinator(enc_params, pir_params, endpoints);
+        coordinator.set_galois_key(0, client.generate_galois_keys());
+
+        for (int t = 0; t < 3; t++) {
+            uint64_t ele_index = rd() % number_of_items;
+            uint64_t index = client.get_fv_index(ele_index);
+            uint64_t offset = client.get_fv_offset(ele_index);
+            PirQuery query = client.generate_query(index);
+            PirReply reply = coordinator.generate_reply(query, 0);
+            vector<uint8_t> elems = client.decode_reply(reply, offset);
+
+            for (uint64_t i = 0; i < size_per_item; i++) {
+                if (elems[i] != db[ele_index * size_per_item + i]) {
+                    cout << "Main: PIR result wrong at element " << ele_index
+                         << ", byte " << i << endl;
+                    failed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cout << "Main: shard process failed" << endl;
+            failed = true;
+        }
+    }
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: Sharded PIR result correct!" << endl;
+    return 0;
+}
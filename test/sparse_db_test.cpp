@@ -0,0 +1,94 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <chrono>
+#include <random>
+#include <set>
+
+using namespace std::chrono;
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 18;
+    uint64_t size_per_item = 2; // phone count, blacklist byte, as imp_data lays them out
+    uint64_t occupied_blocks = 5;
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+
+    random_device rd;
+    bool failed = false;
+    // without dense packing the elements fill every coefficient, so the
+    // padding plaintext is zero; with it the last coefficients are padding
+    for (bool dense : {false, true}) {
+        PirParams pir_params;
+        gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params,
+                       false, true, true, false, dense);
+        uint64_t per_ptxt = pir_params.elements_per_plaintext;
+
+        // the ids in use fall in a few plaintexts; the rest are zero bytes
+        vector<uint8_t> db(number_of_items * size_per_item, 0);
+        set<uint64_t> blocks;
+        while (blocks.size() < occupied_blocks) {
+            blocks.insert(rd() % pir_params.num_of_plaintexts);
+        }
+        vector<uint64_t> used;
+        for (uint64_t block : blocks) {
+            for (uint64_t i = 0; i < 100; i++) {
+                uint64_t id = min(number_of_items - 1, block * per_ptxt + rd() % per_ptxt);
+                db[id * size_per_item] = rd() % 255 + 1;
+                db[id * size_per_item + 1] = 1;
+                used.push_back(id);
+            }
+        }
+        auto bytes(make_unique<uint8_t[]>(db.size()));
+        copy(db.begin(), db.end(), bytes.get());
+
+        PIRClient client(enc_params, pir_params);
+        PIRServer server(enc_params, pir_params);
+        server.set_galois_key(0, client.generate_galois_keys());
+        server.set_database(move(bytes), number_of_items, size_per_item);
+
+        for (uint64_t ele_index : {used[0], used[rd() % used.size()], used.back(),
+                                   rd() % number_of_items, number_of_items - 1}) {
+            PirQuery query = client.generate_query(client.get_fv_index(ele_index));
+            auto start = high_resolution_clock::now();
+            PirReply reply = server.generate_reply(query, 0);
+            auto end = high_resolution_clock::now();
+            vector<uint8_t> elems = client.decode_reply(reply, client.get_fv_offset(ele_index));
+            if (!equal(elems.begin(), elems.end(), db.begin() + ele_index * size_per_item)) {
+                cout << "Main: element " << ele_index << " was not retrieved" << endl;
+                failed = true;
+            }
+            cout << "Main: element " << ele_index << " retrieved in "
+                 << duration_cast<milliseconds>(end - start).count() << " ms" << endl;
+        }
+
+        // only the occupied plaintexts, one folded padding product per
+        // column and the second level are multiplied
+        MetricsSnapshot stats = server.metrics().snapshot();
+        uint64_t n1 = pir_params.nvec[1];
+        uint64_t reply_size = pir_params.expansion_ratio;
+        uint64_t bound = 5 * (occupied_blocks + n1 + reply_size * n1);
+        cout << "Main: " << (dense ? "dense" : "per-element") << " packing, "
+             << pir_params.num_of_plaintexts << " plaintexts, "
+             << stats.counters[COUNT_MULTIPLY_PLAIN] / 5 << " multiply_plain per reply"
+             << endl;
+        if (stats.counters[COUNT_MULTIPLY_PLAIN] > bound) {
+            cout << "Main: padding plaintexts were scanned" << endl;
+            failed = true;
+        }
+    }
+
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: sparse database retrieval correct!" << endl;
+    return 0;
+}
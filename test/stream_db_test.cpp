@@ -0,0 +1,94 @@
+#include "pir.hpp"
+#include "pir_server.hpp"
+#include "pir_client.hpp"
+
+#include <seal/seal.h>
+#include <random>
+
+using namespace std;
+using namespace seal;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = 1UL << 11;
+    uint64_t size_per_item = 288; // in bytes
+    uint64_t rows_per_chunk = 7;  // deliberately not a divisor of ele_per_ptxt
+    uint32_t N = 4096;
+    uint32_t logt = 20;
+    uint32_t d = 2;
+    EncryptionParameters enc_params(scheme_type::bfv);
+    PirParams pir_params;
+
+    gen_encryption_params(N, logt, enc_params);
+    verify_encryption_params(enc_params);
+    gen_pir_params(number_of_items, size_per_item, d, enc_params, pir_params);
+    print_pir_params(pir_params);
+
+    PIRClient client(enc_params, pir_params);
+    PIRServer server(enc_params, pir_params);
+    server.set_galois_key(0, client.generate_galois_keys());
+    server.set_num_threads(3);
+
+    random_device rd;
+    vector<uint8_t> db(number_of_items * size_per_item);
+    for (auto &b : db) {
+        b = rd() % 256;
+    }
+
+    // Feeds chunk_rows rows per call, stopping after `limit` rows
+    auto producer = [&](uint64_t chunk_rows, uint64_t limit, uint64_t &produced) {
+        produced = 0;
+        return [&, chunk_rows, limit](vector<uint8_t> &chunk) {
+            if (produced == limit) {
+                return false;
+            }
+            uint64_t rows = min(chunk_rows, limit - produced);
+            chunk.assign(db.begin() + produced * size_per_item,
+                         db.begin() + (produced + rows) * size_per_item);
+            produced += rows;
+            return true;
+        };
+    };
+
+    // A producer that runs dry must not leave padding in place of rows
+    uint64_t produced;
+    try {
+        server.set_database(producer(rows_per_chunk, number_of_items / 2, produced),
+                            number_of_items, size_per_item);
+        cout << "Main: short producer was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+
+    // Small chunks cover a fraction of a plaintext; large ones span several
+    // plaintexts per call and keep several encode batches in flight.
+    bool failed = false;
+    uint64_t large_chunk = 5 * pir_params.elements_per_plaintext + 3;
+    for (uint64_t rows : {rows_per_chunk, large_chunk}) {
+        server.set_database(producer(rows, number_of_items, produced),
+                            number_of_items, size_per_item);
+        cout << "Main: Streamed database built from " << rows
+             << "-row chunks." << endl;
+        for (int t = 0; t < 3; t++) {
+            uint64_t ele_index = rd() % number_of_items;
+            uint64_t index = client.get_fv_index(ele_index);
+            uint64_t offset = client.get_fv_offset(ele_index);
+            PirQuery query = client.generate_query(index);
+            PirReply reply = server.generate_reply(query, 0);
+            vector<uint8_t> elems = client.decode_reply(reply, offset);
+
+            for (uint64_t i = 0; i < size_per_item; i++) {
+                if (elems[i] != db[ele_index * size_per_item + i]) {
+                    cout << "Main: PIR result wrong at element " << ele_index
+                         << ", byte " << i << endl;
+                    failed = true;
+                    break;
+                }
+            }
+        }
+    }
+    if (failed) {
+        return -1;
+    }
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "pir_xor.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace std::chrono;
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    uint64_t number_of_items = argc > 1 ? stoull(argv[1]) : (1UL << 16) + 13;
+    uint64_t size_per_item = argc > 2 ? stoull(argv[2]) : 100; // not a whole number of words
+
+    random_device rd;
+    auto db(make_unique<uint8_t[]>(number_of_items * size_per_item));
+    for (uint64_t i = 0; i < number_of_items * size_per_item; i++) {
+        db.get()[i] = rd() % 256;
+    }
+    unique_ptr<const uint8_t[]> bytes(move(db));
+
+    for (uint32_t num_servers : {2, 3}) {
+        vector<XorPirServer> servers(num_servers);
+        for (uint32_t s = 0; s < num_servers; s++) {
+            servers[s].set_num_threads(s + 1);
+            servers[s].set_database(bytes, number_of_items, size_per_item);
+        }
+        XorPirClient client(number_of_items, size_per_item, num_servers);
+
+        vector<uint64_t> indices = {0, number_of_items - 1, rd() % number_of_items,
+                                    rd() % number_of_items};
+        vector<vector<XorQuery>> queries; // per index, one per server
+        for (uint64_t index : indices) {
+            queries.push_back(client.generate_query(index));
+            // a single server's share is not the unit vector
+            if (queries.back()[0] == queries.back()[num_servers - 1]) {
+                cout << "Main: query shares are identical" << endl;
+                return -1;
+            }
+        }
+
+        // every server answers the whole batch in one pass
+        vector<vector<XorReply>> replies(indices.size(), vector<XorReply>(num_servers));
+        auto start = high_resolution_clock::now();
+        for (uint32_t s = 0; s < num_servers; s++) {
+            vector<XorQuery> batch;
+            for (auto &q : queries) {
+                batch.push_back(q[s]);
+            }
+            vector<XorReply> server_replies = servers[s].generate_replies(batch);
+            for (size_t i = 0; i < indices.size(); i++) {
+                replies[i][s] = server_replies[i];
+            }
+        }
+        auto end = high_resolution_clock::now();
+
+        for (size_t i = 0; i < indices.size(); i++) {
+            vector<uint8_t> elem = client.decode_reply(replies[i]);
+            if (!equal(elem.begin(), elem.end(), bytes.get() + indices[i] * size_per_item)) {
+                cout << "Main: element " << indices[i] << " is wrong" << endl;
+                return -1;
+            }
+            if (servers[0].generate_reply(queries[i][0]) != replies[i][0]) {
+                cout << "Main: batched and single replies differ" << endl;
+                return -1;
+            }
+        }
+        cout << "Main: " << num_servers << " servers answered " << indices.size()
+             << " queries in " << duration_cast<microseconds>(end - start).count()
+             << " us" << endl;
+    }
+
+    XorPirServer server;
+    server.set_database(bytes, number_of_items, size_per_item);
+    try {
+        server.generate_reply(XorQuery(1));
+        cout << "Main: short query was accepted" << endl;
+        return -1;
+    } catch (const invalid_argument &) {
+    }
+
+    cout << "Main: PIR result correct!" << endl;
+    return 0;
+}